@@ -0,0 +1,224 @@
+// Counts the heap allocations that connection_pool makes per segment request once it has warmed
+// up. The segments are requested from a local server, a few at a time, as while recording; only
+// the allocations of the thread that runs the pool are counted.
+//
+// Usage: allocation_benchmark [-c <concurrent requests>] [-n <segments>] [-s <segment size>]
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "connection.h"
+#include "connection_pool.h"
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+
+static const size_t buffer_pool_size = 32 * 1024 * 1024;
+
+static thread_local bool counting = false;
+static thread_local size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+	if (counting)
+		allocations++;
+
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+
+	throw std::bad_alloc {};
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+class segment_server {
+		asio::io_context io;
+		tcp::acceptor acceptor {io, {asio::ip::make_address("127.0.0.1"), 0}};
+		const std::string body;
+
+		void accept()
+		{
+			for (;;)
+				std::thread {&segment_server::serve, this, acceptor.accept()}
+				    .detach();
+		}
+
+		void serve(tcp::socket socket)
+		{
+			beast::flat_buffer buffer;
+			beast::error_code ec;
+
+			for (;;) {
+				http::request<http::empty_body> request;
+				http::response<http::string_body> response {http::status::ok, 11};
+
+				http::read(socket, buffer, request, ec);
+
+				if (ec)
+					break;
+
+				response.set(http::field::content_type, "video/mp2t");
+				response.body() = body;
+				response.keep_alive(true);
+				response.prepare_payload();
+				http::write(socket, response, ec);
+
+				if (ec)
+					break;
+			}
+		}
+
+	public:
+		explicit segment_server(size_t segment_size) : body(segment_size, 'A')
+		{
+			std::thread {&segment_server::accept, this}.detach();
+		}
+
+		unsigned short get_port() const
+		{
+			return acceptor.local_endpoint().port();
+		}
+};
+
+struct counters {
+	size_t in_flight = 0;
+	size_t remaining = 0;
+};
+
+// Requests the next segment once a segment has been received, as long as some remain.
+class segment_sink : public response_sink {
+		connection_pool * const pool = nullptr;
+		const std::string * const host = nullptr;
+		counters * const c = nullptr;
+
+	public:
+		segment_sink(connection_pool *pool, const std::string *host, counters *c) :
+		    pool(pool), host(host), c(c)
+		{
+		}
+
+		bool on_header(const response_header& header) override
+		{
+			return header.result() == http::status::ok;
+		}
+
+		void on_body(const char *, size_t, const std::shared_ptr<body_reader>& r) override
+		{
+			r->resume();
+		}
+
+		void on_complete() override
+		{
+			c->in_flight--;
+
+			if (c->remaining)
+				request();
+		}
+
+		void request()
+		{
+			// The segment names have the same length, as with most packagers.
+			char resource[32];
+			const int n = std::snprintf(
+			    resource, sizeof(resource), "/segment-%07zu.ts", c->remaining);
+
+			c->remaining--;
+			c->in_flight++;
+			pool->get(false, *host, {resource, static_cast<size_t>(n)}, this, [] {
+				BOOST_LOG_TRIVIAL(error) << "Request failed.";
+				std::exit(EXIT_FAILURE);
+			});
+		}
+};
+
+static size_t run(const std::string& host, size_t num_concurrent, size_t num_segments)
+{
+	asio::io_context io;
+	connection_pool pool {&io, buffer_pool_size};
+	std::vector<std::unique_ptr<segment_sink>> sinks;
+	counters c;
+
+	for (size_t i = 0; i < num_concurrent; i++)
+		sinks.push_back(std::make_unique<segment_sink>(&pool, &host, &c));
+
+	// The pool first warms up, and the allocations are counted for a second round of
+	// segments on the same connections.
+	for (const bool count : {false, true}) {
+		c.remaining = num_segments;
+		allocations = 0;
+		counting = count;
+
+		for (auto& s : sinks)
+			s->request();
+
+		while (c.in_flight)
+			io.run_one();
+
+		counting = false;
+	}
+
+	// The pool closes the idle connections before it is destroyed.
+	io.run();
+	return allocations;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num_concurrent = 4;
+	size_t num_segments = 10000;
+	size_t segment_size = 100000;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 < argc && !std::strcmp(argv[i], "-c"))
+			num_concurrent = std::max(std::strtoull(argv[++i], nullptr, 10), 1ULL);
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-n"))
+			num_segments = std::strtoull(argv[++i], nullptr, 10);
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-s"))
+			segment_size = std::strtoull(argv[++i], nullptr, 10);
+		else {
+			std::cerr << "Usage: " << argv[0]
+				  << " [-c <concurrent requests>] [-n <segments>] [-s <segment "
+				     "size>]\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	boost::log::core::get()->set_filter(boost::log::trivial::severity >=
+					    boost::log::trivial::warning);
+
+	segment_server server {segment_size};
+	const std::string host = "127.0.0.1:" + std::to_string(server.get_port());
+
+	num_segments = std::max(num_segments, num_concurrent);
+
+	const auto a = run(host, num_concurrent, num_segments);
+
+	std::cout << num_segments << " segments of " << segment_size << " bytes, "
+		  << num_concurrent << " at a time: " << static_cast<double>(a) / num_segments
+		  << " allocations per segment\n";
+	std::cout.flush();
+	std::quick_exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,341 @@
+// A mock LL-HLS origin for latency measurements. It publishes a part every part duration, holds
+// blocking playlist reloads and preload hint requests until they can be answered, and reports how
+// long after publication the parts and segments were delivered.
+//
+// Usage: ll_hls_origin [-d <duration in s>] [-l] [-p <port>] [-s <part size>]
+//			[-t <part duration in ms>]
+//
+// With -l the playlist has no LL-HLS tags, so a client has to poll for whole segments. The
+// playlist is served at /live.m3u8.
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+
+static const int max_hold_target_durations = 3;
+static const size_t parts_per_segment = 4;
+static const size_t window_segments = 6;
+// The number of complete segments that still list their parts.
+static const size_t window_part_segments = 2;
+
+struct latency_statistics {
+	std::vector<double> latencies;
+	const char *name;
+
+	explicit latency_statistics(const char *name) : name(name)
+	{
+	}
+
+	void print()
+	{
+		if (latencies.empty()) {
+			std::cout << name << ": none\n";
+			return;
+		}
+
+		std::sort(latencies.begin(), latencies.end());
+
+		double total = 0;
+
+		for (const auto l : latencies)
+			total += l;
+
+		std::cout << name << ": count = " << latencies.size()
+			  << " mean = " << total / latencies.size()
+			  << " ms p50 = " << latencies[latencies.size() / 2]
+			  << " ms p99 = " << latencies[latencies.size() * 99 / 100]
+			  << " ms max = " << latencies.back() << " ms\n";
+	}
+};
+
+class origin {
+		std::mutex mutex;
+		latency_statistics part_latencies {"Part latency"};
+		latency_statistics segment_latencies {"Segment latency"};
+		const std::chrono::steady_clock::time_point start;
+		const std::chrono::milliseconds part_duration;
+		const size_t part_size;
+		size_t blocking_reloads = 0;
+		size_t playlist_requests = 0;
+		const bool low_latency;
+
+		std::string get_part(size_t part) const
+		{
+			return std::string(part_size, static_cast<char>('A' + part % 26));
+		}
+
+		std::string get_playlist() const;
+
+		std::chrono::steady_clock::time_point get_publication_time(size_t part) const
+		{
+			return start + part_duration * (part + 1);
+		}
+
+		size_t get_published_parts() const
+		{
+			return (std::chrono::steady_clock::now() - start) / part_duration;
+		}
+
+		std::chrono::milliseconds get_target_duration() const
+		{
+			return part_duration * static_cast<int>(parts_per_segment);
+		}
+
+		void record(latency_statistics *statistics, size_t part)
+		{
+			const std::chrono::duration<double, std::milli> latency =
+			    std::chrono::steady_clock::now() - get_publication_time(part);
+			std::lock_guard<std::mutex> lock {mutex};
+
+			statistics->latencies.push_back(latency.count());
+		}
+
+		// Waits until the part is published; returns false if that takes too long.
+		bool wait(size_t part) const
+		{
+			const auto t = get_publication_time(part);
+
+			if (t - std::chrono::steady_clock::now() >
+			    get_target_duration() * max_hold_target_durations)
+				return false;
+
+			std::this_thread::sleep_until(t);
+			return true;
+		}
+
+	public:
+		origin(std::chrono::milliseconds part_duration,
+		       size_t part_size,
+		       bool low_latency) :
+		    start(std::chrono::steady_clock::now()),
+		    part_duration(part_duration),
+		    part_size(part_size),
+		    low_latency(low_latency)
+		{
+		}
+
+		void handle(tcp::socket socket);
+		void print_statistics();
+};
+
+static size_t get_query_parameter(const std::string_view& query,
+				  const std::string_view& name,
+				  bool *found)
+{
+	const auto pos = query.find(name);
+	size_t ret = 0;
+
+	*found = pos != std::string_view::npos;
+
+	if (*found)
+		std::from_chars(query.data() + pos + name.size(), query.data() + query.size(), ret);
+
+	return ret;
+}
+
+std::string origin::get_playlist() const
+{
+	const size_t published_parts = get_published_parts();
+	const size_t complete_segments = published_parts / parts_per_segment;
+	const size_t first_segment =
+	    complete_segments > window_segments ? complete_segments - window_segments : 0;
+	const double part_seconds = part_duration.count() / 1000.0;
+	const auto target_duration = std::chrono::ceil<std::chrono::seconds>(get_target_duration());
+	std::string ret = "#EXTM3U\n#EXT-X-VERSION:9\n#EXT-X-TARGETDURATION:" +
+			  std::to_string(target_duration.count()) + '\n';
+	const auto add_parts = [&ret, part_seconds](size_t segment, size_t parts) {
+		for (size_t i = 0; i < parts; i++)
+			ret += "#EXT-X-PART:DURATION=" + std::to_string(part_seconds) +
+			       ",URI=\"seg" + std::to_string(segment) + '.' + std::to_string(i) +
+			       ".ts\"\n";
+	};
+
+	if (low_latency)
+		ret += "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=" +
+		       std::to_string(part_seconds * 3) + "\n#EXT-X-PART-INF:PART-TARGET=" +
+		       std::to_string(part_seconds) + '\n';
+
+	ret += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(first_segment) + '\n';
+
+	for (size_t s = first_segment; s < complete_segments; s++) {
+		if (low_latency && s + window_part_segments >= complete_segments)
+			add_parts(s, parts_per_segment);
+
+		ret += "#EXTINF:" + std::to_string(part_seconds * parts_per_segment) + ",\nseg" +
+		       std::to_string(s) + ".ts\n";
+	}
+
+	if (low_latency) {
+		const size_t parts = published_parts % parts_per_segment;
+
+		add_parts(complete_segments, parts);
+		ret += "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"seg" +
+		       std::to_string(complete_segments) + '.' + std::to_string(parts) + ".ts\"\n";
+	}
+
+	return ret;
+}
+
+void origin::handle(tcp::socket socket)
+{
+	beast::flat_buffer buffer;
+	beast::error_code ec;
+
+	for (;;) {
+		http::request<http::empty_body> request;
+		http::response<http::string_body> response {http::status::ok, request.version()};
+
+		http::read(socket, buffer, request, ec);
+
+		if (ec)
+			break;
+
+		const std::string_view target = request.target();
+		const auto query_pos = target.find('?');
+		const auto path = target.substr(0, query_pos);
+		const auto query = query_pos == std::string_view::npos ? std::string_view {}
+								       : target.substr(query_pos);
+		latency_statistics *statistics = nullptr;
+		size_t part = 0;
+
+		if (path == "/live.m3u8") {
+			bool has_msn;
+			bool has_part;
+			const auto msn = get_query_parameter(query, "_HLS_msn=", &has_msn);
+			const auto p = get_query_parameter(query, "_HLS_part=", &has_part);
+
+			{
+				std::lock_guard<std::mutex> lock {mutex};
+
+				playlist_requests++;
+				blocking_reloads += has_msn;
+			}
+
+			// A blocking reload returns once the playlist contains the part, or the
+			// segment if no part is given.
+			if (has_msn &&
+			    !wait(has_part ? msn * parts_per_segment + p
+					   : (msn + 1) * parts_per_segment - 1))
+				response.result(http::status::service_unavailable);
+			else {
+				response.set(http::field::content_type,
+					     "application/vnd.apple.mpegurl");
+				response.body() = get_playlist();
+			}
+		}
+		else if (path.substr(0, 4) == "/seg" && path.size() > 7) {
+			size_t segment = 0;
+			const auto p = path.data();
+			const auto [e, sec] = std::from_chars(p + 4, p + path.size(), segment);
+
+			response.set(http::field::content_type, "video/mp2t");
+
+			// A part is held until it is published, so that it can be preloaded.
+			if (*e == '.' && e[1] != 't') {
+				std::from_chars(e + 1, p + path.size(), part);
+				part += segment * parts_per_segment;
+
+				if (wait(part)) {
+					response.body() = get_part(part);
+					statistics = &part_latencies;
+				}
+				else
+					response.result(http::status::not_found);
+			}
+			else if ((segment + 1) * parts_per_segment <= get_published_parts()) {
+				part = segment * parts_per_segment;
+
+				for (size_t i = 0; i < parts_per_segment; i++)
+					response.body() += get_part(part + i);
+
+				part += parts_per_segment - 1;
+				statistics = &segment_latencies;
+			}
+			else
+				response.result(http::status::not_found);
+		}
+		else
+			response.result(http::status::not_found);
+
+		response.keep_alive(request.keep_alive());
+		response.prepare_payload();
+		http::write(socket, response, ec);
+
+		if (ec)
+			break;
+
+		if (statistics)
+			record(statistics, part);
+	}
+}
+
+void origin::print_statistics()
+{
+	std::lock_guard<std::mutex> lock {mutex};
+
+	std::cout << "Playlist requests: " << playlist_requests
+		  << " blocking reloads: " << blocking_reloads << '\n';
+	part_latencies.print();
+	segment_latencies.print();
+}
+
+int main(int argc, char *argv[])
+{
+	std::chrono::milliseconds part_duration {200};
+	std::chrono::seconds duration {30};
+	size_t part_size = 50000;
+	unsigned short port = 8080;
+	bool low_latency = true;
+
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "-l"))
+			low_latency = false;
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-d"))
+			duration = std::chrono::seconds {std::strtoull(argv[++i], nullptr, 10)};
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-p"))
+			port = std::strtoul(argv[++i], nullptr, 10);
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-s"))
+			part_size = std::strtoull(argv[++i], nullptr, 10);
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-t"))
+			part_duration =
+			    std::chrono::milliseconds {std::strtoull(argv[++i], nullptr, 10)};
+		else {
+			std::cerr << "Usage: " << argv[0]
+				  << " [-d <duration in s>] [-l] [-p <port>] [-s <part size>] "
+				     "[-t <part duration in ms>]\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	asio::io_context io;
+	tcp::acceptor acceptor {io, {asio::ip::make_address("127.0.0.1"), port}};
+	origin o {part_duration, part_size, low_latency};
+
+	std::thread {[&] {
+		for (;;) {
+			tcp::socket socket {io};
+
+			acceptor.accept(socket);
+			std::thread {&origin::handle, &o, std::move(socket)}.detach();
+		}
+	}}.detach();
+	std::this_thread::sleep_for(duration);
+	o.print_statistics();
+	std::cout.flush();
+	std::quick_exit(EXIT_SUCCESS);
+}
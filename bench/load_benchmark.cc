@@ -0,0 +1,415 @@
+// Records many live HLS streams at once from a local mock origin, and reports the throughput and
+// resource usage of the recorder. The origin serves a master playlist with two variants for each
+// stream, and a sliding window of synthetic segments; it can delay responses, fail segment
+// requests and close connections after a number of requests.
+//
+// Usage: load_benchmark [-b <bitrate in kbit/s>] [-c <requests per connection>]
+//			 [-d <duration in s>] [-e <error rate in %>] [-f <transport stream>]
+//			 [-j <jitter in ms>] [-l <latency in ms>] [-m <memory budget in MiB>]
+//			 [-n <recordings>] [-o <output directory>] [-t <segment duration in ms>]
+//
+// With -f, every segment of every variant is the given transport stream file, and the
+// recordings are remuxed to fragmented MP4; the bitrate then follows from the file.
+//
+// The recordings share a single connection_pool and run on one thread; its CPU time is reported
+// where the operating system can measure a single thread, and the process CPU time otherwise.
+// The peak RSS includes the origin, whose segments share a single buffer. The output files are
+// removed once the run ends.
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "connection_pool.h"
+#include "memory_budget.h"
+#include "playlist.h"
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+
+static const size_t buffer_pool_size = 32 * 1024 * 1024;
+// The bitrate of each variant is a quarter of the previous one.
+static const size_t num_variants = 2;
+static const size_t window_segments = 6;
+
+struct origin_options {
+	std::chrono::milliseconds jitter {0};
+	std::chrono::milliseconds latency {0};
+	std::chrono::milliseconds segment_duration {2000};
+	// In bit/s, for the first variant.
+	size_t bitrate = 4000000;
+	// The probability that a segment request fails with a 503 status.
+	double error_rate = 0;
+	// Connections are closed after this many requests, unless it is 0.
+	size_t requests_per_connection = 0;
+};
+
+class origin {
+		asio::io_context io;
+		tcp::acceptor acceptor {io, {asio::ip::make_address("127.0.0.1"), 0}};
+		const origin_options options;
+		// The segments of every variant are a prefix of this one, unless it is a real
+		// transport stream, which every variant serves whole.
+		const bool synthetic;
+		const std::string segment;
+		// The first segments are already published once the origin starts.
+		const std::chrono::steady_clock::time_point start;
+		std::atomic<size_t> closed_connections {0};
+		std::atomic<size_t> injected_errors {0};
+		std::atomic<size_t> requests {0};
+
+		void accept()
+		{
+			for (;;)
+				std::thread {&origin::serve, this, acceptor.accept()}.detach();
+		}
+
+		std::string get_master_playlist() const;
+		std::string get_media_playlist(size_t variant) const;
+
+		size_t get_published_segments() const
+		{
+			return (std::chrono::steady_clock::now() - start) /
+			       options.segment_duration;
+		}
+
+		size_t get_segment_size(size_t variant) const
+		{
+			return synthetic ? segment.size() >> (2 * variant) : segment.size();
+		}
+
+		void serve(tcp::socket socket);
+
+	public:
+		// The segments are synthetic if segment is empty.
+		origin(const origin_options& options, std::string segment) :
+		    options(options),
+		    synthetic(segment.empty()),
+		    segment(synthetic ? std::string(options.bitrate / 8 *
+						    options.segment_duration.count() / 1000,
+						    'A')
+				      : std::move(segment)),
+		    start(std::chrono::steady_clock::now() -
+			  options.segment_duration * static_cast<int>(window_segments))
+		{
+			std::thread {&origin::accept, this}.detach();
+		}
+
+		unsigned short get_port() const
+		{
+			return acceptor.local_endpoint().port();
+		}
+
+		void print_statistics() const
+		{
+			std::cout << "Origin: requests = " << requests
+				  << " injected errors = " << injected_errors
+				  << " closed connections = " << closed_connections << '\n';
+		}
+};
+
+std::string origin::get_master_playlist() const
+{
+	std::string ret = "#EXTM3U\n";
+
+	for (size_t v = 0; v < num_variants; v++)
+		ret += "#EXT-X-STREAM-INF:BANDWIDTH=" + std::to_string(options.bitrate >> (2 * v)) +
+		       '\n' + std::to_string(v) + ".m3u8\n";
+
+	return ret;
+}
+
+std::string origin::get_media_playlist(size_t variant) const
+{
+	const size_t published = get_published_segments();
+	const size_t first = published - window_segments;
+	const auto target_duration =
+	    std::chrono::ceil<std::chrono::seconds>(options.segment_duration);
+	const auto extinf = "#EXTINF:" + std::to_string(options.segment_duration.count() / 1000.0) +
+			    ",\n" + std::to_string(variant) + '/';
+	std::string ret = "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:" +
+			  std::to_string(target_duration.count()) +
+			  "\n#EXT-X-MEDIA-SEQUENCE:" + std::to_string(first) + '\n';
+
+	for (size_t s = first; s < published; s++)
+		ret += extinf + std::to_string(s) + ".ts\n";
+
+	return ret;
+}
+
+// The resources are /<stream>/master.m3u8, /<stream>/<variant>.m3u8 and
+// /<stream>/<variant>/<sequence number>.ts; the streams are identical.
+void origin::serve(tcp::socket socket)
+{
+	std::mt19937 random {std::random_device {}()};
+	std::uniform_real_distribution<double> error_distribution {0, 1};
+	std::uniform_int_distribution<long long> jitter_distribution {0, options.jitter.count()};
+	beast::flat_buffer buffer;
+	beast::error_code ec;
+
+	for (size_t n = 1;; n++) {
+		http::request<http::empty_body> request;
+		http::response<http::span_body<const char>> response {http::status::ok, 11};
+		std::string playlist;
+
+		http::read(socket, buffer, request, ec);
+
+		if (ec)
+			break;
+
+		requests++;
+
+		const std::string_view target = request.target();
+		const auto stream_end = target.find('/', 1);
+		const auto path = stream_end == std::string_view::npos
+				      ? std::string_view {}
+				      : target.substr(stream_end + 1);
+		const auto path_end = path.data() + path.size();
+		size_t variant = num_variants;
+		size_t sequence_number = 0;
+		const auto e = std::from_chars(path.data(), path_end, variant).ptr;
+
+		if (path == "master.m3u8") {
+			playlist = get_master_playlist();
+			response.set(http::field::content_type, "application/vnd.apple.mpegurl");
+		}
+		else if (variant >= num_variants)
+			response.result(http::status::not_found);
+		else if (std::string_view {e, static_cast<size_t>(path_end - e)} == ".m3u8") {
+			playlist = get_media_playlist(variant);
+			response.set(http::field::content_type, "application/vnd.apple.mpegurl");
+		}
+		else if (e != path_end && *e == '/' &&
+			 std::from_chars(e + 1, path_end, sequence_number).ec == std::errc {} &&
+			 sequence_number < get_published_segments()) {
+			if (error_distribution(random) < options.error_rate) {
+				injected_errors++;
+				response.result(http::status::service_unavailable);
+			}
+			else {
+				response.set(http::field::content_type, "video/mp2t");
+				response.body() = {segment.data(), get_segment_size(variant)};
+			}
+		}
+		else
+			response.result(http::status::not_found);
+
+		if (!playlist.empty())
+			response.body() = {playlist.data(), playlist.size()};
+
+		const bool close = options.requests_per_connection &&
+				   n == options.requests_per_connection;
+
+		std::this_thread::sleep_for(
+		    options.latency + std::chrono::milliseconds {jitter_distribution(random)});
+		response.keep_alive(request.keep_alive() && !close);
+		response.prepare_payload();
+		http::write(socket, response, ec);
+
+		if (ec)
+			break;
+
+		if (close) {
+			closed_connections++;
+			break;
+		}
+	}
+
+	socket.shutdown(tcp::socket::shutdown_both, ec);
+}
+
+// The CPU time of the calling thread, in seconds, or that of the process if unavailable.
+static double get_cpu_time()
+{
+#ifdef _WIN32
+	return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#else
+#ifdef RUSAGE_THREAD
+	const int who = RUSAGE_THREAD;
+#else
+	const int who = RUSAGE_SELF;
+#endif
+	rusage usage;
+
+	getrusage(who, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+	       (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+}
+
+// In MiB, or 0 if unavailable.
+static double get_peak_rss()
+{
+#ifdef _WIN32
+	return 0;
+#else
+	rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+	return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+static void remove_output(const std::string& file_name)
+{
+	std::error_code ec;
+
+	std::filesystem::remove(file_name, ec);
+	std::filesystem::remove(file_name + ".journal", ec);
+}
+
+int main(int argc, char *argv[])
+{
+	origin_options options;
+	std::chrono::seconds duration {30};
+	std::filesystem::path output_directory {"."};
+	std::string segment;
+	bool remux = false;
+	size_t memory_budget_size = 64 * 1024 * 1024;
+	size_t num_recordings = 10;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 < argc && !std::strcmp(argv[i], "-b"))
+			options.bitrate = std::strtoull(argv[++i], nullptr, 10) * 1000;
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-c"))
+			options.requests_per_connection = std::strtoull(argv[++i], nullptr, 10);
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-d"))
+			duration = std::chrono::seconds {std::strtoull(argv[++i], nullptr, 10)};
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-e"))
+			options.error_rate = std::strtod(argv[++i], nullptr) / 100;
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-f")) {
+			std::ifstream input {argv[++i], std::ios::binary};
+
+			segment.assign(std::istreambuf_iterator<char> {input}, {});
+
+			if (segment.empty()) {
+				std::cerr << "Failed to read the transport stream: " << argv[i]
+					  << '\n';
+				return EXIT_FAILURE;
+			}
+
+			remux = true;
+		}
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-j"))
+			options.jitter = std::chrono::milliseconds {
+			    std::strtoull(argv[++i], nullptr, 10)};
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-l"))
+			options.latency = std::chrono::milliseconds {
+			    std::strtoull(argv[++i], nullptr, 10)};
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-m"))
+			memory_budget_size = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-n"))
+			num_recordings = std::max(std::strtoull(argv[++i], nullptr, 10), 1ULL);
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-o"))
+			output_directory = argv[++i];
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-t"))
+			options.segment_duration = std::chrono::milliseconds {
+			    std::max(std::strtoull(argv[++i], nullptr, 10), 1ULL)};
+		else {
+			std::cerr << "Usage: " << argv[0]
+				  << " [-b <bitrate in kbit/s>] [-c <requests per connection>] "
+				     "[-d <duration in s>] [-e <error rate in %>] "
+				     "[-f <transport stream>] [-j <jitter in ms>] "
+				     "[-l <latency in ms>] [-m <memory budget in MiB>] "
+				     "[-n <recordings>] [-o <output directory>] "
+				     "[-t <segment duration in ms>]\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Injected errors would flood the log; they show up in the counts instead.
+	boost::log::core::get()->set_filter(boost::log::trivial::severity >=
+					    boost::log::trivial::fatal);
+
+	origin o {options, std::move(segment)};
+	const std::string prefix = "http://127.0.0.1:" + std::to_string(o.get_port()) + '/';
+	asio::io_context io {1};
+	memory_budget budget {memory_budget_size};
+	connection_pool pool {&io, buffer_pool_size, 1, default_idle_timeout, nullptr, &budget};
+	std::list<playlist> playlists;
+	std::vector<std::string> file_names;
+
+	for (size_t i = 0; i < num_recordings; i++) {
+		auto& file_name = file_names.emplace_back(
+		    (output_directory /
+		     ("load-" + std::to_string(i) + (remux ? ".mp4" : ".ts")))
+			.string());
+
+		// A previous run would be resumed.
+		remove_output(file_name);
+		playlists.emplace_back(&io, &pool, &budget, 0, remux);
+
+		if (!playlists.back().record(prefix + std::to_string(i) + "/master.m3u8",
+					     file_name)) {
+			std::cerr << "Failed to start recording " << i << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+
+	const auto start_cpu_time = get_cpu_time();
+	const auto start = std::chrono::steady_clock::now();
+
+	io.run_for(duration);
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	const auto cpu_time = get_cpu_time() - start_cpu_time;
+	size_t bytes = 0;
+	size_t dropped_segments = 0;
+	size_t segments = 0;
+	std::uint64_t throttled = 0;
+
+	for (const auto& p : playlists) {
+		const auto m = p.get_metrics();
+
+		bytes += m->bytes.get();
+		dropped_segments += m->dropped_segments.get();
+		segments += m->segments.get();
+		throttled += m->throttled.get_sum();
+	}
+
+	std::cout << num_recordings << " recordings for " << elapsed.count() << " s: segments = "
+		  << segments << " (" << segments / elapsed.count()
+		  << "/s) bytes = " << bytes << " (" << bytes / elapsed.count() / (1024 * 1024)
+		  << " MiB/s) dropped segments = " << dropped_segments << '\n';
+	std::cout << "CPU time = " << cpu_time << " s (" << 100 * cpu_time / elapsed.count()
+		  << "%) peak RSS = " << get_peak_rss() << " MiB\n";
+	std::cout << "Memory budget = " << memory_budget_size / (1024 * 1024)
+		  << " MiB throttled = " << throttled / 1e6 << " s\n";
+	o.print_statistics();
+	std::cout.flush();
+
+	for (const auto& f : file_names)
+		remove_output(f);
+
+	std::quick_exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,238 @@
+// Measures how many segments per second connection_pool downloads from a distant server, with
+// several pipeline depths. The server runs locally and delays each response by the round-trip
+// time; the segments are requested at once, as during a catch-up burst.
+//
+// Usage: pipelining_benchmark [-n <segments>] [-r <round-trip time in ms>] [-s <segment size>]
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "connection.h"
+#include "connection_pool.h"
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+
+static const size_t buffer_pool_size = 32 * 1024 * 1024;
+
+class delayed_server {
+		struct response {
+			std::chrono::steady_clock::time_point due;
+			bool keep_alive = false;
+		};
+
+		struct session {
+			std::condition_variable condition;
+			std::mutex mutex;
+			std::deque<response> responses;
+			tcp::socket socket;
+			bool closed = false;
+
+			explicit session(tcp::socket socket) : socket(std::move(socket))
+			{
+			}
+		};
+
+		asio::io_context io;
+		tcp::acceptor acceptor {io, {asio::ip::make_address("127.0.0.1"), 0}};
+		const std::string body;
+		const std::chrono::milliseconds round_trip_time;
+
+		// Requests are read while earlier responses are still delayed, so that pipelined
+		// requests are served in parallel.
+		void read(const std::shared_ptr<session>& s)
+		{
+			beast::flat_buffer buffer;
+			beast::error_code ec;
+
+			for (;;) {
+				http::request<http::empty_body> request;
+
+				http::read(s->socket, buffer, request, ec);
+
+				std::lock_guard<std::mutex> lock {s->mutex};
+
+				if (ec) {
+					s->closed = true;
+					s->condition.notify_one();
+					break;
+				}
+
+				s->responses.push_back(
+				    {std::chrono::steady_clock::now() + round_trip_time,
+				     request.keep_alive()});
+				s->condition.notify_one();
+			}
+		}
+
+		void write(const std::shared_ptr<session>& s)
+		{
+			beast::error_code ec;
+
+			for (;;) {
+				response r;
+
+				{
+					std::unique_lock<std::mutex> lock {s->mutex};
+
+					s->condition.wait(lock, [&s] {
+						return s->closed || !s->responses.empty();
+					});
+
+					if (s->responses.empty())
+						break;
+
+					r = s->responses.front();
+					s->responses.pop_front();
+				}
+
+				http::response<http::string_body> res {http::status::ok, 11};
+
+				std::this_thread::sleep_until(r.due);
+				res.set(http::field::content_type, "video/mp2t");
+				res.body() = body;
+				res.keep_alive(r.keep_alive);
+				res.prepare_payload();
+				http::write(s->socket, res, ec);
+
+				if (ec || !r.keep_alive)
+					break;
+			}
+		}
+
+	public:
+		delayed_server(size_t segment_size, std::chrono::milliseconds round_trip_time) :
+		    body(segment_size, 'A'), round_trip_time(round_trip_time)
+		{
+			std::thread {[this] {
+				for (;;) {
+					auto s = std::make_shared<session>(acceptor.accept());
+
+					std::thread {&delayed_server::read, this, s}.detach();
+					std::thread {&delayed_server::write, this, s}.detach();
+				}
+			}}.detach();
+		}
+
+		unsigned short get_port() const
+		{
+			return acceptor.local_endpoint().port();
+		}
+};
+
+class segment_sink : public response_sink {
+		size_t * const remaining = nullptr;
+		std::chrono::steady_clock::time_point * const end = nullptr;
+
+	public:
+		size_t size = 0;
+
+		segment_sink(size_t *remaining, std::chrono::steady_clock::time_point *end) :
+		    remaining(remaining), end(end)
+		{
+		}
+
+		bool on_header(const response_header& header) override
+		{
+			size = 0;
+			return header.result() == http::status::ok;
+		}
+
+		void on_body(const char *, size_t n, const std::shared_ptr<body_reader>& r) override
+		{
+			size += n;
+			r->resume();
+		}
+
+		void on_complete() override
+		{
+			--*remaining;
+			*end = std::chrono::steady_clock::now();
+		}
+};
+
+static void run(const std::string& host, size_t num_segments, size_t pipeline_depth)
+{
+	asio::io_context io;
+	connection_pool pool {&io, buffer_pool_size, pipeline_depth};
+	std::vector<std::unique_ptr<segment_sink>> sinks;
+	size_t failed = 0;
+	size_t remaining = num_segments;
+	const auto start = std::chrono::steady_clock::now();
+	// io_context::run() only returns once the idle connections are closed.
+	auto end = start;
+
+	for (size_t i = 0; i < num_segments; i++) {
+		sinks.push_back(std::make_unique<segment_sink>(&remaining, &end));
+		pool.get(false,
+			 host,
+			 "/seg" + std::to_string(i) + ".ts",
+			 sinks.back().get(),
+			 [&failed, &end] {
+				 failed++;
+				 end = std::chrono::steady_clock::now();
+			 });
+	}
+
+	io.run();
+
+	const std::chrono::duration<double> d = end - start;
+
+	std::cout << "Pipeline depth " << pipeline_depth << ": " << num_segments / d.count()
+		  << " segments/s (" << num_segments - remaining << " received, " << failed
+		  << " failed)\n";
+}
+
+int main(int argc, char *argv[])
+{
+	std::chrono::milliseconds round_trip_time {100};
+	size_t num_segments = 200;
+	size_t segment_size = 100000;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 < argc && !std::strcmp(argv[i], "-n"))
+			num_segments = std::strtoull(argv[++i], nullptr, 10);
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-r"))
+			round_trip_time =
+			    std::chrono::milliseconds {std::strtoull(argv[++i], nullptr, 10)};
+		else if (i + 1 < argc && !std::strcmp(argv[i], "-s"))
+			segment_size = std::strtoull(argv[++i], nullptr, 10);
+		else {
+			std::cerr << "Usage: " << argv[0]
+				  << " [-n <segments>] [-r <round-trip time in ms>] [-s <segment "
+				     "size>]\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	boost::log::core::get()->set_filter(boost::log::trivial::severity >=
+					    boost::log::trivial::warning);
+
+	delayed_server server {segment_size, round_trip_time};
+	const std::string host = "127.0.0.1:" + std::to_string(server.get_port());
+
+	std::cout << num_segments << " segments of " << segment_size << " bytes, round-trip time "
+		  << round_trip_time.count() << " ms\n";
+
+	for (const size_t pipeline_depth : {1, 2, 4, 8, 16})
+		run(host, num_segments, pipeline_depth);
+
+	std::cout.flush();
+	std::quick_exit(EXIT_SUCCESS);
+}
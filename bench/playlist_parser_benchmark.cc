@@ -0,0 +1,264 @@
+// Measures the playlist parsing throughput on a corpus of playlists with real-world sizes, for the
+// tokenizer and for the per-line prefix matching that it replaced.
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hls_tokenizer.h"
+
+#define BANDWIDTH_ATTRIBUTE "BANDWIDTH="
+#define DISCONTINUITY_TAG "#EXT-X-DISCONTINUITY"
+#define END_LIST_TAG "#EXT-X-ENDLIST"
+#define MAP_TAG "#EXT-X-MAP:"
+#define MEDIA_SEQUENCE_TAG "#EXT-X-MEDIA-SEQUENCE:"
+#define PLAYLIST_TYPE_VOD_TAG "#EXT-X-PLAYLIST-TYPE:VOD"
+#define STREAM_INF_TAG "#EXT-X-STREAM-INF:"
+#define TARGET_DURATION_TAG "#EXT-X-TARGETDURATION:"
+#define URI_ATTRIBUTE "URI=\""
+
+struct corpus_playlist {
+	const char *name;
+	std::string data;
+};
+
+// The parsers add up everything that they extract, so that no work is optimized away.
+struct parse_result {
+	size_t sum = 0;
+
+	void add(size_t n)
+	{
+		sum += n;
+	}
+
+	void add(const std::string_view& s)
+	{
+		sum += s.size();
+	}
+};
+
+static std::string get_live_playlist()
+{
+	std::string ret = "#EXTM3U\n#EXT-X-VERSION:6\n#EXT-X-TARGETDURATION:4\n"
+			  "#EXT-X-MEDIA-SEQUENCE:1834512\n#EXT-X-DISCONTINUITY-SEQUENCE:12\n";
+
+	for (size_t i = 0; i < 15; i++) {
+		ret += "#EXT-X-PROGRAM-DATE-TIME:2024-03-01T12:00:" + std::to_string(10 + i * 4) +
+		       ".000Z\n#EXTINF:4.000,\n";
+		ret += "live/1080p/segment_" + std::to_string(1834512 + i) + ".ts\n";
+	}
+
+	return ret;
+}
+
+static std::string get_master_playlist()
+{
+	std::string ret = "#EXTM3U\n#EXT-X-INDEPENDENT-SEGMENTS\n";
+
+	for (size_t i = 0; i < 8; i++)
+		ret += "#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"aac\",LANGUAGE=\"l" + std::to_string(i) +
+		       "\",NAME=\"Audio " + std::to_string(i) +
+		       "\",AUTOSELECT=YES,URI=\"audio/" + std::to_string(i) + "/index.m3u8\"\n";
+
+	for (size_t i = 0; i < 60; i++) {
+		const auto bandwidth = std::to_string(200000 + i * 150000);
+
+		ret += "#EXT-X-STREAM-INF:AVERAGE-BANDWIDTH=" + bandwidth +
+		       ",BANDWIDTH=" + bandwidth +
+		       ",CODECS=\"avc1.640028,mp4a.40.2\",RESOLUTION=1920x1080,FRAME-RATE=29.970,"
+		       "AUDIO=\"aac\",CLOSED-CAPTIONS=NONE\n";
+		ret += "https://cdn.example.com/content/" + std::to_string(i) +
+		       "/index.m3u8?token=0123456789abcdef0123456789abcdef\n";
+	}
+
+	return ret;
+}
+
+static std::string get_vod_playlist(size_t num_segments)
+{
+	std::string ret = "#EXTM3U\n#EXT-X-VERSION:7\n#EXT-X-TARGETDURATION:6\n"
+			  "#EXT-X-MEDIA-SEQUENCE:0\n#EXT-X-PLAYLIST-TYPE:VOD\n"
+			  "#EXT-X-MAP:URI=\"init.mp4\"\n";
+
+	for (size_t i = 0; i < num_segments; i++) {
+		ret += "#EXTINF:6.006,\n";
+		ret += "https://cdn.example.com/content/vod/1080p/segment_" + std::to_string(i) +
+		       ".m4s?token=0123456789abcdef0123456789abcdef\n";
+	}
+
+	ret += "#EXT-X-ENDLIST\n";
+	return ret;
+}
+
+static parse_result parse_legacy(const std::string& playlist)
+{
+	const char *line_end;
+	const char *iter = playlist.data();
+	const char * const playlist_end = iter + playlist.size();
+	parse_result ret;
+
+	for (; iter < playlist_end; iter = line_end + 1) {
+		line_end = std::find(iter, playlist_end, '\n');
+
+		const char * const e = line_end[-1] == '\r' ? line_end - 1 : line_end;
+		const size_t line_len = e - iter;
+		size_t n = 0;
+
+		if (!line_len)
+			continue;
+
+		if (line_len > sizeof(TARGET_DURATION_TAG) - 1 &&
+		    std::equal(iter, iter + sizeof(TARGET_DURATION_TAG) - 1, TARGET_DURATION_TAG)) {
+			std::from_chars(iter + sizeof(TARGET_DURATION_TAG) - 1, e, n);
+			ret.add(n);
+		}
+		else if (line_len > sizeof(MEDIA_SEQUENCE_TAG) - 1 &&
+			 std::equal(
+			     iter, iter + sizeof(MEDIA_SEQUENCE_TAG) - 1, MEDIA_SEQUENCE_TAG)) {
+			std::from_chars(iter + sizeof(MEDIA_SEQUENCE_TAG) - 1, e, n);
+			ret.add(n);
+		}
+		else if (line_len >= sizeof(DISCONTINUITY_TAG) - 1 &&
+			 std::equal(iter, iter + sizeof(DISCONTINUITY_TAG) - 1, DISCONTINUITY_TAG))
+			ret.add(1);
+		else if (line_len >= sizeof(END_LIST_TAG) - 1 &&
+			 std::equal(iter, iter + sizeof(END_LIST_TAG) - 1, END_LIST_TAG))
+			ret.add(1);
+		else if (line_len >= sizeof(PLAYLIST_TYPE_VOD_TAG) - 1 &&
+			 std::equal(
+			     iter, iter + sizeof(PLAYLIST_TYPE_VOD_TAG) - 1, PLAYLIST_TYPE_VOD_TAG))
+			ret.add(1);
+		else if (line_len > sizeof(MAP_TAG) - 1 &&
+			 std::equal(iter, iter + sizeof(MAP_TAG) - 1, MAP_TAG)) {
+			auto uri_pos = std::search(iter + sizeof(MAP_TAG) - 1,
+						   e,
+						   URI_ATTRIBUTE,
+						   &URI_ATTRIBUTE[sizeof(URI_ATTRIBUTE) - 1]);
+
+			if (uri_pos != e) {
+				uri_pos += sizeof(URI_ATTRIBUTE) - 1;
+				ret.add(std::find(uri_pos, e, '"') - uri_pos);
+			}
+		}
+		else if (line_len > sizeof(STREAM_INF_TAG) - 1 &&
+			 std::equal(iter, iter + sizeof(STREAM_INF_TAG) - 1, STREAM_INF_TAG)) {
+			auto bandwidth_pos =
+			    std::search(iter,
+					e,
+					BANDWIDTH_ATTRIBUTE,
+					&BANDWIDTH_ATTRIBUTE[sizeof(BANDWIDTH_ATTRIBUTE) - 1]);
+
+			if (bandwidth_pos != e) {
+				bandwidth_pos += sizeof(BANDWIDTH_ATTRIBUTE) - 1;
+				std::from_chars(bandwidth_pos, e, n);
+				ret.add(n);
+			}
+		}
+		else if (*iter != '#')
+			ret.add(line_len);
+
+		if (line_end == playlist_end)
+			break;
+	}
+
+	return ret;
+}
+
+static parse_result parse_tokenizer(const std::string& playlist)
+{
+	hls_tokenizer tokenizer {playlist.data(), playlist.size()};
+	hls_line line;
+	parse_result ret;
+
+	while (tokenizer.next(&line)) {
+		const auto& value = line.value;
+		std::string_view attribute;
+		size_t n = 0;
+
+		switch (line.tag) {
+			case hls_tag::media_sequence:
+			case hls_tag::target_duration:
+				std::from_chars(value.data(), value.data() + value.size(), n);
+				ret.add(n);
+				break;
+
+			case hls_tag::discontinuity:
+			case hls_tag::end_list:
+				ret.add(1);
+				break;
+
+			case hls_tag::playlist_type:
+				ret.add(value == "VOD");
+				break;
+
+			case hls_tag::map:
+				if (get_hls_attribute(value, "URI", &attribute))
+					ret.add(attribute);
+
+				break;
+
+			case hls_tag::stream_inf:
+				if (get_hls_attribute(value, "BANDWIDTH", &attribute)) {
+					const auto a = attribute.data();
+
+					std::from_chars(a, a + attribute.size(), n);
+					ret.add(n);
+				}
+
+				break;
+
+			case hls_tag::uri:
+				ret.add(value);
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return ret;
+}
+
+template<typename F>
+static void measure(const char *name, const corpus_playlist& playlist, size_t iterations, F&& f)
+{
+	parse_result result;
+	const auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < iterations; i++)
+		result.add(f(playlist.data).sum);
+
+	const std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+	const double size = static_cast<double>(playlist.data.size()) * iterations;
+
+	std::cout << playlist.name << ", " << name << ": " << size / d.count() / (1024 * 1024)
+		  << " MiB/s (" << result.sum << ")\n";
+}
+
+int main(int argc, char *argv[])
+{
+	// The amount of playlist data that is parsed for every measurement.
+	const size_t total_size =
+	    (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256) * 1024 * 1024;
+	const std::vector<corpus_playlist> corpus {
+	    {"live, 15 segments", get_live_playlist()},
+	    {"master, 60 variants", get_master_playlist()},
+	    {"VOD, 2000 segments", get_vod_playlist(2000)},
+	    {"VOD, 20000 segments", get_vod_playlist(20000)},
+	};
+
+	for (const auto& playlist : corpus) {
+		const size_t iterations = std::max<size_t>(total_size / playlist.data.size(), 1);
+
+		std::cout << playlist.name << ": " << playlist.data.size() << " bytes\n";
+		measure("legacy", playlist, iterations, parse_legacy);
+		measure("tokenizer", playlist, iterations, parse_tokenizer);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+// Compares the reorder window with the structures it replaced, by downloading a large VOD
+// backlog, where a segment is requested once it is within a fixed distance of the first segment
+// that has not been written, and the requested segments complete in random order.
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "reorder_window.h"
+
+struct segment {
+	size_t sequence_number = 0;
+	bool complete = false;
+
+	explicit segment(size_t sequence_number) : sequence_number(sequence_number)
+	{
+	}
+};
+
+// The segments that are completed in turn; each one has been requested at the time.
+static std::vector<size_t> get_completion_order(size_t num_segments, size_t window_size)
+{
+	std::mt19937_64 generator {1};
+	std::vector<size_t> flight;
+	std::vector<size_t> ret;
+	size_t next = 0;
+
+	ret.reserve(num_segments);
+
+	while (ret.size() < num_segments) {
+		const auto first = flight.empty() ? next
+						  : *std::min_element(flight.begin(), flight.end());
+
+		while (next < first + window_size && next < num_segments)
+			flight.push_back(next++);
+
+		const auto i = generator() % flight.size();
+
+		ret.push_back(flight[i]);
+		flight[i] = flight.back();
+		flight.pop_back();
+	}
+
+	return ret;
+}
+
+static size_t run_priority_queue(const std::vector<size_t>& order, size_t window_size)
+{
+	typedef std::pair<size_t, segment> element;
+
+	const auto compare = [](const element& x, const element& y) { return x.first > y.first; };
+	std::priority_queue<element, std::deque<element>, decltype(compare)> segments {compare};
+	std::set<size_t> segments_in_progress;
+	size_t first = 0;
+	size_t next = 0;
+	size_t written = 0;
+
+	for (const auto s : order) {
+		while (next < first + window_size && next < order.size())
+			segments_in_progress.insert(next++);
+
+		segments_in_progress.erase(s);
+		segments.emplace(s, segment {s});
+
+		while (!segments.empty()) {
+			const auto min = std::min_element(segments_in_progress.begin(),
+							  segments_in_progress.end());
+
+			if (min != segments_in_progress.end() && *min < segments.top().first)
+				break;
+
+			written += segments.top().second.sequence_number;
+			first = segments.top().first + 1;
+			segments.pop();
+		}
+	}
+
+	return written;
+}
+
+static size_t run_map(const std::vector<size_t>& order, size_t window_size)
+{
+	std::map<size_t, segment> segments;
+	size_t next = 0;
+	size_t written = 0;
+
+	for (const auto s : order) {
+		while ((segments.empty() || next < segments.begin()->first + window_size) &&
+		       next < order.size()) {
+			segments.try_emplace(next, next);
+			next++;
+		}
+
+		segments.find(s)->second.complete = true;
+
+		while (!segments.empty() && segments.begin()->second.complete) {
+			written += segments.begin()->second.sequence_number;
+			segments.erase(segments.begin());
+		}
+	}
+
+	return written;
+}
+
+template<size_t N> static size_t run_reorder_window(const std::vector<size_t>& order)
+{
+	reorder_window<segment, N> segments;
+	size_t next = 0;
+	size_t written = 0;
+
+	for (const auto s : order) {
+		while (next < order.size() && segments.fits(next)) {
+			segments.emplace(next, next);
+			next++;
+		}
+
+		segments.find(s)->complete = true;
+
+		while (!segments.empty() && segments.front()->complete) {
+			written += segments.front()->sequence_number;
+			segments.pop_front();
+		}
+	}
+
+	return written;
+}
+
+template<typename F> static void measure(const char *name, size_t num_segments, F&& f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const auto result = f();
+	const std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+
+	std::cout << name << ": " << d.count() / num_segments << " ns per segment (" << result
+		  << ")\n";
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t num_segments = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+	// The largest window size matches the one used by stream_writer.
+	for (const size_t window_size : {4, 32, 256}) {
+		const auto order = get_completion_order(num_segments, window_size);
+
+		std::cout << num_segments << " segments, window size " << window_size << '\n';
+		measure("priority_queue + set", num_segments, [&] {
+			return run_priority_queue(order, window_size);
+		});
+		measure("map", num_segments, [&] { return run_map(order, window_size); });
+		measure("reorder_window", num_segments, [&] {
+			return window_size == 4	   ? run_reorder_window<4>(order)
+			       : window_size == 32 ? run_reorder_window<32>(order)
+						   : run_reorder_window<256>(order);
+		});
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+#include <boost/log/trivial.hpp>
+#include <openssl/evp.h>
+#include <vector>
+
+#include "aes_decryptor.h"
+
+aes_decryptor::~aes_decryptor()
+{
+	EVP_CIPHER_CTX_free(ctx);
+}
+
+bool aes_decryptor::finish(std::vector<char> *plaintext)
+{
+	const auto size = plaintext->size();
+	int n = 0;
+
+	plaintext->resize(size + block_size);
+
+	const bool ret = EVP_DecryptFinal_ex(
+	    ctx, reinterpret_cast<unsigned char *>(plaintext->data() + size), &n);
+
+	plaintext->resize(size + (ret ? n : 0));
+	return ret;
+}
+
+bool aes_decryptor::init(const block& key, const block& iv)
+{
+	if (!ctx) {
+		BOOST_LOG_TRIVIAL(error) << "Failed to allocate a cipher context.";
+		return false;
+	}
+
+	// The implementation fetched by OpenSSL uses AES-NI where the CPU supports it.
+	return EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), nullptr, key.data(), iv.data());
+}
+
+bool aes_decryptor::update(const char *data, size_t size, std::vector<char> *plaintext)
+{
+	const auto offset = plaintext->size();
+	int n = 0;
+
+	// The chunks of a response body are far smaller than the limit of an int.
+	plaintext->resize(offset + size + block_size);
+
+	const auto out = reinterpret_cast<unsigned char *>(plaintext->data() + offset);
+	const bool ret = EVP_DecryptUpdate(ctx,
+					   out,
+					   &n,
+					   reinterpret_cast<const unsigned char *>(data),
+					   static_cast<int>(size));
+
+	plaintext->resize(offset + (ret ? n : 0));
+	return ret;
+}
@@ -0,0 +1,39 @@
+#ifndef AES_DECRYPTOR_H
+
+#define AES_DECRYPTOR_H
+
+#include <array>
+#include <cstddef>
+#include <openssl/evp.h>
+#include <vector>
+
+// Decrypts data encrypted with AES-128 in CBC mode with PKCS7 padding, as it is received in
+// chunks of any size.
+class aes_decryptor {
+	public:
+		static const size_t block_size = 16;
+
+		typedef std::array<unsigned char, block_size> block;
+
+	private:
+		EVP_CIPHER_CTX *ctx = nullptr;
+
+	public:
+		aes_decryptor() : ctx(EVP_CIPHER_CTX_new())
+		{
+		}
+
+		aes_decryptor(const aes_decryptor&) = delete;
+		aes_decryptor& operator=(const aes_decryptor&) = delete;
+		~aes_decryptor();
+
+		// Appends the plaintext of the last block, without its padding, to the buffer.
+		bool finish(std::vector<char> *plaintext);
+		bool init(const block& key, const block& iv);
+		// Appends the plaintext of the data to the buffer, except for the last block,
+		// which is held back until finish() since it may be the padded one. Up to
+		// block_size bytes more than the data may be appended.
+		bool update(const char *data, size_t size, std::vector<char> *plaintext);
+};
+
+#endif // AES_DECRYPTOR_H
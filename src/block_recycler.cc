@@ -0,0 +1,52 @@
+#include <new>
+
+#include "block_recycler.h"
+
+block_recycler::~block_recycler()
+{
+	for (const auto& b : blocks)
+		::operator delete(b.data);
+}
+
+void *block_recycler::allocate(size_t size)
+{
+	block *fit = nullptr;
+	block *smallest = nullptr;
+
+	for (auto& b : blocks)
+		if (b.used)
+			continue;
+		else if (b.size >= size) {
+			if (!fit || b.size < fit->size)
+				fit = &b;
+		}
+		else if (!smallest || b.size < smallest->size)
+			smallest = &b;
+
+	// The smallest free block grows, since the others are more likely to fit.
+	if (!fit && smallest) {
+		::operator delete(smallest->data);
+		smallest->data = nullptr;
+		smallest->size = 0;
+		smallest->data = ::operator new(size);
+		smallest->size = size;
+		fit = smallest;
+	}
+
+	if (!fit)
+		return ::operator new(size);
+
+	fit->used = true;
+	return fit->data;
+}
+
+void block_recycler::deallocate(void *p) noexcept
+{
+	for (auto& b : blocks)
+		if (b.data == p) {
+			b.used = false;
+			return;
+		}
+
+	::operator delete(p);
+}
@@ -0,0 +1,82 @@
+#ifndef BLOCK_RECYCLER_H
+
+#define BLOCK_RECYCLER_H
+
+#include <cstddef>
+#include <new>
+
+// Recycles the memory blocks that a connection allocates again for each request, which are those
+// of its asynchronous operations and of the header fields of its messages. Each block grows to
+// the largest size allocated in it, so that the heap is only used while the connection warms up,
+// and by the allocations made while all the blocks are in use.
+class block_recycler {
+		struct block {
+			void *data = nullptr;
+			size_t size = 0;
+			bool used = false;
+		};
+
+		block blocks[16];
+
+	public:
+		block_recycler() = default;
+		block_recycler(const block_recycler&) = delete;
+		block_recycler& operator=(const block_recycler&) = delete;
+		~block_recycler();
+
+		void *allocate(size_t size);
+		void deallocate(void *p) noexcept;
+};
+
+// Allocates from a block recycler, or from the heap if it is default-constructed.
+template<typename T> class block_allocator {
+		template<typename> friend class block_allocator;
+
+		block_recycler *recycler = nullptr;
+
+	public:
+		typedef T value_type;
+
+		block_allocator() noexcept = default;
+
+		explicit block_allocator(block_recycler *recycler) noexcept : recycler(recycler)
+		{
+		}
+
+		template<typename U>
+		block_allocator(const block_allocator<U>& a) noexcept : recycler(a.recycler)
+		{
+		}
+
+		T *allocate(size_t n)
+		{
+			return static_cast<T *>(recycler ? recycler->allocate(n * sizeof(T))
+							 : ::operator new(n * sizeof(T)));
+		}
+
+		void deallocate(T *p, size_t) noexcept
+		{
+			if (recycler)
+				recycler->deallocate(p);
+			else
+				::operator delete(p);
+		}
+
+		// A copy, such as one of the header of a response, may outlive the connection.
+		block_allocator select_on_container_copy_construction() const noexcept
+		{
+			return {};
+		}
+
+		template<typename U> bool operator==(const block_allocator<U>& a) const noexcept
+		{
+			return recycler == a.recycler;
+		}
+
+		template<typename U> bool operator!=(const block_allocator<U>& a) const noexcept
+		{
+			return recycler != a.recycler;
+		}
+};
+
+#endif // BLOCK_RECYCLER_H
@@ -0,0 +1,64 @@
+#include <boost/log/trivial.hpp>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.h"
+
+static size_t get_size_class(size_t n, bool round_up)
+{
+	size_t c = 0;
+
+	for (size_t s = buffer_pool::min_buffer_size; s < n; s *= 2)
+		c++;
+
+	if (!round_up && n != buffer_pool::min_buffer_size << c && c)
+		c--;
+
+	return c;
+}
+
+buffer_pool::~buffer_pool()
+{
+	if (stats.discarded)
+		BOOST_LOG_TRIVIAL(debug)
+		    << "Buffer pool statistics: discarded = " << stats.discarded;
+}
+
+std::vector<char> buffer_pool::get(size_t n)
+{
+	const auto c = get_size_class(n, true);
+	std::vector<char> ret;
+
+	if (c < num_size_classes && !buffers[c].empty()) {
+		ret = std::move(buffers[c].back());
+		buffers[c].pop_back();
+		size -= ret.capacity();
+		metrics->hits.add(1);
+	}
+	else {
+		ret.reserve(min_buffer_size << c);
+		metrics->misses.add(1);
+	}
+
+	return ret;
+}
+
+void buffer_pool::put(std::vector<char>&& buffer)
+{
+	const auto capacity = buffer.capacity();
+
+	if (capacity >= min_buffer_size) {
+		const auto c = get_size_class(capacity, false);
+
+		if (c < num_size_classes && size + capacity <= max_size) {
+			buffer.clear();
+			size += capacity;
+			buffers[c].push_back(std::move(buffer));
+		}
+		else
+			stats.discarded++;
+	}
+
+	// Callers rely on the buffer being left empty, as after a move.
+	buffer = std::vector<char> {};
+}
@@ -0,0 +1,49 @@
+#ifndef BUFFER_POOL_H
+
+#define BUFFER_POOL_H
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "metrics.h"
+
+// Recycles the buffers that hold response bodies. The buffers are grouped into size classes
+// that are powers of two, and at most max_size bytes of unused buffers are kept. The hits and
+// misses are counted in the metrics.
+class buffer_pool {
+	public:
+		static const size_t min_buffer_size = 64 * 1024;
+		static const size_t num_size_classes = 10;
+
+		struct statistics {
+			size_t discarded = 0;
+		};
+
+	private:
+		std::array<std::vector<std::vector<char>>, num_size_classes> buffers;
+		statistics stats;
+		cache_metrics * const metrics = nullptr;
+		size_t max_size = 0;
+		size_t size = 0;
+
+	public:
+		buffer_pool(size_t max_size, cache_metrics *m) : metrics(m), max_size(max_size)
+		{
+		}
+
+		buffer_pool(const buffer_pool&) = delete;
+		buffer_pool& operator=(const buffer_pool&) = delete;
+		~buffer_pool();
+
+		// Returns an empty buffer with a capacity of at least n bytes.
+		std::vector<char> get(size_t n);
+		const statistics& get_statistics() const noexcept
+		{
+			return stats;
+		}
+
+		void put(std::vector<char>&& buffer);
+};
+
+#endif // BUFFER_POOL_H
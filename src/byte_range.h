@@ -0,0 +1,43 @@
+#ifndef BYTE_RANGE_H
+
+#define BYTE_RANGE_H
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+// A range of bytes of a resource, as requested with a Range field. The default range is the whole
+// resource, and a range with an unbounded length extends to the end of the resource.
+struct byte_range {
+	static const std::uint64_t unbounded = std::numeric_limits<std::uint64_t>::max();
+	// Enough for "bytes=" and two 64-bit numbers.
+	static const size_t max_field_size = 48;
+
+	std::uint64_t offset = 0;
+	std::uint64_t length = unbounded;
+
+	bool is_whole() const noexcept
+	{
+		return !offset && length == unbounded;
+	}
+
+	// Returns the value of the Range field, which is stored in the buffer.
+	std::string_view format(char (&buffer)[max_field_size]) const noexcept
+	{
+		static const std::string_view unit = "bytes=";
+		const auto end = buffer + max_field_size;
+		auto p = std::copy(unit.begin(), unit.end(), buffer);
+
+		p = std::to_chars(p, end, offset).ptr;
+		*p++ = '-';
+
+		if (length != unbounded)
+			p = std::to_chars(p, end, offset + length - 1).ptr;
+
+		return {buffer, static_cast<size_t>(p - buffer)};
+	}
+};
+
+#endif // BYTE_RANGE_H
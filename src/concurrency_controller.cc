@@ -0,0 +1,68 @@
+#include <algorithm>
+
+#include "concurrency_controller.h"
+
+// The limit starts at the number of connections that the pool used to open to each host.
+static const double initial_limit = 4;
+static const double max_limit = 16;
+static const double decrease_factor = 0.75;
+// The lowest response time is forgotten after a while, in case the route to the host changes.
+static const size_t window_size = 100;
+// The response times of a nearby host vary by more than their lowest value without any queueing.
+static const std::chrono::milliseconds min_queueing_delay {5};
+
+concurrency_controller::concurrency_controller() noexcept : limit(initial_limit)
+{
+}
+
+bool concurrency_controller::decrease(clock::time_point request_time) noexcept
+{
+	const auto old_limit = get_limit();
+
+	// The requests sent before the last decrease would trigger another one.
+	if (request_time <= last_decrease)
+		return false;
+
+	last_decrease = clock::now();
+	smoothed_response_time = clock::duration::zero();
+	limit = std::max(1.0, limit * decrease_factor);
+	return get_limit() != old_limit;
+}
+
+bool concurrency_controller::on_error(clock::time_point request_time) noexcept
+{
+	return decrease(request_time);
+}
+
+bool concurrency_controller::on_response(clock::time_point request_time,
+					 clock::duration response_time,
+					 bool requests_waiting) noexcept
+{
+	const auto old_limit = get_limit();
+
+	min_response_time = std::min(min_response_time, response_time);
+	window_min_response_time = std::min(window_min_response_time, response_time);
+
+	if (++window_responses == window_size) {
+		min_response_time = window_min_response_time;
+		window_min_response_time = clock::duration::max();
+		window_responses = 0;
+	}
+
+	// Smoothed like the round-trip time of TCP, so that a single slow response does not
+	// count.
+	if (smoothed_response_time == clock::duration::zero())
+		smoothed_response_time = response_time;
+	else
+		smoothed_response_time += (response_time - smoothed_response_time) / 8;
+
+	if (smoothed_response_time > 2 * min_response_time &&
+	    smoothed_response_time - min_response_time > min_queueing_delay)
+		return decrease(request_time);
+
+	if (!requests_waiting || limit >= max_limit)
+		return false;
+
+	limit = std::min(max_limit, limit + 1 / limit);
+	return get_limit() != old_limit;
+}
@@ -0,0 +1,46 @@
+#ifndef CONCURRENCY_CONTROLLER_H
+
+#define CONCURRENCY_CONTROLLER_H
+
+#include <chrono>
+#include <cstddef>
+
+// Limits the number of connections to a host, the way TCP limits its congestion window. While
+// requests wait for a connection, the limit grows by one connection per limit responses, as long
+// as the response time stays close to the lowest recent one. It is cut by a quarter when a
+// connection fails or the response time doubles, which is how origins that throttle parallel
+// requests, or a saturated link, show up; the response time of a segment is its download time,
+// without the time for which the recording held its data, so it also reflects the throughput of
+// each connection.
+class concurrency_controller {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+	private:
+		// The lowest response time of the current and of the previous window of responses.
+		clock::duration min_response_time = clock::duration::max();
+		clock::duration window_min_response_time = clock::duration::max();
+		clock::duration smoothed_response_time = clock::duration::zero();
+		clock::time_point last_decrease = clock::time_point::min();
+		double limit;
+		size_t window_responses = 0;
+
+		bool decrease(clock::time_point request_time) noexcept;
+
+	public:
+		concurrency_controller() noexcept;
+
+		size_t get_limit() const noexcept
+		{
+			return static_cast<size_t>(limit);
+		}
+
+		// The functions take the time when the request was sent, and return true if the
+		// limit has changed.
+		bool on_error(clock::time_point request_time) noexcept;
+		bool on_response(clock::time_point request_time,
+				 clock::duration response_time,
+				 bool requests_waiting) noexcept;
+};
+
+#endif // CONCURRENCY_CONTROLLER_H
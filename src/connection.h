@@ -6,21 +6,40 @@
 #include <boost/beast.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/log/trivial.hpp>
+#include <charconv>
 #include <chrono>
-#include <functional>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <openssl/ssl.h>
 
+#include "block_recycler.h"
+#include "buffer_pool.h"
+#include "byte_range.h"
+#include "dns_cache.h"
+#include "happy_eyeballs.h"
+#include "http2_session.h"
+#include "metrics.h"
+#include "response_sink.h"
+#include "tls_session_cache.h"
+
 namespace asio = boost::asio;
 namespace beast = boost::beast;
 namespace http = boost::beast::http;
 namespace ssl = asio::ssl;
 using tcp = boost::asio::ip::tcp;
 
+static const size_t body_buffer_size = 64 * 1024;
+static const std::uint64_t max_body_size = std::numeric_limits<std::uint64_t>::max();
+static const unsigned char alpn_protocols[] = "\x02h2\x08http/1.1";
 static const std::string http_port = "80";
 static const std::string https_port = "443";
 static const unsigned http_version = 11;
@@ -29,36 +48,219 @@ static const std::chrono::seconds timeout {30};
 static const char user_agent[] =
     "Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:69.0) Gecko/20100101 Firefox/69.0";
 
-class connection : public std::enable_shared_from_this<connection> {
+// Requests over HTTPS are multiplexed on HTTP/2 streams if the server selects HTTP/2 during the
+// TLS handshake, and are otherwise sent over HTTP/1.1.
+class connection : public std::enable_shared_from_this<connection>,
+		   public body_reader,
+		   private http2_session::listener {
 	public:
 		typedef http::response<http::vector_body<char>> http_response;
-		typedef std::function<void(const std::string&)> on_error_callback;
-		typedef std::function<void(const std::shared_ptr<connection>&, http_response *)>
-		    on_receive_callback;
+
+		class request_handler {
+			public:
+				// Whether the failed request held the connection, which is the case
+				// for the first request in flight.
+				virtual void on_error(const std::shared_ptr<connection>& c,
+						      bool release) = 0;
+				virtual void on_receive(const std::shared_ptr<connection>& c,
+							http_response *response) = 0;
+
+			protected:
+				~request_handler() = default;
+		};
+
+	private:
+		struct pending_request {
+			std::string_view resource;
+			request_handler *handler = nullptr;
+			const http::fields *fields = nullptr;
+			response_sink *sink = nullptr;
+			byte_range range;
+			std::chrono::steady_clock::time_point sent;
+			// Whether the server may hold the response on purpose.
+			bool held = false;
+		};
+
+		// Keeps the connection alive until an operation completes, and allocates the
+		// memory of the operation from the block recycler of the connection.
+		template<typename derived, typename... Args> class operation_handler {
+				std::shared_ptr<derived> c;
+				void (derived::*f)(Args...) = nullptr;
+				bool counted = false;
+
+			public:
+				typedef block_allocator<void> allocator_type;
+
+				operation_handler(const std::shared_ptr<derived>& c,
+						  void (derived::*f)(Args...),
+						  bool counted) :
+				    c(c),
+				    f(f), counted(counted)
+				{
+				}
+
+				allocator_type get_allocator() const noexcept
+				{
+					return allocator_type(&c->memory);
+				}
+
+				// The operation ends after the handler, which usually starts the
+				// next one.
+				template<typename... T> void operator()(T&&... args)
+				{
+					((*c).*f)(std::forward<T>(args)...);
+
+					if (counted)
+						c->end_operation();
+				}
+		};
+
+		// A request sent on an HTTP/2 stream. The data received for a sink is buffered
+		// while the sink processes the previous data, within the flow control window.
+		class http2_stream : public body_reader {
+			public:
+				pending_request request;
+				http_response response;
+				// The header passed to the sink.
+				response_header header;
+				std::vector<char> data;
+				std::vector<char> sink_data;
+				std::weak_ptr<connection> c;
+				std::chrono::steady_clock::time_point header_time;
+				int32_t id = 0;
+				bool closed = false;
+				bool discard_body = false;
+				bool failed = false;
+				bool has_header = false;
+
+				void resume() override
+				{
+					if (const auto p = c.lock())
+						p->resume_stream(this);
+				}
+		};
+
+		typedef http::request<http::empty_body, recycled_fields> http_request;
+
+	protected:
+		typedef beast::basic_stream<tcp, happy_eyeballs::executor_type> tcp_stream;
 
 	private:
+		// Declared first, so that it outlives the messages that allocate from it.
+		block_recycler memory;
 		beast::flat_buffer buffer;
-		on_receive_callback on_receive_cb;
-		http::request<http::empty_body> request;
+		std::vector<char> body_buffer;
+		std::optional<http::response_parser<http::buffer_body, block_allocator<char>>>
+		    parser;
+		http_request request;
+		// The requests that have not been answered yet, in the order in which they are
+		// sent; the first num_sent ones have been written. With HTTP/2, these are the
+		// requests waiting for a stream. Unlike a deque, the vector keeps its capacity.
+		std::vector<pending_request> requests;
+		std::unordered_map<void *, std::shared_ptr<http2_stream>> streams;
+		std::unique_ptr<http2_session> http2;
 		http_response response;
-		tcp::resolver * const resolver = nullptr;
+		dns_cache * const dns = nullptr;
+		buffer_pool * const buffers = nullptr;
+		response_sink *sink = nullptr;
+		std::string_view output;
+		// Fails the connection once none of its operations has completed for the timeout,
+		// instead of a timer for each operation.
+		asio::steady_timer watchdog;
+		std::chrono::steady_clock::time_point deadline;
+		// When the header of the response to the first request in flight was received.
+		std::chrono::steady_clock::time_point header_time;
+		size_t num_operations = 0;
+		size_t num_sent = 0;
 		size_t sequence_number = 0;
 		bool connected = false;
+		bool connecting = false;
+		bool discard_body = false;
+		bool failed = false;
+		bool has_fields = false;
+		// Set while the sink holds the data of the response being read.
+		bool paused = false;
+		bool persistent = false;
+		bool pipeline_failed = false;
+		bool reading = false;
+		// Set while HTTP/2 frames are processed, when no frames may be written.
+		bool receiving = false;
+		// Set once a request holding the connection has failed.
+		bool released = false;
+		bool watching = false;
+		bool writing = false;
 
 		virtual void async_read()
 		{
-			auto& stream = get_tcp_stream();
+			do_async_read(get_tcp_stream());
+		}
 
-			stream.expires_after(timeout);
-			do_async_read(stream);
+		virtual void async_read_body()
+		{
+			do_async_read_body(get_tcp_stream());
+		}
+
+		virtual void async_read_frames()
+		{
+			do_async_read_frames(get_tcp_stream());
 		}
 
 		virtual void async_write()
 		{
-			auto& stream = get_tcp_stream();
+			do_async_write(get_tcp_stream());
+		}
 
-			stream.expires_after(timeout);
-			do_async_write(stream);
+		virtual void async_write_frames()
+		{
+			do_async_write_frames(get_tcp_stream());
+		}
+
+		void arm_watchdog()
+		{
+			watching = true;
+			watchdog.expires_at(deadline);
+			watchdog.async_wait(
+			    operation_handler(shared_from_this(), &connection::on_watchdog, false));
+		}
+
+		void deliver_stream_data(const std::shared_ptr<http2_stream>& s)
+		{
+			if (!s->data.empty() && !s->failed) {
+				auto& d = s->sink_data;
+
+				std::swap(s->data, d);
+				s->request.sink->on_body(d.data(), d.size(), s);
+			}
+			else if (s->closed)
+				finish_stream(s);
+		}
+
+		void finish_stream(std::shared_ptr<http2_stream> s)
+		{
+			const auto c = shared_from_this();
+			auto& r = s->request;
+
+			streams.erase(s.get());
+
+			if (s->failed)
+				r.handler->on_error(c, false);
+			else {
+				if (r.sink) {
+					metrics->body.record(std::chrono::steady_clock::now() -
+							     s->header_time);
+					r.sink->on_complete();
+				}
+
+				r.handler->on_receive(c, r.sink ? nullptr : &s->response);
+			}
+
+			buffers->put(std::move(s->data));
+			buffers->put(std::move(s->sink_data));
+			buffers->put(std::move(s->response.body()));
+
+			// A request may take the place of the stream.
+			if (!failed)
+				submit_requests();
 		}
 
 		virtual const std::string& get_default_port() const noexcept
@@ -66,84 +268,506 @@ class connection : public std::enable_shared_from_this<connection> {
 			return http_port;
 		}
 
-		virtual beast::tcp_stream& get_tcp_stream() = 0;
+		virtual tcp_stream& get_tcp_stream() = 0;
 
-		void on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
+		void on_body_complete()
 		{
+			auto s = sink;
+
+			metrics->body.record(std::chrono::steady_clock::now() - header_time);
+
+			sink = nullptr;
+			s->on_complete();
+			on_response_complete(nullptr);
+		}
+
+		void on_connect(beast::error_code ec, happy_eyeballs::stream_socket&& socket)
+		{
+			// A connection left idle by a canceled request may be closed meanwhile.
+			if (failed)
+				return;
+
 			if (ec) {
+				const std::string_view h {host};
+
 				BOOST_LOG_TRIVIAL(error) << "Failed to connect to: " << host
 							 << " Error code: " << ec.what();
-				on_error(host);
+				// The addresses may have changed.
+				dns->invalidate(h.substr(0, port_pos), h.substr(port_pos + 1));
+				fail();
 			}
-			else
+			else {
+				const auto now = std::chrono::steady_clock::now();
+
+				metrics->connect.record(now - phase_start);
+				phase_start = now;
+				get_tcp_stream().socket() = std::move(socket);
 				post_connect();
+			}
 		}
 
 		void on_read(beast::error_code ec, size_t)
 		{
+			if (failed)
+				return;
+
 			if (ec)
-				on_error(host);
-			else
-				on_receive_cb(shared_from_this(), &response);
+				fail();
+			else {
+				metrics->bytes.add(response.body().size());
+				on_response_complete(&response);
+			}
+		}
+
+		void on_read_frames(beast::error_code ec, size_t size)
+		{
+			reading = false;
+
+			if (failed)
+				return;
+
+			// The read is canceled once the connection is idle.
+			if (ec == asio::error::operation_aborted) {
+				read_frames();
+				return;
+			}
+
+			if (ec) {
+				fail();
+				return;
+			}
+
+			receiving = true;
+
+			const bool received = http2->receive(body_buffer.data(), size);
+
+			receiving = false;
+
+			if (received)
+				submit_requests();
+			else {
+				BOOST_LOG_TRIVIAL(error) << "HTTP/2 protocol error with: " << host;
+				fail();
+			}
+		}
+
+		void on_read_body(beast::error_code ec, size_t)
+		{
+			if (ec == http::error::need_buffer)
+				ec = {};
+
+			if (failed)
+				return;
+
+			if (ec)
+				fail();
+			else {
+				const size_t size = body_buffer.size() - parser->get().body().size;
+
+				metrics->bytes.add(size);
+
+				if (size && !discard_body) {
+					paused = true;
+					sink->on_body(body_buffer.data(), size, shared_from_this());
+				}
+				else
+					resume();
+			}
+		}
+
+		void on_read_header(beast::error_code ec, size_t)
+		{
+			if (failed)
+				return;
+
+			if (ec)
+				fail();
+			else {
+				header_time = std::chrono::steady_clock::now();
+				metrics->first_byte.record(header_time - requests.front().sent);
+				discard_body = !sink->on_header(parser->get().base());
+				resume();
+			}
 		}
 
-		void on_resolve(beast::error_code ec, tcp::resolver::results_type results)
+		void on_resolve(beast::error_code ec,
+				const std::shared_ptr<const dns_cache::endpoints>& endpoints)
 		{
+			if (failed)
+				return;
+
 			if (ec) {
 				BOOST_LOG_TRIVIAL(error) << "Failed to resolve: " << host
 							 << " Error code: " << ec.what();
-				on_error(host);
+				fail();
 			}
 			else {
 				BOOST_LOG_TRIVIAL(trace) << "Establishing connection "
 							 << sequence_number << " to: " << host;
+				metrics->resolve.record(std::chrono::steady_clock::now() -
+							phase_start);
+				phase_start = std::chrono::steady_clock::now();
 
-				if (pre_connect()) {
-					auto& stream = get_tcp_stream();
-
-					stream.expires_after(timeout);
-					stream.async_connect(
-					    results,
+				if (pre_connect())
+					happy_eyeballs::connect(
+					    get_tcp_stream().get_executor(),
+					    *endpoints,
+					    timeout,
 					    beast::bind_front_handler(&connection::on_connect,
 								      shared_from_this()));
-				}
 				else {
 					BOOST_LOG_TRIVIAL(error)
 					    << "Failed to connect to: " << host;
-					on_error(host);
+					fail();
 				}
 			}
 		}
 
+		void on_response_complete(http_response *r)
+		{
+			auto completed = std::move(requests.front());
+
+			// Requests are only pipelined once the server has kept the connection open.
+			persistent = r ? r->keep_alive() && r->version() == http_version
+				       : parser->get().keep_alive() &&
+					     parser->get().version() == http_version;
+			requests.erase(requests.begin());
+			num_sent--;
+			reading = false;
+			completed.handler->on_receive(shared_from_this(), r);
+
+			if (!failed && !reading && num_sent)
+				read_response();
+		}
+
+		void on_stream_close(void *stream, bool error) override
+		{
+			const auto i = streams.find(stream);
+
+			if (i != streams.end()) {
+				const auto s = i->second;
+
+				s->closed = true;
+				s->failed = error || !s->has_header;
+
+				if (s->sink_data.empty())
+					deliver_stream_data(s);
+			}
+		}
+
+		void on_stream_data(void *stream, const char *data, size_t size) override
+		{
+			const auto i = streams.find(stream);
+
+			if (i == streams.end())
+				return;
+
+			const auto s = i->second;
+
+			metrics->bytes.add(size);
+
+			if (!s->request.sink) {
+				auto& body = s->response.body();
+
+				body.insert(body.end(), data, data + size);
+				http2->consume(s->id, size);
+			}
+			else if (s->discard_body)
+				http2->consume(s->id, size);
+			else {
+				s->data.insert(s->data.end(), data, data + size);
+
+				if (s->sink_data.empty())
+					deliver_stream_data(s);
+			}
+		}
+
+		void on_stream_header(void *stream,
+				      const std::string_view& name,
+				      const std::string_view& value) override
+		{
+			const auto i = streams.find(stream);
+
+			// The trailer fields are ignored.
+			if (i == streams.end() || i->second->has_header)
+				return;
+
+			auto& r = i->second->response;
+
+			if (name == ":status") {
+				unsigned status = 0;
+
+				std::from_chars(value.data(), value.data() + value.size(), status);
+				r.result(status);
+			}
+			else if (name.empty() || name.front() != ':')
+				r.insert(name, value);
+		}
+
+		void on_stream_headers_end(void *stream) override
+		{
+			const auto i = streams.find(stream);
+
+			if (i == streams.end() || i->second->has_header)
+				return;
+
+			const auto s = i->second;
+
+			// Interim responses are skipped.
+			if (s->response.result_int() / 100 == 1) {
+				s->response.base() = http::response_header<> {};
+				return;
+			}
+
+			s->has_header = true;
+
+			if (s->request.sink) {
+				s->header_time = std::chrono::steady_clock::now();
+				metrics->first_byte.record(s->header_time - s->request.sent);
+				s->header.result(s->response.result());
+
+				for (const auto& f : s->response)
+					s->header.insert(f.name_string(), f.value());
+
+				s->discard_body = !s->request.sink->on_header(s->header);
+			}
+		}
+
+		// The watchdog is canceled once no operation is pending, but an operation may have
+		// started since.
+		void on_watchdog(beast::error_code ec)
+		{
+			watching = false;
+
+			if (failed || !num_operations)
+				return;
+
+			if (!ec && std::chrono::steady_clock::now() >= deadline) {
+				BOOST_LOG_TRIVIAL(error) << "Timed out waiting for: " << host;
+				fail();
+			}
+			else
+				arm_watchdog();
+		}
+
 		void on_write(beast::error_code ec, size_t)
 		{
+			writing = false;
+
+			if (failed)
+				return;
+
 			if (ec)
-				on_error(host);
+				fail();
 			else {
-				response = http::response<http::vector_body<char>> {};
-				async_read();
+				requests[num_sent].sent = std::chrono::steady_clock::now();
+				num_sent++;
+
+				if (!reading)
+					read_response();
+
+				write_request();
 			}
 		}
 
+		void on_write_frames(beast::error_code ec, size_t)
+		{
+			writing = false;
+
+			if (failed)
+				return;
+
+			if (ec)
+				fail();
+			else {
+				write_frames();
+				read_frames();
+			}
+		}
+
+		http_request new_request()
+		{
+			return {std::piecewise_construct,
+				std::make_tuple(),
+				std::make_tuple(block_allocator<char>(&memory))};
+		}
+
+		void init_request()
+		{
+			request.version(http_version);
+			request.set(http::field::host, host);
+			request.set(http::field::user_agent, user_agent);
+		}
+
 		virtual bool pre_connect()
 		{
 			return true;
 		}
 
+		// Frames are only read while there are requests in flight, like responses, so
+		// that an idle connection has no pending operation. The read buffer is in use
+		// while frames are processed.
+		void read_frames()
+		{
+			if (failed || receiving)
+				return;
+
+			if (!requests.empty() || !streams.empty()) {
+				if (!reading) {
+					reading = true;
+					async_read_frames();
+				}
+			}
+			else if (reading && !writing) {
+				beast::error_code ec;
+
+				get_tcp_stream().socket().cancel(ec);
+			}
+		}
+
+		void read_response()
+		{
+			reading = true;
+			sink = requests.front().sink;
+
+			if (sink) {
+				parser.emplace(std::piecewise_construct,
+					       std::make_tuple(),
+					       std::make_tuple(block_allocator<char>(&memory)));
+				parser->body_limit(max_body_size);
+			}
+			else {
+				buffers->put(std::move(response.body()));
+				response = http::response<http::vector_body<char>> {};
+				response.body() = buffers->get(0);
+			}
+
+			async_read();
+		}
+
+		void resume_stream(http2_stream *stream)
+		{
+			const auto i = streams.find(stream);
+
+			if (failed || i == streams.end())
+				return;
+
+			const auto s = i->second;
+
+			http2->consume(s->id, s->sink_data.size());
+			s->sink_data.clear();
+			deliver_stream_data(s);
+			write_frames();
+		}
+
+		// Starts streams for the queued requests, as far as the server allows.
+		void submit_requests()
+		{
+			while (!requests.empty() && http2->accepts_streams() &&
+			       streams.size() < http2->get_max_concurrent_streams()) {
+				auto s = std::make_shared<http2_stream>();
+
+				s->request = requests.front();
+				s->c = weak_from_this();
+				requests.erase(requests.begin());
+
+				if (!s->request.sink)
+					s->response.body() = buffers->get(0);
+
+				char range[byte_range::max_field_size];
+				auto& r = s->request;
+
+				r.sent = std::chrono::steady_clock::now();
+				s->id = http2->submit(host,
+						      r.resource,
+						      r.fields,
+						      r.range.is_whole() ? std::string_view {}
+									 : r.range.format(range),
+						      s.get());
+
+				if (s->id < 0) {
+					BOOST_LOG_TRIVIAL(error)
+					    << "Failed to submit an HTTP/2 request to: " << host;
+					s->request.handler->on_error(shared_from_this(), false);
+				}
+				else
+					streams.emplace(s.get(), std::move(s));
+			}
+
+			write_frames();
+			read_frames();
+		}
+
+		// The connection is closed once the server has ended the session.
+		void write_frames()
+		{
+			if (failed || receiving || writing)
+				return;
+
+			// Producing the frames closes the streams that have been reset, whose
+			// handlers may make requests.
+			writing = true;
+			output = http2->get_output();
+			writing = false;
+
+			if (http2->has_failed() || (output.empty() && !http2->is_open()))
+				fail();
+			else if (!output.empty()) {
+				writing = true;
+				async_write_frames();
+			}
+		}
+
+		void write_request()
+		{
+			if (writing || num_sent == requests.size())
+				return;
+
+			const auto& r = requests[num_sent];
+
+			// Drop the fields of the previous request.
+			if (has_fields) {
+				request = new_request();
+				init_request();
+			}
+
+			has_fields = r.fields && r.fields->begin() != r.fields->end();
+
+			if (has_fields)
+				for (const auto& f : *r.fields)
+					request.set(f.name_string(), f.value());
+
+			// The range is dropped from the next request like the fields.
+			if (!r.range.is_whole()) {
+				char range[byte_range::max_field_size];
+
+				request.set(http::field::range, r.range.format(range));
+				has_fields = true;
+			}
+
+			request.method(http::verb::get);
+			request.target(r.resource);
+			writing = true;
+			async_write();
+		}
+
 	protected:
 		std::string host;
-		on_error_callback on_error;
+		// When the current phase of establishing the connection started.
+		std::chrono::steady_clock::time_point phase_start;
+		host_metrics * const metrics = nullptr;
 		std::string_view::size_type port_pos = 0;
 
 		connection(size_t sequence_number,
 			   const std::string_view& h,
-			   tcp::resolver *resolver) :
-		    resolver(resolver),
-		    sequence_number(sequence_number), host(h)
+			   asio::io_context *io,
+			   dns_cache *dns,
+			   buffer_pool *buffers,
+			   host_metrics *metrics) :
+		    request(new_request()),
+		    dns(dns), buffers(buffers), watchdog(*io), sequence_number(sequence_number),
+		    host(h), metrics(metrics)
 		{
-			request.version(http_version);
-			request.set(http::field::user_agent, user_agent);
-
 			auto pos = host.find(port_delimiter);
 
 			if (pos == std::string::npos) {
@@ -155,69 +779,315 @@ class connection : public std::enable_shared_from_this<connection> {
 			}
 
 			port_pos = pos;
-			request.set(http::field::host, host);
+			init_request();
 		}
 
 		connection(const connection&) = default;
 		connection(connection&&) = default;
-		virtual ~connection() = default;
+		virtual ~connection()
+		{
+			buffers->put(std::move(body_buffer));
+			buffers->put(std::move(response.body()));
+		}
+
+		// Counts the operation until its handler is called, for the watchdog.
+		template<typename derived, typename... Args>
+		operation_handler<derived, Args...>
+		bind_operation(const std::shared_ptr<derived>& c, void (derived::*f)(Args...))
+		{
+			deadline = std::chrono::steady_clock::now() + timeout;
+
+			if (!num_operations++ && !watching)
+				arm_watchdog();
+
+			return {c, f, true};
+		}
+
+		// An idle connection has no pending operation, not even the watchdog.
+		void end_operation()
+		{
+			deadline = std::chrono::steady_clock::now() + timeout;
+
+			if (!--num_operations && watching)
+				watchdog.cancel();
+		}
 
 		template<typename stream> void do_async_read(stream& s)
 		{
-			http::async_read(
+			if (sink)
+				http::async_read_header(
+				    s,
+				    buffer,
+				    *parser,
+				    bind_operation(shared_from_this(),
+						   &connection::on_read_header));
+			else
+				http::async_read(s,
+						 buffer,
+						 response,
+						 bind_operation(shared_from_this(),
+								&connection::on_read));
+		}
+
+		template<typename stream> void do_async_read_body(stream& s)
+		{
+			http::async_read_some(
 			    s,
 			    buffer,
-			    response,
-			    beast::bind_front_handler(&connection::on_read, shared_from_this()));
+			    *parser,
+			    bind_operation(shared_from_this(), &connection::on_read_body));
+		}
+
+		template<typename stream> void do_async_read_frames(stream& s)
+		{
+			s.async_read_some(
+			    asio::buffer(body_buffer),
+			    bind_operation(shared_from_this(), &connection::on_read_frames));
 		}
 
 		template<typename stream> void do_async_write(stream& s)
 		{
 			http::async_write(
+			    s, request, bind_operation(shared_from_this(), &connection::on_write));
+		}
+
+		template<typename stream> void do_async_write_frames(stream& s)
+		{
+			asio::async_write(
 			    s,
-			    request,
-			    beast::bind_front_handler(&connection::on_write, shared_from_this()));
+			    asio::buffer(output.data(), output.size()),
+			    bind_operation(shared_from_this(), &connection::on_write_frames));
+		}
+
+		// Fails all the requests in flight, which may then be retried on other
+		// connections. The connection is not used again, and requests made afterwards
+		// fail immediately.
+		void fail()
+		{
+			const auto c = shared_from_this();
+			auto r = std::move(requests);
+			auto s = std::move(streams);
+			const auto on_error = [this, &c](pending_request& p) {
+				const bool release = !released;
+
+				released = true;
+				p.handler->on_error(c, release);
+			};
+
+			if (!failed) {
+				beast::error_code ec;
+
+				// A server that announced closing the connection has not failed the
+				// requests pipelined behind the last response.
+				failed = true;
+				pipeline_failed = r.size() > 1 && persistent;
+				get_tcp_stream().socket().close(ec);
+				watchdog.cancel();
+			}
+
+			requests.clear();
+			streams.clear();
+
+			for (auto& p : s)
+				on_error(p.second->request);
+
+			for (auto& p : r)
+				on_error(p);
 		}
 
 		virtual void post_connect()
 		{
 			connected = true;
-			async_write();
+			write_request();
+		}
+
+		void start_http2()
+		{
+			BOOST_LOG_TRIVIAL(trace) << "Using HTTP/2 with: " << host;
+			connected = true;
+			http2 = std::make_unique<http2_session>(
+			    static_cast<http2_session::listener *>(this));
+
+			if (body_buffer.empty()) {
+				body_buffer = buffers->get(body_buffer_size);
+				body_buffer.resize(body_buffer_size);
+			}
+
+			submit_requests();
 		}
 
 	public:
-		void get(const std::string_view& resource,
-			 on_receive_callback&& on_receive_fn,
-			 on_error_callback&& on_error_cb)
+		// Closes an idle connection, which the pool no longer counts.
+		void close()
 		{
-			request.method(http::verb::get);
-			request.target(resource);
-			on_error = std::move(on_error_cb);
-			on_receive_cb = std::move(on_receive_fn);
+			beast::error_code ec;
 
-			if (connected)
-				async_write();
-			else {
+			failed = true;
+			released = true;
+			get_tcp_stream().socket().close(ec);
+			watchdog.cancel();
+		}
+
+		// The fields are added to the request, and only the range of the resource is
+		// requested. If a sink is passed, the response body is passed to it as it arrives,
+		// and the handler gets a null response. A request made while others are in flight
+		// is pipelined behind them, or sent on its own stream with HTTP/2. A held request
+		// is one that the server may hold on purpose, behind which no other request is
+		// pipelined. The resource and the fields must remain valid until the handler is
+		// called.
+		void get(request_handler *handler,
+			 const std::string_view& resource,
+			 const http::fields *fields,
+			 const byte_range& range,
+			 response_sink *s,
+			 bool held = false)
+		{
+			requests.push_back({resource, handler, fields, s, range, {}, held});
+
+			if (s && body_buffer.empty()) {
+				body_buffer = buffers->get(body_buffer_size);
+				body_buffer.resize(body_buffer_size);
+				buffer.reserve(body_buffer_size);
+			}
+
+			if (failed)
+				fail();
+			else if (http2)
+				submit_requests();
+			else if (connected)
+				write_request();
+			else if (!connecting) {
 				const std::string_view h {host};
 
-				resolver->async_resolve(
-				    h.substr(0, port_pos),
-				    h.substr(port_pos + 1),
-				    beast::bind_front_handler(&connection::on_resolve,
-							      shared_from_this()));
+				connecting = true;
+				phase_start = std::chrono::steady_clock::now();
+				dns->resolve(h.substr(0, port_pos),
+					     h.substr(port_pos + 1),
+					     beast::bind_front_handler(&connection::on_resolve,
+								       shared_from_this()));
 			}
 		}
 
+		// Gives up on a request without failing the other ones, if possible; the handler
+		// gets an error unless the whole response has been received. An HTTP/2 stream is
+		// reset, and an HTTP/1.1 request is dropped unless it has been written, in which
+		// case the connection is closed.
+		void cancel(request_handler *handler)
+		{
+			if (failed)
+				return;
+
+			const auto c = shared_from_this();
+
+			for (const auto& p : streams)
+				if (p.second->request.handler == handler) {
+					if (!p.second->closed) {
+						http2->reset(p.second->id);
+						write_frames();
+					}
+
+					return;
+				}
+
+			for (size_t i = 0; i < requests.size(); i++)
+				if (requests[i].handler == handler) {
+					if (!http2 &&
+					    (i < num_sent || (i == num_sent && writing))) {
+						// The connection is not at fault for the other
+						// requests in flight.
+						persistent = false;
+						fail();
+					}
+					else {
+						requests.erase(requests.begin() + i);
+						handler->on_error(c, false);
+					}
+
+					return;
+				}
+		}
+
 		const std::string& get_host() const noexcept
 		{
 			return host;
 		}
+
+		size_t get_pending_requests() const noexcept
+		{
+			return requests.size() + streams.size();
+		}
+
+		// Whether further requests may be sent on their own HTTP/2 streams.
+		bool is_multiplexed() const noexcept
+		{
+			return http2 && !failed && http2->accepts_streams() &&
+			       get_pending_requests() < http2->get_max_concurrent_streams();
+		}
+
+		// Whether further requests may be pipelined on the connection, which is not the
+		// case behind a response that the server may hold, nor while the sink holds the
+		// data of a response: it may wait for a response that would be queued behind.
+		bool is_pipelinable() const noexcept
+		{
+			return persistent && !failed && !paused &&
+			       std::none_of(requests.cbegin(),
+					    requests.cend(),
+					    [](const pending_request& r) { return r.held; });
+		}
+
+		// Whether other responses wait behind the one being read.
+		bool blocks_responses() const noexcept override
+		{
+			return !http2 && requests.size() > 1;
+		}
+
+		// Whether the connection may take further requests once idle, which is not the
+		// case once the server has announced closing it.
+		bool is_reusable() const noexcept
+		{
+			return !failed && (http2 ? http2->is_open() : persistent);
+		}
+
+		bool has_failed() const noexcept
+		{
+			return failed;
+		}
+
+		// Whether the server violated the HTTP/2 protocol.
+		bool has_http2_failed() const noexcept
+		{
+			return http2 && http2->has_failed();
+		}
+
+		// Whether the connection failed with more than one request in flight.
+		bool has_pipeline_failed() const noexcept
+		{
+			return pipeline_failed;
+		}
+
+		void resume() override
+		{
+			paused = false;
+
+			if (failed)
+				return;
+
+			if (parser->is_done())
+				on_body_complete();
+			else {
+				auto& body = parser->get().body();
+
+				body.data = body_buffer.data();
+				body.size = body_buffer.size();
+				async_read_body();
+			}
+		}
 };
 
 class http_connection : public virtual connection {
-		beast::tcp_stream stream;
+		tcp_stream stream;
 
-		beast::tcp_stream& get_tcp_stream() override
+		tcp_stream& get_tcp_stream() override
 		{
 			return stream;
 		}
@@ -226,74 +1096,125 @@ class http_connection : public virtual connection {
 		http_connection(size_t sequence_number,
 				const std::string_view& h,
 				asio::io_context *io,
-				tcp::resolver *resolver) :
-		    connection(sequence_number, h, resolver),
+				dns_cache *dns,
+				buffer_pool *buffers,
+				host_metrics *metrics) :
+		    connection(sequence_number, h, io, dns, buffers, metrics),
 		    stream(*io)
 		{
 		}
 };
 
 class https_connection : public virtual connection {
-		beast::ssl_stream<beast::tcp_stream> stream;
+		beast::ssl_stream<tcp_stream> stream;
+		tls_session_cache * const sessions = nullptr;
+		const bool offer_http2 = false;
 
 		void async_read() override
 		{
-			get_tcp_stream().expires_after(timeout);
 			do_async_read(stream);
 		}
 
+		void async_read_body() override
+		{
+			do_async_read_body(stream);
+		}
+
+		void async_read_frames() override
+		{
+			do_async_read_frames(stream);
+		}
+
 		void async_write() override
 		{
-			get_tcp_stream().expires_after(timeout);
 			do_async_write(stream);
 		}
 
+		void async_write_frames() override
+		{
+			do_async_write_frames(stream);
+		}
+
 		const std::string& get_default_port() const noexcept override
 		{
 			return https_port;
 		}
 
-		beast::tcp_stream& get_tcp_stream() override
+		tcp_stream& get_tcp_stream() override
 		{
 			return beast::get_lowest_layer(stream);
 		}
 
 		void on_handshake(beast::error_code ec)
 		{
+			if (has_failed())
+				return;
+
+			sessions->on_handshake(host, !!ec);
+
 			if (ec) {
 				BOOST_LOG_TRIVIAL(error) << "Failed TLS handshake with: " << host
 							 << " Error code: " << ec.what();
-				on_error(host);
+				fail();
+			}
+			else {
+				metrics->tls_handshake.record(std::chrono::steady_clock::now() -
+							      phase_start);
+
+				if (SSL_session_reused(stream.native_handle()))
+					metrics->tls_resumed_handshakes.add(1);
+				else
+					metrics->tls_full_handshakes.add(1);
+
+				const unsigned char *p = nullptr;
+				unsigned int size = 0;
+
+				SSL_get0_alpn_selected(stream.native_handle(), &p, &size);
+
+				const std::string_view protocol {reinterpret_cast<const char *>(p),
+								 size};
+
+				if (protocol == "h2")
+					start_http2();
+				else
+					connection::post_connect();
 			}
-			else
-				connection::post_connect();
 		}
 
 		void post_connect() override
 		{
 			auto c = std::dynamic_pointer_cast<https_connection>(shared_from_this());
 
-			get_tcp_stream().expires_after(timeout);
-			stream.async_handshake(
-			    asio::ssl::stream_base::client,
-			    beast::bind_front_handler(&https_connection::on_handshake, c));
+			stream.async_handshake(asio::ssl::stream_base::client,
+					       bind_operation(c, &https_connection::on_handshake));
 		}
 
 		bool pre_connect() override
 		{
 			const std::string h {host.substr(0, host.find(port_delimiter))};
 
-			return !!SSL_set_tlsext_host_name(stream.native_handle(), h.c_str());
+			// SSL_set_alpn_protos() returns 0 on success.
+			return SSL_set_tlsext_host_name(stream.native_handle(), h.c_str()) &&
+			       sessions->prepare(stream.native_handle(), host) &&
+			       (!offer_http2 || !SSL_set_alpn_protos(stream.native_handle(),
+								     alpn_protocols,
+								     sizeof(alpn_protocols) - 1));
 		}
 
 	public:
+		// HTTP/2 is offered to the server during the TLS handshake if offer_http2 is set.
+		// The handshake resumes a session of an earlier connection to the host if possible.
 		https_connection(size_t sequence_number,
 				 const std::string_view& h,
 				 asio::io_context *io,
-				 tcp::resolver *resolver,
-				 ssl::context *tls_context) :
-		    connection(sequence_number, h, resolver),
-		    stream(*io, *tls_context)
+				 dns_cache *dns,
+				 buffer_pool *buffers,
+				 host_metrics *metrics,
+				 ssl::context *tls_context,
+				 tls_session_cache *sessions,
+				 bool offer_http2) :
+		    connection(sequence_number, h, io, dns, buffers, metrics),
+		    stream(*io, *tls_context), sessions(sessions), offer_http2(offer_http2)
 		{
 		}
 };
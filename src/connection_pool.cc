@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <boost/beast.hpp>
 #include <boost/log/trivial.hpp>
 #include <functional>
@@ -9,91 +10,782 @@
 #include "connection.h"
 #include "connection_pool.h"
 
-static const size_t max_connections = 4;
+void connection_pool::get(bool is_https,
+			  const std::string_view& host,
+			  const std::string_view& resource,
+			  const http::fields *fields,
+			  const byte_range& range,
+			  const on_receive_callback& on_receive,
+			  response_sink *sink,
+			  const on_error_callback& on_error,
+			  bool held,
+			  size_t retry_number)
+{
+	auto r = new_request();
+
+	r->resource.assign(resource);
+	r->on_receive_fn = on_receive;
+	r->on_error_fn = on_error;
+	r->fields = fields;
+	r->sink = sink;
+	r->range = range;
+	r->host_id = get_host_id(is_https, host);
+	r->retry_number = retry_number;
+	r->held = held;
+	hosts[r->host_id].metrics.requests.add(1);
+
+	// Only the responses passed to a sink are hedged, and not those that the server may hold
+	// on purpose, such as the parts announced by preload hints.
+	if (sink && !held)
+		hosts[r->host_id].hedging.on_request();
+
+	send(r);
+}
+
+void connection_pool::get(bool is_https,
+			  const std::string_view& host,
+			  const std::string_view& resource,
+			  const on_receive_callback& on_receive,
+			  const on_error_callback& on_error,
+			  size_t retry_number)
+{
+	get(is_https,
+	    host,
+	    resource,
+	    nullptr,
+	    {},
+	    on_receive,
+	    nullptr,
+	    on_error,
+	    false,
+	    retry_number);
+}
+
+void connection_pool::get(bool is_https,
+			  const std::string_view& host,
+			  const std::string_view& resource,
+			  const http::fields *fields,
+			  const on_receive_callback& on_receive,
+			  const on_error_callback& on_error,
+			  bool held,
+			  size_t retry_number)
+{
+	get(is_https,
+	    host,
+	    resource,
+	    fields,
+	    {},
+	    on_receive,
+	    nullptr,
+	    on_error,
+	    held,
+	    retry_number);
+}
+
+void connection_pool::get(bool is_https,
+			  const std::string_view& host,
+			  const std::string_view& resource,
+			  response_sink *sink,
+			  const on_error_callback& on_error,
+			  size_t retry_number)
+{
+	get(is_https, host, resource, nullptr, {}, nullptr, sink, on_error, false, retry_number);
+}
 
 void connection_pool::get(bool is_https,
 			  const std::string_view& host,
 			  const std::string_view& resource,
+			  const byte_range& range,
 			  const on_receive_callback& on_receive,
 			  const on_error_callback& on_error,
 			  size_t retry_number)
+{
+	get(is_https,
+	    host,
+	    resource,
+	    nullptr,
+	    range,
+	    on_receive,
+	    nullptr,
+	    on_error,
+	    false,
+	    retry_number);
+}
+
+void connection_pool::get(bool is_https,
+			  const std::string_view& host,
+			  const std::string_view& resource,
+			  const byte_range& range,
+			  response_sink *sink,
+			  const on_error_callback& on_error,
+			  bool held,
+			  size_t retry_number)
+{
+	get(is_https, host, resource, nullptr, range, nullptr, sink, on_error, held, retry_number);
+}
+
+void connection_pool::add_in_flight(host& h, request *r)
+{
+	const auto delay = h.hedging.get_delay();
+
+	if (delay == clock::duration::max())
+		return;
+
+	r->in_flight = true;
+	r->prev_in_flight = h.last_in_flight;
+	r->next_in_flight = nullptr;
+
+	if (h.last_in_flight)
+		h.last_in_flight->next_in_flight = r;
+	else
+		h.first_in_flight = r;
+
+	h.last_in_flight = r;
+
+	const auto deadline = r->start + r->paused_time + delay;
+
+	if (deadline < hedge_deadline) {
+		hedge_deadline = deadline;
+		hedge_timer.expires_at(hedge_deadline);
+		hedge_timer.async_wait(
+		    std::bind(&connection_pool::on_hedge_timer, this, std::placeholders::_1));
+	}
+}
+
+void connection_pool::cancel(request *r)
+{
+	r->cancelled = true;
+	remove_in_flight(hosts[r->host_id], r);
+
+	if (!r->finished)
+		r->c->cancel(r);
+	else if (!r->paused)
+		release_request(r);
+}
+
+connection_pool::request *connection_pool::dequeue(host& h)
+{
+	auto r = h.first_request;
+
+	h.first_request = r->next;
+
+	if (!h.first_request)
+		h.last_request = nullptr;
+
+	return r;
+}
+
+std::shared_ptr<connection>
+connection_pool::get_connection(host& h, const connection *excluded, size_t *retry_number)
 {
 	std::shared_ptr<connection> c;
-	std::string h {host};
 
-	if (host.find(port_delimiter) == std::string_view::npos) {
+	if (!h.idle_connections.empty()) {
+		c = std::move(h.idle_connections.back().c);
+		h.idle_connections.pop_back();
+		(*retry_number)++;
+		h.busy_connections.push_back(c);
+	}
+	// A request on a busy connection is retried if the server closes the connection before
+	// responding, the same as one on an idle connection.
+	else if ((c = get_multiplexed_connection(h, excluded)))
+		(*retry_number)++;
+	else if (h.num_connections < h.connection_limit.get_limit())
+		c = open_connection(h);
+
+	return c;
+}
+
+size_t connection_pool::get_host_id(bool is_https, const std::string_view& name)
+{
+	auto& ids = host_ids[is_https];
+	const auto i = ids.find(name);
+
+	if (i != ids.end())
+		return i->second;
+
+	std::string n {name};
+
+	if (name.find(port_delimiter) == std::string_view::npos) {
 		const auto d = port_delimiter;
 
-		h.append(&d, 1);
-		h.append(is_https ? https_port : http_port);
+		n.append(&d, 1);
+		n.append(is_https ? https_port : http_port);
+	}
+
+	const auto j = ids.find(n);
+	size_t id = hosts.size();
+
+	if (j != ids.end())
+		id = j->second;
+	else {
+		auto& h = hosts.emplace_back();
+
+		h.name = std::move(n);
+		h.is_https = is_https;
+		ids.emplace(h.name, id);
+
+		if (registry)
+			registry->add_host(h.name, &h.metrics);
+	}
+
+	if (name != hosts[id].name)
+		ids.emplace(host_aliases.emplace_back(name), id);
+
+	return id;
+}
+
+std::shared_ptr<connection> connection_pool::get_multiplexed_connection(const host& h,
+									const connection *excluded)
+{
+	std::shared_ptr<connection> ret;
+
+	for (const auto& c : h.busy_connections)
+		if (c.get() != excluded && c->is_multiplexed() &&
+		    (!ret || c->get_pending_requests() < ret->get_pending_requests()))
+			ret = c;
+
+	return ret;
+}
+
+std::shared_ptr<connection> connection_pool::get_pipelined_connection(const host& h,
+								       const request *r)
+{
+	std::shared_ptr<connection> ret;
+
+	// Playlists and keys wait for a connection of their own rather than behind a segment.
+	// Nothing is pipelined behind a request that the server may hold.
+	if (pipeline_depth > 1 && !h.serial && r->sink)
+		for (const auto& c : h.busy_connections)
+			if (c->is_pipelinable() && c->get_pending_requests() < pipeline_depth &&
+			    (!ret || c->get_pending_requests() < ret->get_pending_requests()))
+				ret = c;
+
+	return ret;
+}
+
+void connection_pool::hedge(request *r)
+{
+	auto& h = hosts[r->host_id];
+	size_t retry_number = 0;
+
+	if (!h.hedging.may_hedge())
+		return;
+
+	auto c = get_connection(h, r->c.get(), &retry_number);
+
+	// The budget limits the connections that hedges open above the limit, which are
+	// closed once idle.
+	if (!c)
+		c = open_connection(h);
+
+	BOOST_LOG_TRIVIAL(debug) << "Hedging: " << (h.is_https ? HTTPS_PREFIX : HTTP_PREFIX)
+				 << h.name << r->resource;
+	h.hedging.on_hedge();
+	h.metrics.hedges.add(1);
+
+	const auto b = new_request();
+
+	b->resource.assign(r->resource);
+	b->on_error_fn = r->on_error_fn;
+	b->c = c;
+	b->start = clock::now();
+	b->fields = r->fields;
+	b->sink = r->sink;
+	b->range = r->range;
+	b->peer = r;
+	b->host_id = r->host_id;
+	b->retry_number = retry_number;
+	b->hedge = true;
+	r->peer = b;
+	r->hedged = true;
+	c->get(b, b->resource, b->fields, b->range, b);
+}
+
+connection_pool::request *connection_pool::new_request()
+{
+	auto r = free_requests;
+
+	if (r)
+		free_requests = r->next;
+	else {
+		r = &requests.emplace_back();
+		r->pool = this;
+	}
+
+	r->next = nullptr;
+	return r;
+}
+
+std::shared_ptr<connection> connection_pool::open_connection(host& h)
+{
+	std::shared_ptr<connection> c;
+
+	if (h.is_https)
+		c = std::make_shared<https_connection>(sequence_number,
+						       h.name,
+						       io,
+						       &dns,
+						       &buffers,
+						       &h.metrics,
+						       &tls_context,
+						       &tls_sessions,
+						       !h.http1);
+	else
+		c = std::make_shared<http_connection>(
+		    sequence_number, h.name, io, &dns, &buffers, &h.metrics);
+
+	h.num_connections++;
+	sequence_number++;
+	h.busy_connections.push_back(c);
+	return c;
+}
+
+void connection_pool::on_body(request *r,
+			      const char *data,
+			      size_t size,
+			      const std::shared_ptr<body_reader>& reader)
+{
+	if (r->cancelled)
+		reader->resume();
+	else if (r->hedge) {
+		auto& d = r->body;
+
+		// A hedge that would exceed the budget is dropped, unless it has taken the
+		// place of a request that failed, and then gets to the end of its connection.
+		if (budget && r->peer && !r->peer->cancelled) {
+			if (!budget->acquire(r->budget_size, size)) {
+				BOOST_LOG_TRIVIAL(debug) << "Dropped hedge over the memory budget: "
+							 << r->resource;
+				r->cancelled = true;
+				r->peer->peer = nullptr;
+				r->peer = nullptr;
+				reader->resume();
+				return;
+			}
+
+			r->budget_size += size;
+		}
+
+		if (d.capacity() - d.size() < size) {
+			auto b = buffers.get(d.size() + size);
+
+			b.insert(b.end(), d.cbegin(), d.cend());
+			buffers.put(std::move(d));
+			d = std::move(b);
+		}
+
+		d.insert(d.end(), data, data + size);
+		reader->resume();
+	}
+	else {
+		r->reader = reader;
+		r->paused = true;
+		r->pause_start = clock::now();
+		// A request is not hedged for being held by the sink.
+		remove_in_flight(hosts[r->host_id], r);
+		// The sink does not own the request.
+		r->sink->on_body(
+		    data, size, std::shared_ptr<body_reader>(std::shared_ptr<body_reader>(), r));
+	}
+}
+
+void connection_pool::on_error(request *r, const std::shared_ptr<connection>& c, bool release)
+{
+	auto& h = hosts[r->host_id];
+
+	// The other requests in flight on the connection fail after the first one.
+	if (release) {
+		h.num_connections--;
+		remove_busy_connection(h, c);
+
+		if (c->has_pipeline_failed() && !h.serial) {
+			h.serial = true;
+			BOOST_LOG_TRIVIAL(warning) << "Stopped pipelining requests to: " << h.name;
+		}
+
+		if (c->has_http2_failed() && !h.http1) {
+			h.http1 = true;
+			BOOST_LOG_TRIVIAL(warning) << "Stopped using HTTP/2 with: " << h.name;
+		}
+
+		// A request that lost to its hedge does not say much about the host.
+		if (!r->cancelled && h.connection_limit.on_error(r->start))
+			BOOST_LOG_TRIVIAL(debug) << "Connection limit for " << h.name << ": "
+						 << h.connection_limit.get_limit();
+	}
+	// An HTTP/2 stream failed on its own.
+	else if (!c->has_failed() && !c->get_pending_requests())
+		put_idle_connection(h, c);
+
+	remove_in_flight(h, r);
+	r->finished = true;
+
+	// While the other request of a hedged pair may still succeed, the failed one is neither
+	// retried nor reported.
+	if (r->cancelled || (r->peer && !r->peer->cancelled)) {
+		r->cancelled = true;
+
+		if (!r->paused)
+			release_request(r);
+
+		if (release && h.first_request)
+			send(dequeue(h));
+
+		return;
+	}
+
+	// The retry, or else the first queued request, takes the place of the failed connection
+	// before the error callback may issue new requests, which keeps the requests in order.
+	// The requests that failed with HTTP/2 are retried with HTTP/1.1.
+	if (r->retry_number || c->has_http2_failed()) {
+		if (r->retry_number)
+			r->retry_number--;
+
+		h.metrics.retries.add(1);
+		send(r);
+		return;
+	}
+
+	if (release && h.first_request)
+		send(dequeue(h));
+
+	BOOST_LOG_TRIVIAL(error) << "Failed to get: " << (h.is_https ? HTTPS_PREFIX : HTTP_PREFIX)
+				 << h.name << r->resource;
+	h.metrics.errors.add(1);
+	r->on_error_fn();
+
+	// The sink may still hold the request, which is then released once resumed.
+	if (r->paused)
+		r->cancelled = true;
+	else
+		release_request(r);
+}
+
+bool connection_pool::on_header(request *r, const response_header& header)
+{
+	if (r->cancelled)
+		return false;
+
+	if (!r->hedge)
+		return r->sink->on_header(header);
+
+	// The body of a retry replaces the one received before.
+	if (budget)
+		budget->release(0, r->budget_size);
+
+	r->header = header;
+	r->body.clear();
+	r->budget_size = 0;
+	return header.result_int() / 100 == 2;
+}
+
+void connection_pool::on_hedge_timer(const boost::system::error_code& ec)
+{
+	// The timer is reset when a request needs to be hedged earlier.
+	if (ec)
+		return;
+
+	const auto now = clock::now();
+
+	hedge_deadline = clock::time_point::max();
+
+	for (auto& h : hosts) {
+		const auto delay = h.hedging.get_delay();
+
+		// The requests that have been held by their sink are no longer in order.
+		for (auto r = h.first_in_flight; r;) {
+			const auto next = r->next_in_flight;
+			const auto deadline = r->start + r->paused_time + delay;
+
+			if (now >= deadline) {
+				remove_in_flight(h, r);
+				hedge(r);
+			}
+			else
+				hedge_deadline = std::min(hedge_deadline, deadline);
+
+			r = next;
+		}
 	}
 
-	if (connections[h].empty()) {
-		if (num_connections[h] >= max_connections) {
-			requests[h].emplace_back(
-			    std::make_tuple(is_https, h, resource, on_receive, on_error));
-			return;
+	if (hedge_deadline != clock::time_point::max()) {
+		hedge_timer.expires_at(hedge_deadline);
+		hedge_timer.async_wait(
+		    std::bind(&connection_pool::on_hedge_timer, this, std::placeholders::_1));
+	}
+}
+
+void connection_pool::on_idle_timer(const boost::system::error_code& ec)
+{
+	if (!ec)
+		reap_idle_connections();
+}
+
+void connection_pool::on_receive(request *r,
+				 const std::shared_ptr<connection>& c,
+				 http_response *response)
+{
+	auto& h = hosts[r->host_id];
+	// More connections do not help while requests may be multiplexed, nor if the connection
+	// is about to take the only queued request.
+	const bool requests_waiting =
+	    h.first_request && !c->is_multiplexed() &&
+	    (c->get_pending_requests() || h.first_request != h.last_request);
+	// The time for which the sink has held the request says nothing about the host, nor does
+	// a response that the server held on purpose.
+	const auto response_time = clock::now() - r->start - r->paused_time;
+
+	if (!r->held &&
+	    h.connection_limit.on_response(r->start, response_time, requests_waiting))
+		BOOST_LOG_TRIVIAL(debug) << "Connection limit for " << h.name << ": "
+					 << h.connection_limit.get_limit();
+
+	remove_in_flight(h, r);
+	r->finished = true;
+
+	if (r->cancelled) {
+		if (!r->paused)
+			release_request(r);
+	}
+	// A hedge wins with a successful response, unless the request has failed meanwhile.
+	else if (r->hedge && r->peer && !r->peer->cancelled && r->header.result_int() / 100 != 2)
+		release_request(r);
+	else if (r->hedge) {
+		const auto p = r->peer;
+		// The sink may still hold the data of the other request.
+		const bool waiting = p && p->paused;
+
+		BOOST_LOG_TRIVIAL(debug) << "Hedge won: "
+					 << (h.is_https ? HTTPS_PREFIX : HTTP_PREFIX) << h.name
+					 << r->resource;
+		h.hedging.on_response(response_time);
+
+		if (p && !waiting) {
+			p->peer = nullptr;
+			r->peer = nullptr;
 		}
 
-		c = is_https
-			? std::static_pointer_cast<connection>(std::make_shared<https_connection>(
-			      sequence_number, h, io, &resolver, &tls_context))
-			: std::static_pointer_cast<connection>(
-			      std::make_shared<http_connection>(sequence_number, h, io, &resolver));
-		num_connections[h]++;
-		sequence_number++;
+		if (p)
+			cancel(p);
+
+		if (!waiting)
+			replay(r);
 	}
 	else {
-		c = connections[h].back();
-		connections[h].pop_back();
-		retry_number++;
-	}
-
-	auto on_error_wrapper =
-	    [is_https, on_receive, on_error, resource = std::string {resource}, retry_number, this](
-		const std::string& host) {
-		    num_connections[host]--;
-
-		    if (retry_number)
-			    get(is_https, host, resource, on_receive, on_error, retry_number - 1);
-		    else {
-			    BOOST_LOG_TRIVIAL(error)
-				<< "Failed to get: " << (is_https ? HTTPS_PREFIX : HTTP_PREFIX)
-				<< host << resource;
-			    on_error();
-		    }
-
-		    if (!requests[host].empty()) {
-			    const auto r = requests[host].front();
-
-			    requests[host].pop_front();
-			    get(std::get<0>(r),
-				std::get<1>(r),
-				std::get<2>(r),
-				std::get<3>(r),
-				std::get<4>(r));
-		    }
-	    };
-	auto on_receive_wrapper = [on_receive, this](const std::shared_ptr<connection>& connection,
-						     http_response *response) {
-		const auto& host = connection->get_host();
-
-		on_receive(response);
-		connections[host].push_back(connection);
-
-		if (!requests[host].empty()) {
-			const auto r = requests[host].front();
-
-			requests[host].pop_front();
-			get(std::get<0>(r),
-			    std::get<1>(r),
-			    std::get<2>(r),
-			    std::get<3>(r),
-			    std::get<4>(r));
+		if (r->sink && !r->held)
+			h.hedging.on_response(response_time);
+
+		if (r->peer)
+			cancel(r->peer);
+
+		if (r->on_receive_fn)
+			r->on_receive_fn(response);
+
+		release_request(r);
+	}
+
+	if (!c->get_pending_requests())
+		put_idle_connection(h, c);
+
+	// The queued requests are multiplexed or pipelined as far as possible, and get new
+	// connections once the limit has grown.
+	while (h.first_request &&
+	       (!h.idle_connections.empty() || get_multiplexed_connection(h, nullptr) ||
+		h.num_connections < h.connection_limit.get_limit() ||
+		get_pipelined_connection(h, h.first_request)))
+		send(dequeue(h));
+}
+
+void connection_pool::put_idle_connection(host& h, const std::shared_ptr<connection>& c)
+{
+	remove_busy_connection(h, c);
+
+	// The connections above a lowered limit are closed as they become idle, as are those that
+	// the server is closing, rather than failing the next request.
+	if (h.num_connections > h.connection_limit.get_limit() || !c->is_reusable()) {
+		c->close();
+		h.num_connections--;
+		return;
+	}
+
+	h.idle_connections.push_back({c, clock::now()});
+
+	if (!reaping)
+		reap_idle_connections();
+}
+
+void connection_pool::reap_idle_connections()
+{
+	const auto now = clock::now();
+	auto next = clock::time_point::max();
+
+	for (auto& h : hosts) {
+		auto& idle = h.idle_connections;
+		auto i = idle.begin();
+
+		for (; i != idle.end() && now - i->since >= idle_timeout; i++) {
+			BOOST_LOG_TRIVIAL(trace) << "Closing an idle connection to: " << h.name;
+			i->c->close();
+			h.num_connections--;
 		}
-	};
 
-	c->get(resource, on_receive_wrapper, on_error_wrapper);
+		idle.erase(idle.begin(), i);
+
+		if (!idle.empty())
+			next = std::min(next, idle.front().since + idle_timeout);
+	}
+
+	reaping = next != clock::time_point::max();
+
+	if (reaping) {
+		idle_timer.expires_at(next);
+		idle_timer.async_wait(
+		    std::bind(&connection_pool::on_idle_timer, this, std::placeholders::_1));
+	}
+}
+
+void connection_pool::release_request(request *r)
+{
+	if (r->peer)
+		r->peer->peer = nullptr;
+
+	if (r->hedge) {
+		if (budget)
+			budget->release(0, r->budget_size);
+
+		r->header = response_header {};
+		buffers.put(std::move(r->body));
+		r->budget_size = 0;
+	}
+
+	r->on_receive_fn = nullptr;
+	r->on_error_fn = nullptr;
+	r->reader = nullptr;
+	r->c = nullptr;
+	r->peer = nullptr;
+	r->paused_time = clock::duration::zero();
+	r->cancelled = false;
+	r->finished = false;
+	r->hedge = false;
+	r->hedged = false;
+	r->next = free_requests;
+	free_requests = r;
+}
+
+void connection_pool::remove_busy_connection(host& h, const std::shared_ptr<connection>& c)
+{
+	auto& busy = h.busy_connections;
+	const auto i = std::find(busy.begin(), busy.end(), c);
+
+	if (i != busy.end())
+		busy.erase(i);
+}
+
+void connection_pool::remove_in_flight(host& h, request *r)
+{
+	if (!r->in_flight)
+		return;
+
+	r->in_flight = false;
+
+	if (r->prev_in_flight)
+		r->prev_in_flight->next_in_flight = r->next_in_flight;
+	else
+		h.first_in_flight = r->next_in_flight;
+
+	if (r->next_in_flight)
+		r->next_in_flight->prev_in_flight = r->prev_in_flight;
+	else
+		h.last_in_flight = r->prev_in_flight;
+}
+
+void connection_pool::replay(request *r)
+{
+	if (r->sink->on_header(r->header) && !r->body.empty()) {
+		r->paused = true;
+		r->sink->on_body(r->body.data(),
+				 r->body.size(),
+				 std::shared_ptr<body_reader>(std::shared_ptr<body_reader>(), r));
+	}
+	else {
+		r->sink->on_complete();
+		release_request(r);
+	}
+}
+
+void connection_pool::resume(request *r)
+{
+	const auto reader = std::move(r->reader);
+
+	r->paused = false;
+	r->paused_time += clock::now() - r->pause_start;
+
+	// The sink is done with the response of a hedge that won.
+	if (r->hedge) {
+		r->sink->on_complete();
+		release_request(r);
+		return;
+	}
+
+	if (r->cancelled) {
+		const auto p = r->peer;
+
+		// The hedge that won waited for the sink to be done with the data of the
+		// request.
+		if (p && p->finished) {
+			p->peer = nullptr;
+			r->peer = nullptr;
+			replay(p);
+		}
+
+		if (r->finished)
+			release_request(r);
+	}
+	else if (!r->finished && !r->hedged && !r->held)
+		add_in_flight(hosts[r->host_id], r);
+
+	// The connection of a request that has been cancelled still needs to get to its end.
+	if (reader)
+		reader->resume();
+}
+
+void connection_pool::send(request *r)
+{
+	auto& h = hosts[r->host_id];
+	auto c = get_connection(h, nullptr, &r->retry_number);
+	const auto now = clock::now();
+
+	r->next = nullptr;
+
+	if (!c && (c = get_pipelined_connection(h, r)))
+		r->retry_number++;
+
+	if (!c) {
+		if (h.last_request)
+			h.last_request->next = r;
+		else
+			h.first_request = r;
+
+		h.last_request = r;
+		r->start = now;
+		r->queued = true;
+		return;
+	}
+
+	h.metrics.queue.record(r->queued ? now - r->start : clock::duration::zero());
+	r->start = now;
+	r->paused_time = clock::duration::zero();
+	r->queued = false;
+
+	r->c = c;
+	r->finished = false;
+
+	// A request is hedged at most once, and a held one not at all.
+	if (r->sink && !r->hedge && !r->hedged && !r->held)
+		add_in_flight(h, r);
+
+	c->get(r, r->resource, r->fields, r->range, r->sink ? r : nullptr, r->held);
 }
 
 bool connection_pool::get(const std::string_view& url,
@@ -116,6 +808,26 @@ bool connection_pool::get(const std::string_view& url,
 	return ret;
 }
 
+bool connection_pool::get(const std::string_view& url,
+			  response_sink *sink,
+			  const on_error_callback& on_error,
+			  size_t retry_number)
+{
+	std::string_view host;
+	std::string_view resource;
+	bool is_https;
+	bool ret = false;
+
+	if (parse_url(url, &is_https, &host, &resource)) {
+		get(is_https, host, resource, sink, on_error, retry_number);
+		ret = true;
+	}
+	else
+		BOOST_LOG_TRIVIAL(error) << "Invalid URL: " << url;
+
+	return ret;
+}
+
 bool connection_pool::parse_url(const std::string_view& url,
 				bool *is_https,
 				std::string_view *host,
@@ -6,13 +6,25 @@
 #include <boost/asio/ssl.hpp>
 #include <boost/beast.hpp>
 #include <boost/log/trivial.hpp>
+#include <chrono>
+#include <deque>
 #include <functional>
-#include <list>
 #include <memory>
 #include <string>
 #include <string_view>
-#include <tuple>
 #include <unordered_map>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "concurrency_controller.h"
+#include "connection.h"
+#include "dns_cache.h"
+#include "hedge_controller.h"
+#include "key_cache.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "response_sink.h"
+#include "tls_session_cache.h"
 
 namespace asio = boost::asio;
 namespace http = boost::beast::http;
@@ -25,42 +37,270 @@ namespace ssl = asio::ssl;
 #define HTTPS_PREFIX HTTPS_PROTOCOL PROTOCOL_END
 
 static const char resource_delimiter = '/';
+// Shorter than the keep-alive timeout of most servers.
+static const std::chrono::seconds default_idle_timeout {4};
 
 typedef http::response<http::vector_body<char>> http_response;
 
-class connection;
-
 class connection_pool {
-		typedef std::tuple<bool,
-				   std::string,
-				   std::string,
-				   std::function<void(http_response *)>,
-				   std::function<void(void)>>
-		    request;
-
-		std::unordered_map<std::string, std::list<std::shared_ptr<connection>>> connections;
-		std::unordered_map<std::string, size_t> num_connections;
-		std::unordered_map<std::string, std::list<request>> requests;
-		asio::ip::tcp::resolver resolver;
+		typedef std::chrono::steady_clock clock;
+
+		// A request and its retries, or a hedge of another request. Requests are recycled
+		// once their callback has been called, and keep the capacity of their resource.
+		// A request with a sink stands in for it on the connection, and for the connection
+		// as the body reader, so that the pool can pick the response of a hedge instead.
+		class request final : public connection::request_handler,
+				      public response_sink,
+				      public body_reader {
+			public:
+				std::string resource;
+				std::function<void(http_response *)> on_receive_fn;
+				std::function<void(void)> on_error_fn;
+				// The response of a hedge, which is passed to the sink once the
+				// hedge has won.
+				response_header header;
+				std::vector<char> body;
+				// The reader of the connection while the sink holds the request.
+				std::shared_ptr<body_reader> reader;
+				std::shared_ptr<connection> c;
+				clock::time_point start;
+				clock::time_point pause_start;
+				// The time for which the sink has held the request, which does not
+				// count towards its download time.
+				clock::duration paused_time {};
+				connection_pool *pool = nullptr;
+				const http::fields *fields = nullptr;
+				response_sink *sink = nullptr;
+				byte_range range;
+				// The next request in the queue of the host, or in the free list.
+				request *next = nullptr;
+				// The requests in flight that may be hedged. A request leaves while
+				// the sink holds it.
+				request *next_in_flight = nullptr;
+				request *prev_in_flight = nullptr;
+				// The other request of a hedged pair, while both are live.
+				request *peer = nullptr;
+				size_t host_id = 0;
+				// The part of the body of a hedge that has been taken from the
+				// memory budget.
+				size_t budget_size = 0;
+				size_t retry_number = 0;
+				// Set once the other request has won, or has taken over after an
+				// error; the connection then only needs to be done with it.
+				bool cancelled = false;
+				bool finished = false;
+				bool hedge = false;
+				bool hedged = false;
+				// Whether the server may hold the response on purpose until the
+				// resource exists, as with a blocking playlist reload or a preload
+				// hint, so that its response time says nothing about the host.
+				bool held = false;
+				bool in_flight = false;
+				// Whether the request waits for a connection, since start.
+				bool queued = false;
+				// Whether the sink holds the request as its body reader.
+				bool paused = false;
+
+				void on_error(const std::shared_ptr<connection>& c,
+					      bool release) override
+				{
+					pool->on_error(this, c, release);
+				}
+
+				void on_receive(const std::shared_ptr<connection>& c,
+						http_response *response) override
+				{
+					pool->on_receive(this, c, response);
+				}
+
+				bool on_header(const response_header& header) override
+				{
+					return pool->on_header(this, header);
+				}
+
+				void on_body(const char *data,
+					     size_t size,
+					     const std::shared_ptr<body_reader>& r) override
+				{
+					pool->on_body(this, data, size, r);
+				}
+
+				bool blocks_responses() const noexcept override
+				{
+					return reader && reader->blocks_responses();
+				}
+
+				void on_complete() override
+				{
+					if (!cancelled && !hedge)
+						sink->on_complete();
+				}
+
+				void resume() override
+				{
+					pool->resume(this);
+				}
+		};
+
+		struct idle_connection {
+			std::shared_ptr<connection> c;
+			clock::time_point since;
+		};
+
+		struct host {
+			// Includes the port.
+			std::string name;
+			// The connections with requests in flight.
+			std::vector<std::shared_ptr<connection>> busy_connections;
+			// The most recently used last.
+			std::vector<idle_connection> idle_connections;
+			concurrency_controller connection_limit;
+			hedge_controller hedging;
+			host_metrics metrics;
+			// The requests waiting for a connection.
+			request *first_request = nullptr;
+			request *last_request = nullptr;
+			request *first_in_flight = nullptr;
+			request *last_in_flight = nullptr;
+			size_t num_connections = 0;
+			bool is_https = false;
+			// Set once a connection failed with an HTTP/2 protocol error, after which
+			// HTTP/2 is no longer offered.
+			bool http1 = false;
+			// Set once a connection failed with several requests in flight, after which
+			// requests are no longer pipelined.
+			bool serial = false;
+		};
+
+		// Declared first, so that they outlive the caches.
+		cache_metrics buffer_metrics;
+		cache_metrics dns_metrics;
+		// Declared before the hosts, so that it outlives the connections.
+		buffer_pool buffers;
+		// Hosts are identified by their index, which is looked up once per request.
+		std::deque<host> hosts;
+		// The IDs by host as given, with and without the default port, for HTTP and HTTPS.
+		std::unordered_map<std::string_view, size_t> host_ids[2];
+		// The keys of host_ids that are not host names.
+		std::deque<std::string> host_aliases;
+		std::deque<request> requests;
+		request *free_requests = nullptr;
+		dns_cache dns;
 		ssl::context tls_context;
+		tls_session_cache tls_sessions;
+		key_cache keys;
 		asio::io_context * const io = nullptr;
+		metrics_registry * const registry = nullptr;
+		memory_budget * const budget = nullptr;
+		asio::steady_timer idle_timer;
+		// Expires when the first request in flight to any host should be hedged.
+		asio::steady_timer hedge_timer;
+		clock::time_point hedge_deadline = clock::time_point::max();
+		const clock::duration idle_timeout;
+		const size_t pipeline_depth = 1;
 		size_t sequence_number = 0;
+		bool reaping = false;
+
+		void get(bool is_https,
+			 const std::string_view& host,
+			 const std::string_view& resource,
+			 const http::fields *fields,
+			 const byte_range& range,
+			 const std::function<void(http_response *)>& on_receive,
+			 response_sink *sink,
+			 const std::function<void(void)>& on_error,
+			 bool held,
+			 size_t retry_number);
+		// Starts hedging the request once it has taken longer than the delay of its host.
+		void add_in_flight(host& h, request *r);
+		// Makes the connection done with the request without passing on its response.
+		void cancel(request *r);
+		// Removes the first queued request of the host.
+		request *dequeue(host& h);
+		// Returns an idle connection, an HTTP/2 connection with a stream available, or a
+		// new connection below the limit, other than the excluded one, if any. The retry
+		// number is increased for a connection that was opened for other requests.
+		std::shared_ptr<connection>
+		get_connection(host& h, const connection *excluded, size_t *retry_number);
+		size_t get_host_id(bool is_https, const std::string_view& name);
+		// Returns the HTTP/2 connection with the fewest requests in flight that has a
+		// stream available, if any.
+		std::shared_ptr<connection> get_multiplexed_connection(const host& h,
+								       const connection *excluded);
+		// Returns the busy connection with the fewest requests in flight that the request
+		// may be pipelined on, if any. Only requests with a sink are pipelined.
+		std::shared_ptr<connection> get_pipelined_connection(const host& h,
+								     const request *r);
+		// Sends a duplicate of the request on another connection, within the budget of its
+		// host.
+		void hedge(request *r);
+		request *new_request();
+		void on_body(request *r,
+			     const char *data,
+			     size_t size,
+			     const std::shared_ptr<body_reader>& reader);
+		void on_error(request *r, const std::shared_ptr<connection>& c, bool release);
+		bool on_header(request *r, const response_header& header);
+		void on_hedge_timer(const boost::system::error_code& ec);
+		void on_idle_timer(const boost::system::error_code& ec);
+		void on_receive(request *r,
+				const std::shared_ptr<connection>& c,
+				http_response *response);
+		std::shared_ptr<connection> open_connection(host& h);
+		void put_idle_connection(host& h, const std::shared_ptr<connection>& c);
+		// Closes the connections that have been idle for too long.
+		void reap_idle_connections();
+		// Called once the callback of the request has returned.
+		void release_request(request *r);
+		void remove_busy_connection(host& h, const std::shared_ptr<connection>& c);
+		void remove_in_flight(host& h, request *r);
+		// Passes the buffered response of a hedge that has won to the sink.
+		void replay(request *r);
+		void resume(request *r);
+		// Sends the request on a connection to its host, or queues it until one is
+		// available.
+		void send(request *r);
 
 	public:
 		typedef std::function<void(void)> on_error_callback;
 		typedef std::function<void(http_response *)> on_receive_callback;
 
-		connection_pool(asio::io_context *io_ctx) :
-		    resolver(*io_ctx), tls_context(ssl::context::tlsv12_client), io(io_ctx)
+		// Requests share the HTTP/2 connections to a host. Otherwise, once all connections
+		// to a host are busy, up to pipeline_depth requests are sent on each connection
+		// without waiting for the responses. Connections that stay idle for idle_timeout
+		// are closed, which should happen before the server closes them; io_context::run()
+		// returns once they are. Slow requests with a sink are hedged, unless they are
+		// held, and the budget, if any, limits the responses of hedges buffered until they
+		// win. The metrics of each
+		// host and of the caches are added to the registry, if any.
+		connection_pool(asio::io_context *io_ctx,
+				size_t max_buffer_pool_size,
+				size_t pipeline_depth = 1,
+				clock::duration idle_timeout = default_idle_timeout,
+				metrics_registry *registry = nullptr,
+				memory_budget *budget = nullptr) :
+		    buffers(max_buffer_pool_size, &buffer_metrics),
+		    dns(io_ctx, &dns_metrics),
+		    tls_context(ssl::context::tls_client),
+		    tls_sessions(&tls_context), keys(this), io(io_ctx), registry(registry),
+		    budget(budget), idle_timer(*io_ctx), hedge_timer(*io_ctx),
+		    idle_timeout(idle_timeout), pipeline_depth(pipeline_depth)
 		{
 			boost::system::error_code ec;
 
+			// TLS 1.3 is negotiated when the server supports it.
+			SSL_CTX_set_min_proto_version(tls_context.native_handle(), TLS1_2_VERSION);
 			tls_context.set_default_verify_paths(ec);
 			tls_context.set_verify_mode(ssl::verify_peer);
 
 			if (ec)
 				BOOST_LOG_TRIVIAL(error)
 				    << "Failed to set the default paths for TLS verification.";
+
+			if (registry) {
+				registry->add_cache("buffer_pool", &buffer_metrics);
+				registry->add_cache("dns", &dns_metrics);
+			}
 		}
 
 		void get(bool is_https,
@@ -69,10 +309,61 @@ class connection_pool {
 			 const on_receive_callback& on_receive,
 			 const on_error_callback& on_error,
 			 size_t retry_number = 0);
+		// The fields are added to the request, and must remain valid until a callback is
+		// called. A held request is one that the server may hold on purpose until the
+		// resource exists, such as a blocking playlist reload.
+		void get(bool is_https,
+			 const std::string_view& host,
+			 const std::string_view& resource,
+			 const http::fields *fields,
+			 const on_receive_callback& on_receive,
+			 const on_error_callback& on_error,
+			 bool held = false,
+			 size_t retry_number = 0);
+		void get(bool is_https,
+			 const std::string_view& host,
+			 const std::string_view& resource,
+			 response_sink *sink,
+			 const on_error_callback& on_error,
+			 size_t retry_number = 0);
+		// Only the range of the resource is requested. The server may respond with the
+		// whole resource instead, with a 200 status.
+		void get(bool is_https,
+			 const std::string_view& host,
+			 const std::string_view& resource,
+			 const byte_range& range,
+			 const on_receive_callback& on_receive,
+			 const on_error_callback& on_error,
+			 size_t retry_number = 0);
+		// A held request is one that the server may hold on purpose until the resource
+		// exists, such as a part announced by a preload hint.
+		void get(bool is_https,
+			 const std::string_view& host,
+			 const std::string_view& resource,
+			 const byte_range& range,
+			 response_sink *sink,
+			 const on_error_callback& on_error,
+			 bool held = false,
+			 size_t retry_number = 0);
 		bool get(const std::string_view& url,
 			 const on_receive_callback& on_receive,
 			 const on_error_callback& on_error,
 			 size_t retry_number = 0);
+		bool get(const std::string_view& url,
+			 response_sink *sink,
+			 const on_error_callback& on_error,
+			 size_t retry_number = 0);
+
+		buffer_pool *get_buffer_pool() noexcept
+		{
+			return &buffers;
+		}
+
+		// The keys of the encrypted segments of the recordings that use the pool.
+		key_cache *get_key_cache() noexcept
+		{
+			return &keys;
+		}
 
 		static bool parse_url(const std::string_view& url,
 				      bool *is_https,
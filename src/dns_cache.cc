@@ -0,0 +1,101 @@
+#include <boost/log/trivial.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "dns_cache.h"
+
+// The system resolver does not report the TTL of the records, so the results are kept for a
+// fixed time, short enough to follow the DNS-based load balancing of CDNs.
+static const dns_cache::clock::duration cache_duration = std::chrono::seconds(60);
+
+static std::string get_key(const std::string_view& host, const std::string_view& port)
+{
+	std::string ret {host};
+
+	ret.append(1, ':');
+	ret.append(port);
+	return ret;
+}
+
+dns_cache::~dns_cache()
+{
+	if (stats.shared_lookups || stats.stale_results)
+		BOOST_LOG_TRIVIAL(debug) << "DNS cache statistics: shared lookups = "
+					 << stats.shared_lookups
+					 << " stale results = " << stats.stale_results;
+}
+
+void dns_cache::invalidate(const std::string_view& host, const std::string_view& port)
+{
+	const auto e = entries.find(get_key(host, port));
+
+	if (e != entries.end())
+		e->second.results.reset();
+}
+
+void dns_cache::on_resolve(const std::string& key,
+			   const boost::system::error_code& ec,
+			   const tcp::resolver::results_type& results)
+{
+	auto& e = entries[key];
+	const auto waiting = std::move(e.waiting);
+	auto error = ec;
+
+	e.waiting.clear();
+
+	if (!ec) {
+		auto r = std::make_shared<endpoints>();
+
+		r->reserve(results.size());
+
+		for (const auto& result : results)
+			r->push_back(result.endpoint());
+
+		e.results = std::move(r);
+		e.expiry = clock::now() + cache_duration;
+	}
+	// Expired results are better than none if the resolver is unavailable.
+	else if (e.results) {
+		BOOST_LOG_TRIVIAL(warning) << "Using expired addresses for: " << key
+					   << " Error code: " << ec.what();
+		error = {};
+		stats.stale_results++;
+	}
+
+	// The callbacks may resolve other hosts, which invalidates e.
+	const auto r = e.results;
+
+	for (const auto& cb : waiting)
+		cb(error, r);
+}
+
+void dns_cache::resolve(const std::string_view& host, const std::string_view& port, callback&& cb)
+{
+	const auto key = get_key(host, port);
+	auto& e = entries[key];
+
+	if (e.results && clock::now() < e.expiry) {
+		metrics->hits.add(1);
+		asio::post(resolver.get_executor(), [cb = std::move(cb), r = e.results] {
+			cb(boost::system::error_code {}, r);
+		});
+		return;
+	}
+
+	e.waiting.push_back(std::move(cb));
+
+	if (e.waiting.size() > 1) {
+		stats.shared_lookups++;
+		return;
+	}
+
+	metrics->misses.add(1);
+	resolver.async_resolve(
+	    host,
+	    port,
+	    [this, key](const boost::system::error_code& ec, tcp::resolver::results_type results) {
+		    on_resolve(key, ec, results);
+	    });
+}
@@ -0,0 +1,75 @@
+#ifndef DNS_CACHE_H
+
+#define DNS_CACHE_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.h"
+
+namespace asio = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+// Resolves host names for all the connections of a pool. The results are kept for a while, and
+// the requests for a host that is being resolved wait for the same lookup. The hits and misses are
+// counted in the metrics; a request that waits for another lookup is neither.
+class dns_cache {
+	public:
+		typedef std::chrono::steady_clock clock;
+		typedef std::vector<tcp::endpoint> endpoints;
+		typedef std::function<void(const boost::system::error_code&,
+					   const std::shared_ptr<const endpoints>&)>
+		    callback;
+
+		struct statistics {
+			size_t shared_lookups = 0;
+			size_t stale_results = 0;
+		};
+
+	private:
+		struct entry {
+			std::shared_ptr<const endpoints> results;
+			std::vector<callback> waiting;
+			clock::time_point expiry;
+		};
+
+		// Keyed by the host name and port, separated by a colon.
+		std::unordered_map<std::string, entry> entries;
+		tcp::resolver resolver;
+		statistics stats;
+		cache_metrics * const metrics = nullptr;
+
+		void on_resolve(const std::string& key,
+				const boost::system::error_code& ec,
+				const tcp::resolver::results_type& results);
+
+	public:
+		dns_cache(asio::io_context *io, cache_metrics *m) : resolver(*io), metrics(m)
+		{
+		}
+
+		dns_cache(const dns_cache&) = delete;
+		dns_cache& operator=(const dns_cache&) = delete;
+		~dns_cache();
+
+		const statistics& get_statistics() const noexcept
+		{
+			return stats;
+		}
+
+		// Drops the results for a host, for instance after none of the addresses could be
+		// connected to.
+		void invalidate(const std::string_view& host, const std::string_view& port);
+		// The callback is always invoked asynchronously.
+		void
+		resolve(const std::string_view& host, const std::string_view& port, callback&& cb);
+};
+
+#endif // DNS_CACHE_H
@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "fmp4_muxer.h"
+
+static const std::uint32_t default_base_is_moof = 0x020000;
+// The default duration of a video sample at 30 frames per second, in units of 90 kHz, and of
+// an audio sample, in samples, when there is no previous one.
+static const std::uint32_t default_audio_duration = 1024;
+static const std::uint32_t default_video_duration = 3000;
+// Longer gaps between two samples are discontinuities, across which the timestamps of a track
+// are made continuous.
+static const std::uint32_t max_sample_duration = 10;
+static const std::uint32_t movie_timescale = 1000;
+static const std::uint32_t non_sync_sample_flags = 0x01010000;
+static const std::uint32_t sync_sample_flags = 0x02000000;
+static const std::uint32_t timestamp_rate = 90000;
+// The data offset, and the duration, size and flags of each sample, and their composition
+// offset for video.
+static const std::uint32_t trun_flags = 0x000701;
+static const std::uint32_t trun_composition_offsets = 0x000800;
+// "und"
+static const std::uint16_t undetermined_language = 0x55c4;
+
+static void put_u8(std::vector<char> *b, unsigned v)
+{
+	b->push_back(static_cast<char>(v));
+}
+
+static void put_u16(std::vector<char> *b, unsigned v)
+{
+	put_u8(b, v >> 8);
+	put_u8(b, v);
+}
+
+static void put_u32(std::vector<char> *b, std::uint32_t v)
+{
+	put_u16(b, v >> 16);
+	put_u16(b, v);
+}
+
+static void put_u64(std::vector<char> *b, std::uint64_t v)
+{
+	put_u32(b, static_cast<std::uint32_t>(v >> 32));
+	put_u32(b, static_cast<std::uint32_t>(v));
+}
+
+static void put_type(std::vector<char> *b, const std::string_view& type)
+{
+	b->insert(b->end(), type.cbegin(), type.cend());
+}
+
+static void put_zeros(std::vector<char> *b, size_t n)
+{
+	b->insert(b->end(), n, 0);
+}
+
+static void set_u32(std::vector<char> *b, size_t position, std::uint32_t v)
+{
+	for (size_t i = 0; i < 4; i++)
+		(*b)[position + i] = static_cast<char>(v >> (24 - i * 8));
+}
+
+// Returns the position of the box, whose size is set by end_box().
+static size_t begin_box(std::vector<char> *b, const std::string_view& type)
+{
+	const auto ret = b->size();
+
+	put_u32(b, 0);
+	put_type(b, type);
+	return ret;
+}
+
+static size_t
+begin_full_box(std::vector<char> *b, const std::string_view& type, unsigned version, unsigned flags)
+{
+	const auto ret = begin_box(b, type);
+
+	put_u32(b, (version << 24) | flags);
+	return ret;
+}
+
+static void end_box(std::vector<char> *b, size_t position)
+{
+	set_u32(b, position, static_cast<std::uint32_t>(b->size() - position));
+}
+
+static void put_matrix(std::vector<char> *b)
+{
+	for (const std::uint32_t v : {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000})
+		put_u32(b, v);
+}
+
+static std::uint64_t rescale(std::uint64_t t, std::uint32_t timescale)
+{
+	return t * timescale / timestamp_rate;
+}
+
+size_t fmp4_muxer::get_buffered_size() const noexcept
+{
+	size_t ret = 0;
+
+	for (const auto& t : tracks)
+		ret += t.data.size();
+
+	return ret;
+}
+
+std::uint32_t fmp4_muxer::get_default_duration(const track& t) const noexcept
+{
+	if (t.last_duration)
+		return t.last_duration;
+
+	return t.info.codec == media_codec::aac ? default_audio_duration : default_video_duration;
+}
+
+size_t fmp4_muxer::get_fragment(bool final, std::vector<asio::const_buffer> *buffers)
+{
+	size_t data_size = 0;
+
+	for (auto& t : tracks) {
+		t.fragment_samples = 0;
+		t.fragment_size = 0;
+
+		if (!t.id || t.samples.empty())
+			continue;
+
+		if (final)
+			t.samples.back().duration = get_default_duration(t);
+
+		t.fragment_samples = t.samples.size() - (final ? 0 : 1);
+
+		for (size_t i = 0; i < t.fragment_samples; i++)
+			t.fragment_size += t.samples[i].size;
+
+		data_size += t.fragment_size;
+	}
+
+	if (!data_size)
+		return 0;
+
+	header.clear();
+
+	const auto moof = begin_box(&header, "moof");
+	const auto mfhd = begin_full_box(&header, "mfhd", 0, 0);
+
+	put_u32(&header, ++sequence_number);
+	end_box(&header, mfhd);
+
+	for (auto& t : tracks) {
+		if (!t.fragment_samples)
+			continue;
+
+		const bool video = t.info.codec != media_codec::aac;
+		const auto traf = begin_box(&header, "traf");
+		const auto tfhd = begin_full_box(&header, "tfhd", 0, default_base_is_moof);
+
+		put_u32(&header, t.id);
+		end_box(&header, tfhd);
+
+		const auto tfdt = begin_full_box(&header, "tfdt", 1, 0);
+
+		put_u64(&header, t.samples.front().dts);
+		end_box(&header, tfdt);
+
+		const auto trun = begin_full_box(
+		    &header, "trun", 0, trun_flags | (video ? trun_composition_offsets : 0));
+
+		put_u32(&header, static_cast<std::uint32_t>(t.fragment_samples));
+		// The data offset, which is set once the size of the moof box is known.
+		t.fragment_offset_position = header.size();
+		put_u32(&header, 0);
+
+		for (size_t i = 0; i < t.fragment_samples; i++) {
+			const auto& s = t.samples[i];
+
+			put_u32(&header, s.duration);
+			put_u32(&header, s.size);
+			put_u32(&header, s.sync ? sync_sample_flags : non_sync_sample_flags);
+
+			if (video)
+				put_u32(&header, s.composition_offset);
+		}
+
+		end_box(&header, trun);
+		end_box(&header, traf);
+	}
+
+	end_box(&header, moof);
+	put_u32(&header, static_cast<std::uint32_t>(8 + data_size));
+	put_type(&header, "mdat");
+	buffers->push_back(asio::buffer(header));
+
+	// The data of the tracks follows the header in their order.
+	size_t offset = header.size();
+
+	for (const auto& t : tracks) {
+		if (!t.fragment_samples)
+			continue;
+
+		set_u32(&header, t.fragment_offset_position, static_cast<std::uint32_t>(offset));
+		buffers->push_back(asio::buffer(t.data.data(), t.fragment_size));
+		offset += t.fragment_size;
+	}
+
+	return offset;
+}
+
+void fmp4_muxer::get_initialization_segment(std::vector<char> *init) const
+{
+	std::uint32_t next_track_id = 1;
+
+	init->clear();
+
+	const auto ftyp = begin_box(init, "ftyp");
+
+	put_type(init, "iso5");
+	put_u32(init, 512);
+	put_type(init, "iso5");
+	put_type(init, "iso6");
+	put_type(init, "mp41");
+	end_box(init, ftyp);
+
+	const auto moov = begin_box(init, "moov");
+	const auto mvhd = begin_full_box(init, "mvhd", 0, 0);
+
+	for (const auto& t : tracks)
+		next_track_id = std::max(next_track_id, t.id + 1);
+
+	// The creation and modification times, and the duration, are unknown.
+	put_zeros(init, 8);
+	put_u32(init, movie_timescale);
+	put_u32(init, 0);
+	put_u32(init, 0x00010000);
+	put_u16(init, 0x0100);
+	put_zeros(init, 10);
+	put_matrix(init);
+	put_zeros(init, 24);
+	put_u32(init, next_track_id);
+	end_box(init, mvhd);
+
+	for (const auto& t : tracks) {
+		if (t.id)
+			put_track(t, start_time, init);
+	}
+
+	const auto mvex = begin_box(init, "mvex");
+
+	for (const auto& t : tracks) {
+		if (!t.id)
+			continue;
+
+		const auto trex = begin_full_box(init, "trex", 0, 0);
+
+		put_u32(init, t.id);
+		put_u32(init, 1);
+		put_zeros(init, 12);
+		end_box(init, trex);
+	}
+
+	end_box(init, mvex);
+	end_box(init, moov);
+}
+
+void fmp4_muxer::on_sample(size_t track_index,
+			   const media_track& info,
+			   std::uint64_t dts,
+			   std::uint64_t pts,
+			   bool sync,
+			   const std::vector<std::string_view>& units)
+{
+	if (track_index >= tracks.size())
+		tracks.resize(track_index + 1);
+
+	auto& t = tracks[track_index];
+	const bool video = info.codec != media_codec::aac;
+
+	if (started && !t.id)
+		return;
+
+	if (!t.started) {
+		// The samples before the first sync sample cannot be decoded.
+		if (!sync)
+			return;
+
+		t.info = info;
+		t.first_pts = pts;
+		t.timescale = video ? timestamp_rate : info.sample_rate;
+		t.started = true;
+	}
+
+	auto d = static_cast<std::int64_t>(rescale(dts, t.timescale)) + t.offset;
+
+	if (!t.samples.empty()) {
+		auto& last = t.samples.back();
+		const auto last_dts = static_cast<std::int64_t>(last.dts);
+		const auto max_duration = std::int64_t {max_sample_duration} * t.timescale;
+
+		if (d <= last_dts || d - last_dts > max_duration) {
+			const auto next = last_dts + get_default_duration(t);
+
+			t.offset += next - d;
+			d = next;
+		}
+
+		last.duration = t.last_duration = static_cast<std::uint32_t>(d - last_dts);
+	}
+
+	const auto offset = t.data.size();
+	sample s;
+
+	s.dts = static_cast<std::uint64_t>(d);
+	s.sync = sync;
+
+	if (pts > dts)
+		s.composition_offset = static_cast<std::uint32_t>(rescale(pts - dts, t.timescale));
+
+	for (const auto& unit : units) {
+		if (video)
+			put_u32(&t.data, static_cast<std::uint32_t>(unit.size()));
+
+		t.data.insert(t.data.end(), unit.cbegin(), unit.cend());
+	}
+
+	s.size = static_cast<std::uint32_t>(t.data.size() - offset);
+	t.samples.push_back(s);
+}
+
+void fmp4_muxer::put_track(const track& t, std::uint64_t start_time, std::vector<char> *b)
+{
+	const bool video = t.info.codec != media_codec::aac;
+	const auto trak = begin_box(b, "trak");
+	const auto tkhd = begin_full_box(b, "tkhd", 0, 3);
+
+	put_zeros(b, 8);
+	put_u32(b, t.id);
+	put_zeros(b, 16);
+	put_u16(b, 0);
+	put_u16(b, 0);
+	put_u16(b, video ? 0 : 0x0100);
+	put_u16(b, 0);
+	put_matrix(b);
+	put_u32(b, t.info.width << 16);
+	put_u32(b, t.info.height << 16);
+	end_box(b, tkhd);
+
+	// The presentation starts at the first timestamp of the stream.
+	const auto edts = begin_box(b, "edts");
+	const auto elst = begin_full_box(b, "elst", 1, 0);
+
+	put_u32(b, 1);
+	put_u64(b, 0);
+	put_u64(b, rescale(start_time, t.timescale));
+	put_u16(b, 1);
+	put_u16(b, 0);
+	end_box(b, elst);
+	end_box(b, edts);
+
+	const auto mdia = begin_box(b, "mdia");
+	const auto mdhd = begin_full_box(b, "mdhd", 0, 0);
+
+	put_zeros(b, 8);
+	put_u32(b, t.timescale);
+	put_u32(b, 0);
+	put_u16(b, undetermined_language);
+	put_u16(b, 0);
+	end_box(b, mdhd);
+
+	const auto hdlr = begin_full_box(b, "hdlr", 0, 0);
+	const std::string_view name = video ? "VideoHandler" : "SoundHandler";
+
+	put_u32(b, 0);
+	put_type(b, video ? "vide" : "soun");
+	put_zeros(b, 12);
+	put_type(b, name);
+	put_u8(b, 0);
+	end_box(b, hdlr);
+
+	const auto minf = begin_box(b, "minf");
+
+	if (video) {
+		const auto vmhd = begin_full_box(b, "vmhd", 0, 1);
+
+		put_zeros(b, 8);
+		end_box(b, vmhd);
+	}
+	else {
+		const auto smhd = begin_full_box(b, "smhd", 0, 0);
+
+		put_zeros(b, 4);
+		end_box(b, smhd);
+	}
+
+	const auto dinf = begin_box(b, "dinf");
+	const auto dref = begin_full_box(b, "dref", 0, 0);
+
+	put_u32(b, 1);
+	// The data is in the same file.
+	end_box(b, begin_full_box(b, "url ", 0, 1));
+	end_box(b, dref);
+	end_box(b, dinf);
+
+	const auto stbl = begin_box(b, "stbl");
+	const auto stsd = begin_full_box(b, "stsd", 0, 0);
+	const auto& configuration = t.info.configuration;
+
+	put_u32(b, 1);
+
+	if (video) {
+		const bool hevc = t.info.codec == media_codec::hevc;
+		// The sample entries that allow parameter sets in the samples.
+		const auto entry = begin_box(b, hevc ? "hev1" : "avc3");
+
+		put_zeros(b, 6);
+		put_u16(b, 1);
+		put_zeros(b, 16);
+		put_u16(b, t.info.width);
+		put_u16(b, t.info.height);
+		// 72 dpi.
+		put_u32(b, 0x00480000);
+		put_u32(b, 0x00480000);
+		put_u32(b, 0);
+		put_u16(b, 1);
+		put_zeros(b, 32);
+		put_u16(b, 0x0018);
+		put_u16(b, 0xffff);
+
+		const auto config = begin_box(b, hevc ? "hvcC" : "avcC");
+
+		b->insert(b->end(), configuration.cbegin(), configuration.cend());
+		end_box(b, config);
+		end_box(b, entry);
+	}
+	else {
+		const auto entry = begin_box(b, "mp4a");
+		const auto n = static_cast<unsigned>(configuration.size());
+
+		put_zeros(b, 6);
+		put_u16(b, 1);
+		put_zeros(b, 8);
+		put_u16(b, t.info.channels ? t.info.channels : 2);
+		put_u16(b, 16);
+		put_zeros(b, 4);
+		// The sample rate is a 16.16 fixed-point number.
+		put_u32(b, t.info.sample_rate <= 0xffff ? t.info.sample_rate << 16 : 0);
+
+		const auto esds = begin_full_box(b, "esds", 0, 0);
+
+		// The ES descriptor, with the decoder configuration, which holds the
+		// AudioSpecificConfig, and the SL configuration.
+		put_u8(b, 0x03);
+		put_u8(b, 23 + n);
+		put_u16(b, 0);
+		put_u8(b, 0);
+		put_u8(b, 0x04);
+		put_u8(b, 15 + n);
+		// MPEG-4 audio, as an audio stream.
+		put_u8(b, 0x40);
+		put_u8(b, 0x15);
+		put_zeros(b, 11);
+		put_u8(b, 0x05);
+		put_u8(b, n);
+		b->insert(b->end(), configuration.cbegin(), configuration.cend());
+		put_u8(b, 0x06);
+		put_u8(b, 1);
+		put_u8(b, 0x02);
+		end_box(b, esds);
+		end_box(b, entry);
+	}
+
+	end_box(b, stsd);
+
+	// The samples are in the fragments.
+	for (const auto type : {"stts", "stsc", "stco"}) {
+		const auto box = begin_full_box(b, type, 0, 0);
+
+		put_u32(b, 0);
+		end_box(b, box);
+	}
+
+	const auto stsz = begin_full_box(b, "stsz", 0, 0);
+
+	put_zeros(b, 8);
+	end_box(b, stsz);
+	end_box(b, stbl);
+	end_box(b, minf);
+	end_box(b, mdia);
+	end_box(b, trak);
+}
+
+void fmp4_muxer::release_fragment()
+{
+	for (auto& t : tracks) {
+		t.samples.erase(t.samples.cbegin(), t.samples.cbegin() + t.fragment_samples);
+		t.data.erase(t.data.cbegin(), t.data.cbegin() + t.fragment_size);
+		t.fragment_samples = 0;
+		t.fragment_size = 0;
+	}
+}
+
+bool fmp4_muxer::start()
+{
+	if (started)
+		return true;
+
+	std::uint32_t id = 0;
+
+	for (auto& t : tracks) {
+		if (!t.started)
+			continue;
+
+		start_time = id ? std::min(start_time, t.first_pts) : t.first_pts;
+		t.id = ++id;
+	}
+
+	started = id;
+	return started;
+}
@@ -0,0 +1,85 @@
+#ifndef FMP4_MUXER_H
+
+#define FMP4_MUXER_H
+
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "ts_demuxer.h"
+
+namespace asio = boost::asio;
+
+// Builds a fragmented MP4 file out of the samples of a demultiplexed stream: an initialization
+// segment with the tracks that have started, followed by fragments of the samples received
+// since the previous one. The timestamps are kept, and an edit list starts the presentation at
+// the first one.
+class fmp4_muxer : public sample_sink {
+		struct sample {
+			std::uint64_t dts = 0;
+			std::uint32_t composition_offset = 0;
+			std::uint32_t duration = 0;
+			std::uint32_t size = 0;
+			bool sync = false;
+		};
+
+		struct track {
+			media_track info;
+			// The data of the samples, with the length of each NAL unit before it.
+			std::vector<char> data;
+			// The last sample is held back until the next one gives its duration.
+			std::vector<sample> samples;
+			std::uint64_t first_pts = 0;
+			// Added to the timestamps, so that they continue after a discontinuity.
+			std::int64_t offset = 0;
+			// The samples, and their size, in the current fragment.
+			size_t fragment_samples = 0;
+			size_t fragment_size = 0;
+			// The position of the data offset of the track in the header.
+			size_t fragment_offset_position = 0;
+			std::uint32_t id = 0;
+			std::uint32_t last_duration = 0;
+			std::uint32_t timescale = 0;
+			// Set once the first sample is received, which is a sync sample.
+			bool started = false;
+		};
+
+		// The moof box and the mdat header of the current fragment.
+		std::vector<char> header;
+		std::vector<track> tracks;
+		// The first presentation timestamp, in units of 90 kHz.
+		std::uint64_t start_time = 0;
+		std::uint32_t sequence_number = 0;
+		bool started = false;
+
+		std::uint32_t get_default_duration(const track& t) const noexcept;
+		static void
+		put_track(const track& t, std::uint64_t start_time, std::vector<char> *b);
+
+	public:
+		fmp4_muxer() = default;
+		fmp4_muxer(const fmp4_muxer&) = delete;
+		fmp4_muxer& operator=(const fmp4_muxer&) = delete;
+
+		size_t get_buffered_size() const noexcept;
+		// Appends the buffers of the next fragment, with the samples received so far but
+		// the last of each track, unless final is set; returns its size. The buffers remain
+		// valid until release_fragment().
+		size_t get_fragment(bool final, std::vector<asio::const_buffer> *buffers);
+		void get_initialization_segment(std::vector<char> *init) const;
+		void on_sample(size_t track_index,
+			       const media_track& track,
+			       std::uint64_t dts,
+			       std::uint64_t pts,
+			       bool sync,
+			       const std::vector<std::string_view>& units) override;
+		// Removes the samples of the last fragment once it has been written.
+		void release_fragment();
+		// Selects the tracks that have started, unless it was done before; returns false if
+		// none has. The tracks that start later are left out.
+		bool start();
+};
+
+#endif // FMP4_MUXER_H
@@ -0,0 +1,118 @@
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+#include "happy_eyeballs.h"
+
+// The value recommended by RFC 8305.
+static const std::chrono::milliseconds attempt_delay {250};
+
+happy_eyeballs::happy_eyeballs(const executor_type& ex,
+			       const std::vector<tcp::endpoint>& e,
+			       callback&& cb) :
+    attempt_timer(ex),
+    deadline_timer(ex), cb(std::move(cb)), executor(ex)
+{
+	// The family of the first address, which is preferred by the resolver, comes first.
+	std::vector<tcp::endpoint> first;
+	std::vector<tcp::endpoint> second;
+
+	for (const auto& endpoint : e)
+		(endpoint.address().is_v6() == e.front().address().is_v6() ? first : second)
+		    .push_back(endpoint);
+
+	endpoints.reserve(e.size());
+
+	for (size_t i = 0; i < first.size() || i < second.size(); i++) {
+		if (i < first.size())
+			endpoints.push_back(first[i]);
+
+		if (i < second.size())
+			endpoints.push_back(second[i]);
+	}
+}
+
+void happy_eyeballs::connect(const executor_type& ex,
+			     const std::vector<tcp::endpoint>& e,
+			     std::chrono::steady_clock::duration timeout,
+			     callback&& cb)
+{
+	const auto h = std::make_shared<happy_eyeballs>(ex, e, std::move(cb));
+
+	h->deadline_timer.expires_after(timeout);
+	h->deadline_timer.async_wait(
+	    std::bind(&happy_eyeballs::on_deadline, h, std::placeholders::_1));
+	h->start_attempt();
+}
+
+void happy_eyeballs::finish(const boost::system::error_code& ec, stream_socket *s)
+{
+	stream_socket socket {executor};
+	boost::system::error_code ignored;
+
+	done = true;
+	attempt_timer.cancel();
+	deadline_timer.cancel();
+
+	if (s)
+		socket = std::move(*s);
+
+	for (auto& a : attempts)
+		if (&a != s)
+			a.close(ignored);
+
+	cb(ec, std::move(socket));
+}
+
+void happy_eyeballs::on_attempt_delay(const boost::system::error_code& ec)
+{
+	if (!ec && !done)
+		start_attempt();
+}
+
+void happy_eyeballs::on_connect(std::list<stream_socket>::iterator s,
+				const boost::system::error_code& ec)
+{
+	if (done)
+		return;
+
+	if (ec) {
+		// The next address is tried at once.
+		last_error = ec;
+		attempts.erase(s);
+		start_attempt();
+	}
+	else
+		finish(ec, &*s);
+}
+
+void happy_eyeballs::on_deadline(const boost::system::error_code& ec)
+{
+	if (!ec && !done)
+		finish(asio::error::timed_out, nullptr);
+}
+
+void happy_eyeballs::start_attempt()
+{
+	if (next_endpoint == endpoints.size()) {
+		if (attempts.empty())
+			finish(last_error ? last_error : asio::error::host_not_found, nullptr);
+
+		return;
+	}
+
+	auto& s = attempts.emplace_back(executor);
+
+	s.async_connect(endpoints[next_endpoint++],
+			[h = shared_from_this(), i = std::prev(attempts.end())](
+			    const boost::system::error_code& ec) { h->on_connect(i, ec); });
+
+	if (next_endpoint < endpoints.size()) {
+		attempt_timer.expires_after(attempt_delay);
+		attempt_timer.async_wait(std::bind(&happy_eyeballs::on_attempt_delay,
+						   shared_from_this(),
+						   std::placeholders::_1));
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef HAPPY_EYEBALLS_H
+
+#define HAPPY_EYEBALLS_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <vector>
+
+namespace asio = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+// Connects to the first of several addresses that accepts the connection, as described in
+// RFC 8305. The address families are interleaved, and the next address is tried whenever the
+// previous attempt fails or has not succeeded within the connection attempt delay, while the
+// earlier attempts go on.
+class happy_eyeballs : public std::enable_shared_from_this<happy_eyeballs> {
+	public:
+		// The executor is not type-erased, so that the operations on the socket do not
+		// allocate to complete.
+		typedef asio::io_context::executor_type executor_type;
+		typedef asio::basic_stream_socket<tcp, executor_type> stream_socket;
+		typedef std::function<void(const boost::system::error_code&, stream_socket&&)>
+		    callback;
+
+	private:
+		std::list<stream_socket> attempts;
+		std::vector<tcp::endpoint> endpoints;
+		asio::steady_timer attempt_timer;
+		asio::steady_timer deadline_timer;
+		boost::system::error_code last_error;
+		callback cb;
+		executor_type executor;
+		size_t next_endpoint = 0;
+		bool done = false;
+
+		void finish(const boost::system::error_code& ec, stream_socket *s);
+		void on_attempt_delay(const boost::system::error_code& ec);
+		void on_connect(std::list<stream_socket>::iterator s,
+				const boost::system::error_code& ec);
+		void on_deadline(const boost::system::error_code& ec);
+		void start_attempt();
+
+	public:
+		happy_eyeballs(const executor_type& ex,
+			       const std::vector<tcp::endpoint>& e,
+			       callback&& cb);
+
+		// The callback gets the connected socket, or the error of the last attempt.
+		static void connect(const executor_type& ex,
+				    const std::vector<tcp::endpoint>& e,
+				    std::chrono::steady_clock::duration timeout,
+				    callback&& cb);
+};
+
+#endif // HAPPY_EYEBALLS_H
@@ -0,0 +1,34 @@
+#include <algorithm>
+
+#include "hedge_controller.h"
+
+static const size_t min_download_times = 20;
+static const size_t percentile = 95;
+static const double budget_per_request = 0.1;
+// Allows a few hedges in a row once a host starts to stall.
+static const double max_budget = 10;
+// Segments are not hedged before the time it takes to start a download from a distant host.
+static const std::chrono::milliseconds min_delay {200};
+
+void hedge_controller::on_request() noexcept
+{
+	budget = std::min(max_budget, budget + budget_per_request);
+}
+
+void hedge_controller::on_response(clock::duration download_time) noexcept
+{
+	download_times[next_download_time] = download_time;
+	next_download_time = (next_download_time + 1) % window_size;
+	num_download_times = std::min(num_download_times + 1, window_size);
+
+	if (num_download_times < min_download_times)
+		return;
+
+	clock::duration times[window_size];
+	const auto end = times + num_download_times;
+	const auto p = times + num_download_times * percentile / 100;
+
+	std::copy(download_times, download_times + num_download_times, times);
+	std::nth_element(times, p, end);
+	delay = std::max<clock::duration>(*p, min_delay);
+}
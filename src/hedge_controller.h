@@ -0,0 +1,49 @@
+#ifndef HEDGE_CONTROLLER_H
+
+#define HEDGE_CONTROLLER_H
+
+#include <chrono>
+#include <cstddef>
+
+// Decides when a request to a host is slow enough to be hedged with a duplicate request on
+// another connection: once it takes longer than the 95th percentile of the recent download
+// times from the host. A budget limits the hedges to a tenth of the requests, so that a slow
+// host does not get twice the load.
+class hedge_controller {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+	private:
+		static const size_t window_size = 64;
+
+		// The download times of the last window_size responses, as a ring.
+		clock::duration download_times[window_size];
+		clock::duration delay = clock::duration::max();
+		double budget = 0;
+		size_t num_download_times = 0;
+		size_t next_download_time = 0;
+
+	public:
+		// Returns clock::duration::max() until enough responses have been received.
+		clock::duration get_delay() const noexcept
+		{
+			return delay;
+		}
+
+		// Whether the budget allows another hedge.
+		bool may_hedge() const noexcept
+		{
+			return budget >= 1;
+		}
+
+		void on_hedge() noexcept
+		{
+			budget -= 1;
+		}
+
+		// Adds to the budget for each request.
+		void on_request() noexcept;
+		void on_response(clock::duration download_time) noexcept;
+};
+
+#endif // HEDGE_CONTROLLER_H
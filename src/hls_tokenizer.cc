@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+#include <emmintrin.h>
+
+#define HLS_TOKENIZER_SSE2
+
+#elif defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+#define HLS_TOKENIZER_NEON
+
+#endif // defined(__SSE2__) || defined(_M_X64)
+
+#ifdef _MSC_VER
+
+#include <intrin.h>
+
+#endif // _MSC_VER
+
+#include "hls_tokenizer.h"
+
+struct tag_name {
+	std::string_view name;
+	hls_tag tag;
+};
+
+static const char attribute_delimiter = ',';
+static const char attribute_value_delimiter = '=';
+static const char carriage_return = '\r';
+static const char line_feed = '\n';
+static const char quote = '"';
+static const char tag_begin = '#';
+static const char tag_delimiter = ':';
+static const std::string_view tag_prefix = "#EXT";
+static const std::string_view key_tag_prefix = "#EXT-X-KEY:";
+static const size_t tag_table_size = 64;
+static constexpr std::array<tag_name, 13> tag_names {{
+    {"EXT-X-BYTERANGE", hls_tag::byte_range},
+    {"EXT-X-DISCONTINUITY", hls_tag::discontinuity},
+    {"EXT-X-ENDLIST", hls_tag::end_list},
+    {"EXT-X-KEY", hls_tag::key},
+    {"EXT-X-MAP", hls_tag::map},
+    {"EXT-X-MEDIA-SEQUENCE", hls_tag::media_sequence},
+    {"EXT-X-PART", hls_tag::part},
+    {"EXT-X-PART-INF", hls_tag::part_inf},
+    {"EXT-X-PLAYLIST-TYPE", hls_tag::playlist_type},
+    {"EXT-X-PRELOAD-HINT", hls_tag::preload_hint},
+    {"EXT-X-SERVER-CONTROL", hls_tag::server_control},
+    {"EXT-X-STREAM-INF", hls_tag::stream_inf},
+    {"EXT-X-TARGETDURATION", hls_tag::target_duration},
+}};
+
+// A perfect hash of the tag names above, which only looks at the length and two characters: the
+// last one, and the first one after the "EXT-X-" prefix.
+static constexpr size_t hash_tag_name(const std::string_view& name)
+{
+	const size_t n = name.size();
+
+	return (n + name[n - 1] * 53 + name[std::min<size_t>(6, n - 1)]) & (tag_table_size - 1);
+}
+
+// Maps a hash to an index into tag_names plus one, or zero if no tag name has the hash.
+static constexpr std::array<unsigned char, tag_table_size> get_tag_table()
+{
+	std::array<unsigned char, tag_table_size> ret {};
+
+	for (size_t i = 0; i < tag_names.size(); i++)
+		ret[hash_tag_name(tag_names[i].name)] = static_cast<unsigned char>(i + 1);
+
+	return ret;
+}
+
+static constexpr bool is_tag_hash_perfect()
+{
+	const auto table = get_tag_table();
+
+	for (size_t i = 0; i < tag_names.size(); i++)
+		if (table[hash_tag_name(tag_names[i].name)] != i + 1)
+			return false;
+
+	return true;
+}
+
+static_assert(is_tag_hash_perfect(), "The tag names must have distinct hashes.");
+
+static constexpr auto tag_table = get_tag_table();
+
+static unsigned count_trailing_zeros(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long ret;
+
+	_BitScanForward64(&ret, x);
+	return ret;
+#else
+	return __builtin_ctzll(x);
+#endif // _MSC_VER
+}
+
+// Returns the end if there is no line feed.
+static const char *find_line_feed(const char *p, const char *end)
+{
+#ifdef HLS_TOKENIZER_SSE2
+	const auto lf = _mm_set1_epi8(line_feed);
+
+	for (; end - p >= 16; p += 16) {
+		const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		const unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+
+		if (mask)
+			return p + count_trailing_zeros(mask);
+	}
+#elif defined(HLS_TOKENIZER_NEON)
+	const auto lf = vdupq_n_u8(line_feed);
+
+	for (; end - p >= 16; p += 16) {
+		const auto eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(p)), lf);
+		// Narrow the comparison result to 4 bits per byte.
+		const auto narrowed = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+		const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+
+		if (mask)
+			return p + count_trailing_zeros(mask) / 4;
+	}
+#endif // HLS_TOKENIZER_SSE2
+
+	return std::find(p, end, line_feed);
+}
+
+static hls_tag find_tag(const std::string_view& name)
+{
+	const auto i = tag_table[hash_tag_name(name)];
+
+	return i && tag_names[i - 1].name == name ? tag_names[i - 1].tag : hls_tag::unknown;
+}
+
+bool hls_tokenizer::next(hls_line *line)
+{
+	while (iter < end) {
+		const char * const line_end = find_line_feed(iter, end);
+		const char *e = line_end;
+
+		if (e != iter && e[-1] == carriage_return)
+			e--;
+
+		const std::string_view l {iter, static_cast<size_t>(e - iter)};
+
+		iter = line_end == end ? end : line_end + 1;
+
+		if (l.empty())
+			continue;
+
+		if (l[0] != tag_begin) {
+			line->tag = hls_tag::uri;
+			line->value = l;
+			return true;
+		}
+
+		// Lines that start with "#" but not with "#EXT" are comments.
+		if (l.compare(0, tag_prefix.size(), tag_prefix))
+			continue;
+
+		const auto pos = l.find(tag_delimiter);
+
+		line->tag = find_tag(l.substr(1, pos - 1));
+		line->value = {};
+
+		if (pos != std::string_view::npos)
+			line->value = l.substr(pos + 1);
+
+		return true;
+	}
+
+	return false;
+}
+
+size_t hls_tokenizer::skip_uris(size_t n)
+{
+	size_t ret = 0;
+
+	while (ret < n && iter < end) {
+		const char * const line_end = find_line_feed(iter, end);
+		const std::string_view l {iter, static_cast<size_t>(line_end - iter)};
+
+		if (line_end != iter && *iter != tag_begin && *iter != carriage_return)
+			ret++;
+		// The key tag applies to the following segments, so it is left to next().
+		else if (!l.compare(0, key_tag_prefix.size(), key_tag_prefix))
+			break;
+
+		iter = line_end == end ? end : line_end + 1;
+	}
+
+	return ret;
+}
+
+bool get_hls_attribute(std::string_view attributes,
+		       const std::string_view& name,
+		       std::string_view *value)
+{
+	while (!attributes.empty()) {
+		const auto pos = attributes.find(attribute_value_delimiter);
+
+		if (pos == std::string_view::npos)
+			break;
+
+		const auto n = attributes.substr(0, pos);
+		auto v = attributes.substr(pos + 1);
+		std::string_view::size_type value_end;
+
+		if (!v.empty() && v[0] == quote) {
+			value_end = v.find(quote, 1);
+
+			if (value_end == std::string_view::npos)
+				break;
+
+			attributes = v.substr(value_end + 1);
+			v = v.substr(1, value_end - 1);
+		}
+		else {
+			value_end = v.find(attribute_delimiter);
+			attributes = value_end == std::string_view::npos ? std::string_view {}
+									 : v.substr(value_end);
+			v = v.substr(0, value_end);
+		}
+
+		if (n == name) {
+			*value = v;
+			return true;
+		}
+
+		// Skip the delimiter that follows the value.
+		if (!attributes.empty())
+			attributes.remove_prefix(1);
+	}
+
+	return false;
+}
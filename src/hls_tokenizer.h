@@ -0,0 +1,56 @@
+#ifndef HLS_TOKENIZER_H
+
+#define HLS_TOKENIZER_H
+
+#include <cstddef>
+#include <string_view>
+
+enum class hls_tag {
+	byte_range,
+	discontinuity,
+	end_list,
+	key,
+	map,
+	media_sequence,
+	part,
+	part_inf,
+	playlist_type,
+	preload_hint,
+	server_control,
+	stream_inf,
+	target_duration,
+	unknown,
+	uri
+};
+
+struct hls_line {
+	// The tag value after the colon, or the URI.
+	std::string_view value;
+	hls_tag tag = hls_tag::unknown;
+};
+
+// Splits an HLS playlist into lines and identifies the tag of each line in a single pass. Empty
+// lines and comments are skipped.
+class hls_tokenizer {
+		const char *iter = nullptr;
+		const char *end = nullptr;
+
+	public:
+		hls_tokenizer(const char *data, size_t size) : iter(data), end(data + size)
+		{
+		}
+
+		// Returns false at the end of the playlist.
+		bool next(hls_line *line);
+		// Skips the lines up to and including the next n URIs, without looking at the tags
+		// other than EXT-X-KEY, before which it stops early so that the key in effect is
+		// known; returns the number of URIs skipped.
+		size_t skip_uris(size_t n);
+};
+
+// Finds an attribute in an attribute list; the value of a quoted string excludes the quotes.
+bool get_hls_attribute(std::string_view attributes,
+		       const std::string_view& name,
+		       std::string_view *value);
+
+#endif // HLS_TOKENIZER_H
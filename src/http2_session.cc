@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <boost/log/trivial.hpp>
+#include <cctype>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "connection.h"
+#include "http2_session.h"
+
+// The stream window is larger than the default of 64 KiB, so that a segment can be downloaded at
+// full speed from a distant server, while a sink that does not keep up limits the buffered data.
+static const int32_t connection_window_size = 16 * 1024 * 1024;
+static const uint32_t max_concurrent_streams = 100;
+static const uint32_t stream_window_size = 1024 * 1024;
+static const std::string_view authority_header = ":authority";
+static const std::string_view method_header = ":method";
+static const std::string_view method = "GET";
+static const std::string_view path_header = ":path";
+static const std::string_view range_header = "range";
+static const std::string_view scheme_header = ":scheme";
+static const std::string_view scheme = "https";
+static const std::string_view user_agent_header = "user-agent";
+
+static nghttp2_nv make_nv(const std::string_view& name, const std::string_view& value)
+{
+	return {const_cast<uint8_t *>(reinterpret_cast<const uint8_t *>(name.data())),
+		const_cast<uint8_t *>(reinterpret_cast<const uint8_t *>(value.data())),
+		name.size(),
+		value.size(),
+		NGHTTP2_NV_FLAG_NONE};
+}
+
+http2_session::http2_session(listener *l) : l(l)
+{
+	nghttp2_session_callbacks *callbacks;
+	nghttp2_option *option;
+
+	if (nghttp2_session_callbacks_new(&callbacks)) {
+		failed = true;
+		return;
+	}
+
+	if (nghttp2_option_new(&option)) {
+		nghttp2_session_callbacks_del(callbacks);
+		failed = true;
+		return;
+	}
+
+	nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+	    callbacks, &http2_session::on_data_chunk_recv);
+	nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+							     &http2_session::on_frame_recv);
+	nghttp2_session_callbacks_set_on_frame_send_callback(callbacks,
+							     &http2_session::on_frame_send);
+	nghttp2_session_callbacks_set_on_header_callback(callbacks, &http2_session::on_header);
+	nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
+							       &http2_session::on_stream_close);
+	nghttp2_option_set_no_auto_window_update(option, 1);
+
+	if (nghttp2_session_client_new2(&session, callbacks, this, option)) {
+		session = nullptr;
+		failed = true;
+	}
+	else {
+		const nghttp2_settings_entry settings[] = {
+		    {NGHTTP2_SETTINGS_ENABLE_PUSH, 0},
+		    {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, max_concurrent_streams},
+		    {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, stream_window_size},
+		};
+
+		failed = nghttp2_submit_settings(
+			     session, NGHTTP2_FLAG_NONE, settings, std::size(settings)) ||
+			 nghttp2_session_set_local_window_size(
+			     session, NGHTTP2_FLAG_NONE, 0, connection_window_size);
+	}
+
+	nghttp2_option_del(option);
+	nghttp2_session_callbacks_del(callbacks);
+}
+
+http2_session::~http2_session()
+{
+	if (session)
+		nghttp2_session_del(session);
+}
+
+std::string_view http2_session::get_output()
+{
+	const uint8_t *data;
+	const auto n = failed ? 0 : nghttp2_session_mem_send(session, &data);
+
+	if (n < 0) {
+		BOOST_LOG_TRIVIAL(error) << "Failed to send HTTP/2 frames: " << nghttp2_strerror(n);
+		failed = true;
+	}
+
+	return n > 0 ? std::string_view {reinterpret_cast<const char *>(data),
+					  static_cast<size_t>(n)}
+		     : std::string_view {};
+}
+
+int http2_session::on_data_chunk_recv(nghttp2_session *session,
+				      uint8_t,
+				      int32_t stream_id,
+				      const uint8_t *data,
+				      size_t len,
+				      void *user_data)
+{
+	const auto stream = nghttp2_session_get_stream_user_data(session, stream_id);
+
+	if (stream)
+		static_cast<http2_session *>(user_data)->l->on_stream_data(
+		    stream, reinterpret_cast<const char *>(data), len);
+
+	return 0;
+}
+
+int http2_session::on_frame_recv(nghttp2_session *session,
+				 const nghttp2_frame *frame,
+				 void *user_data)
+{
+	if (frame->hd.type == NGHTTP2_HEADERS) {
+		const auto stream =
+		    nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+
+		if (stream)
+			static_cast<http2_session *>(user_data)->l->on_stream_headers_end(stream);
+	}
+	else if (frame->hd.type == NGHTTP2_GOAWAY && frame->goaway.error_code != NGHTTP2_NO_ERROR)
+		BOOST_LOG_TRIVIAL(error)
+		    << "Received HTTP/2 GOAWAY: error code = " << frame->goaway.error_code;
+
+	return 0;
+}
+
+// nghttp2 ends the session with GOAWAY when the server violates the protocol.
+int http2_session::on_frame_send(nghttp2_session *,
+				 const nghttp2_frame *frame,
+				 void *user_data)
+{
+	if (frame->hd.type == NGHTTP2_GOAWAY && frame->goaway.error_code != NGHTTP2_NO_ERROR) {
+		BOOST_LOG_TRIVIAL(error)
+		    << "Sent HTTP/2 GOAWAY: error code = " << frame->goaway.error_code;
+		static_cast<http2_session *>(user_data)->failed = true;
+	}
+
+	return 0;
+}
+
+int http2_session::on_header(nghttp2_session *session,
+			     const nghttp2_frame *frame,
+			     const uint8_t *name,
+			     size_t namelen,
+			     const uint8_t *value,
+			     size_t valuelen,
+			     uint8_t,
+			     void *user_data)
+{
+	if (frame->hd.type == NGHTTP2_HEADERS) {
+		const auto stream =
+		    nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+
+		if (stream)
+			static_cast<http2_session *>(user_data)->l->on_stream_header(
+			    stream,
+			    {reinterpret_cast<const char *>(name), namelen},
+			    {reinterpret_cast<const char *>(value), valuelen});
+	}
+
+	return 0;
+}
+
+int http2_session::on_stream_close(nghttp2_session *session,
+				   int32_t stream_id,
+				   uint32_t error_code,
+				   void *user_data)
+{
+	const auto stream = nghttp2_session_get_stream_user_data(session, stream_id);
+
+	if (stream)
+		static_cast<http2_session *>(user_data)->l->on_stream_close(
+		    stream, error_code != NGHTTP2_NO_ERROR);
+
+	return 0;
+}
+
+bool http2_session::receive(const char *data, size_t size)
+{
+	const auto n =
+	    nghttp2_session_mem_recv(session, reinterpret_cast<const uint8_t *>(data), size);
+
+	if (n < 0) {
+		BOOST_LOG_TRIVIAL(error)
+		    << "Failed to receive HTTP/2 frames: " << nghttp2_strerror(n);
+		failed = true;
+	}
+
+	return !failed;
+}
+
+int32_t http2_session::submit(const std::string_view& authority,
+			      const std::string_view& path,
+			      const http::fields *fields,
+			      const std::string_view& range,
+			      void *stream)
+{
+	std::vector<nghttp2_nv> headers {make_nv(method_header, method),
+					 make_nv(scheme_header, scheme),
+					 make_nv(authority_header, authority),
+					 make_nv(path_header, path),
+					 make_nv(user_agent_header, user_agent)};
+	// HTTP/2 header names are lowercase.
+	std::vector<std::string> names;
+
+	if (fields) {
+		for (const auto& f : *fields) {
+			auto& n = names.emplace_back(f.name_string());
+
+			std::transform(n.begin(), n.end(), n.begin(), [](unsigned char c) {
+				return static_cast<char>(std::tolower(c));
+			});
+		}
+
+		auto n = names.cbegin();
+
+		for (const auto& f : *fields)
+			headers.push_back(make_nv(*n++, f.value()));
+	}
+
+	if (!range.empty())
+		headers.push_back(make_nv(range_header, range));
+
+	return nghttp2_submit_request(
+	    session, nullptr, headers.data(), headers.size(), nullptr, stream);
+}
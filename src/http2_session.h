@@ -0,0 +1,124 @@
+#ifndef HTTP2_SESSION_H
+
+#define HTTP2_SESSION_H
+
+#include <boost/beast.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <nghttp2/nghttp2.h>
+
+namespace http = boost::beast::http;
+
+// The client side of an HTTP/2 session, on top of nghttp2. The bytes received from the server are
+// passed to receive(), and the bytes returned by get_output() are written to the server. The flow
+// control windows are only reopened once the received data is consumed.
+class http2_session {
+	public:
+		// Receives the events of the streams, which are identified by the pointer passed to
+		// submit().
+		class listener {
+			public:
+				virtual ~listener() = default;
+
+				virtual void on_stream_close(void *stream, bool error) = 0;
+				virtual void
+				on_stream_data(void *stream, const char *data, size_t size) = 0;
+				virtual void on_stream_header(void *stream,
+							      const std::string_view& name,
+							      const std::string_view& value) = 0;
+				virtual void on_stream_headers_end(void *stream) = 0;
+		};
+
+	private:
+		listener * const l = nullptr;
+		nghttp2_session *session = nullptr;
+		// Whether the server violated the protocol.
+		bool failed = false;
+
+		static int on_data_chunk_recv(nghttp2_session *session,
+					      uint8_t flags,
+					      int32_t stream_id,
+					      const uint8_t *data,
+					      size_t len,
+					      void *user_data);
+		static int on_frame_recv(nghttp2_session *session,
+					 const nghttp2_frame *frame,
+					 void *user_data);
+		static int on_frame_send(nghttp2_session *session,
+					 const nghttp2_frame *frame,
+					 void *user_data);
+		static int on_header(nghttp2_session *session,
+				     const nghttp2_frame *frame,
+				     const uint8_t *name,
+				     size_t namelen,
+				     const uint8_t *value,
+				     size_t valuelen,
+				     uint8_t flags,
+				     void *user_data);
+		static int on_stream_close(nghttp2_session *session,
+					   int32_t stream_id,
+					   uint32_t error_code,
+					   void *user_data);
+
+	public:
+		explicit http2_session(listener *l);
+		http2_session(const http2_session&) = delete;
+		http2_session& operator=(const http2_session&) = delete;
+		~http2_session();
+
+		// Whether new streams may be started, which is not the case after the server sent
+		// GOAWAY.
+		bool accepts_streams() const noexcept
+		{
+			return session && nghttp2_session_check_request_allowed(session);
+		}
+
+		// Reopens the flow control windows for data passed to the listener.
+		void consume(int32_t stream_id, size_t size)
+		{
+			nghttp2_session_consume(session, stream_id, size);
+		}
+
+		size_t get_max_concurrent_streams() const noexcept
+		{
+			return nghttp2_session_get_remote_settings(
+			    session, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+		}
+
+		// Returns an empty buffer if there is nothing to write; the data remains valid
+		// until the next call.
+		std::string_view get_output();
+		bool has_failed() const noexcept
+		{
+			return failed;
+		}
+
+		// Whether the session is still in use; it ends once the server sent GOAWAY and the
+		// remaining streams are closed.
+		bool is_open() const noexcept
+		{
+			return nghttp2_session_want_read(session) ||
+			       nghttp2_session_want_write(session);
+		}
+
+		// Returns false if the session has failed.
+		bool receive(const char *data, size_t size);
+		// Cancels the stream, which the listener then sees closing with an error.
+		void reset(int32_t stream_id)
+		{
+			nghttp2_submit_rst_stream(
+			    session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+		}
+
+		// Returns the stream ID, or a negative number on failure. The fields, and the range
+		// unless it is empty, are added to the request headers.
+		int32_t submit(const std::string_view& authority,
+			       const std::string_view& path,
+			       const http::fields *fields,
+			       const std::string_view& range,
+			       void *stream);
+};
+
+#endif // HTTP2_SESSION_H
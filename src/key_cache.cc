@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <boost/log/trivial.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "connection_pool.h"
+#include "key_cache.h"
+
+// Enough for the keys that the playlists of a thread rotate through.
+static const size_t max_keys = 256;
+
+std::shared_ptr<const key_cache::key> key_cache::get(bool is_https,
+						     const std::string_view& host,
+						     const std::string_view& resource,
+						     const key_callback& on_key)
+{
+	std::string url {is_https ? HTTPS_PREFIX : HTTP_PREFIX};
+
+	url.append(host);
+	url.append(resource);
+
+	const auto k = std::find_if(
+	    keys.cbegin(), keys.cend(), [&url](const auto& k) { return k->url == url; });
+
+	// A key that could not be received is requested again.
+	if (k != keys.cend() && !(*k)->failed) {
+		if (!(*k)->received)
+			(*k)->waiting.push_back(on_key);
+
+		return *k;
+	}
+
+	if (k != keys.cend())
+		keys.erase(k);
+	// The segments that still use an evicted key keep it.
+	else if (keys.size() == max_keys)
+		keys.pop_front();
+
+	auto ret = std::make_shared<key>();
+
+	ret->url = std::move(url);
+	ret->waiting.push_back(on_key);
+	keys.push_back(ret);
+	BOOST_LOG_TRIVIAL(trace) << "Requesting key: " << ret->url;
+	pool->get(is_https,
+		  host,
+		  resource,
+		  std::bind(&key_cache::on_receive, this, ret, std::placeholders::_1),
+		  std::bind(&key_cache::on_error, this, ret));
+	return ret;
+}
+
+void key_cache::on_error(const std::shared_ptr<key>& k)
+{
+	BOOST_LOG_TRIVIAL(error) << "Failed to get key: " << k->url;
+	k->failed = true;
+	on_key(k);
+}
+
+void key_cache::on_key(const std::shared_ptr<key>& k)
+{
+	const auto waiting = std::move(k->waiting);
+
+	k->waiting.clear();
+
+	for (const auto& cb : waiting)
+		cb();
+}
+
+void key_cache::on_receive(const std::shared_ptr<key>& k, connection::http_response *response)
+{
+	const auto& body = response->body();
+
+	if (response->result() != http::status::ok || body.size() != k->value.size()) {
+		BOOST_LOG_TRIVIAL(error)
+		    << "Invalid " << response->result_int() << " key response: " << k->url
+		    << " size = " << body.size();
+		k->failed = true;
+	}
+	else {
+		std::copy(body.cbegin(), body.cend(), k->value.begin());
+		k->received = true;
+	}
+
+	on_key(k);
+}
@@ -0,0 +1,64 @@
+#ifndef KEY_CACHE_H
+
+#define KEY_CACHE_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "aes_decryptor.h"
+#include "connection.h"
+
+class connection_pool;
+
+// Requests the keys of encrypted segments for the recordings of a pool, so that each key is
+// received once however many segments and recordings use it. The last keys are kept, since a
+// playlist only refers to its recent ones.
+class key_cache {
+	public:
+		typedef std::function<void()> key_callback;
+
+		struct key {
+			std::string url;
+			// Called once the key has been received, or could not be.
+			std::vector<key_callback> waiting;
+			aes_decryptor::block value {};
+			bool failed = false;
+			bool received = false;
+
+			bool is_pending() const noexcept
+			{
+				return !failed && !received;
+			}
+		};
+
+	private:
+		// The oldest key first.
+		std::deque<std::shared_ptr<key>> keys;
+		connection_pool * const pool = nullptr;
+
+		static void on_key(const std::shared_ptr<key>& k);
+		void on_error(const std::shared_ptr<key>& k);
+		void on_receive(const std::shared_ptr<key>& k, connection::http_response *response);
+
+	public:
+		explicit key_cache(connection_pool *pool) : pool(pool)
+		{
+		}
+
+		key_cache(const key_cache&) = delete;
+		key_cache& operator=(const key_cache&) = delete;
+
+		// Returns the key at the URL, which is requested unless it has been before. Until
+		// the key has been received, or could not be, the callback is kept to be called
+		// then.
+		std::shared_ptr<const key> get(bool is_https,
+					       const std::string_view& host,
+					       const std::string_view& resource,
+					       const key_callback& on_key);
+};
+
+#endif // KEY_CACHE_H
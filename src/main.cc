@@ -1,27 +1,270 @@
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/log/trivial.hpp>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "connection_pool.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "metrics_server.h"
 #include "playlist.h"
 
+typedef std::pair<std::string, std::string> recording;
+
+struct shard {
+	boost::asio::io_context io {1};
+	connection_pool pool;
+	std::list<playlist> playlists;
+
+	shard(size_t buffer_pool_size,
+	      size_t pipeline_depth,
+	      std::chrono::seconds idle_timeout,
+	      metrics_registry *registry,
+	      memory_budget *budget) :
+	    pool(&io, buffer_pool_size, pipeline_depth, idle_timeout, registry, budget)
+	{
+	}
+};
+
+static const char buffer_pool_size_option[] = "-b";
+static const char comment_begin = '#';
+static const size_t default_buffer_pool_size = 32;
+static const size_t default_memory_budget = 64;
+static const char extension_delimiter = '.';
+static const char file_name_delimiter = '-';
+static const char mp4_format[] = "mp4";
+static const char idle_timeout_option[] = "-k";
+static const char input_file_option[] = "-i";
+static const char memory_budget_option[] = "-l";
+static const char metrics_port_option[] = "-m";
+static const char output_format_option[] = "-f";
+static const char pipeline_depth_option[] = "-p";
+static const char range_size_option[] = "-r";
+static const char threads_option[] = "-t";
+
+static size_t get_shard(const std::string& url,
+			size_t num_shards,
+			std::unordered_map<std::string_view, size_t> *host_recordings)
+{
+	std::string_view host;
+	std::string_view resource;
+	bool is_https;
+
+	if (!connection_pool::parse_url(url, &is_https, &host, &resource))
+		return 0;
+
+	// Start each host at a different shard and spread its recordings over all shards, so that
+	// a host with many recordings does not end up on a single thread.
+	return (std::hash<std::string_view> {}(host) + (*host_recordings)[host]++) % num_shards;
+}
+
+static std::string get_unique_file_name(const std::string& name,
+					std::unordered_set<std::string> *file_names)
+{
+	std::string ret {name};
+
+	if (!file_names->insert(ret).second) {
+		const auto extension_pos = name.find_last_of(extension_delimiter);
+		const auto& base_name = name.substr(0, extension_pos);
+		const auto& extension = extension_pos == std::string::npos
+					    ? std::string {}
+					    : name.substr(extension_pos);
+
+		for (size_t i = 1; !file_names->insert(ret).second; i++) {
+			ret = base_name;
+			ret.push_back(file_name_delimiter);
+			ret.append(std::to_string(i));
+			ret.append(extension);
+		}
+	}
+
+	return ret;
+}
+
+static bool read_input_file(const char *name, std::vector<recording> *recordings)
+{
+	std::ifstream input {name};
+
+	if (!input) {
+		BOOST_LOG_TRIVIAL(fatal) << "Failed to open input file: " << name;
+		return false;
+	}
+
+	for (std::string line; std::getline(input, line);) {
+		std::istringstream fields {line};
+		std::string url;
+		std::string file_name;
+
+		if (fields >> url && url[0] != comment_begin) {
+			fields >> file_name;
+			recordings->emplace_back(std::move(url), std::move(file_name));
+		}
+	}
+
+	return true;
+}
+
 int main(int argc, char *argv[])
 {
-	int ret = EXIT_FAILURE;
+	std::vector<recording> recordings;
+	size_t buffer_pool_size = default_buffer_pool_size;
+	size_t memory_budget_size = default_memory_budget;
+	size_t num_threads = 1;
+	size_t pipeline_depth = 1;
+	std::uint64_t range_size = 0;
+	unsigned long metrics_port = 0;
+	bool remux = false;
+	std::chrono::seconds idle_timeout = default_idle_timeout;
 
-	if (argc < 2) {
-		BOOST_LOG_TRIVIAL(info) << "Usage: " << *argv << " <playlist URL>";
+	for (int i = 1; i < argc; i++)
+		if (!std::strcmp(argv[i], input_file_option)) {
+			if (++i == argc || !read_input_file(argv[i], &recordings))
+				return EXIT_FAILURE;
+		}
+		else if (!std::strcmp(argv[i], buffer_pool_size_option)) {
+			if (++i == argc)
+				return EXIT_FAILURE;
+
+			buffer_pool_size = std::strtoul(argv[i], nullptr, 10);
+		}
+		else if (!std::strcmp(argv[i], idle_timeout_option)) {
+			if (++i == argc)
+				return EXIT_FAILURE;
+
+			idle_timeout = std::chrono::seconds(std::strtoul(argv[i], nullptr, 10));
+		}
+		else if (!std::strcmp(argv[i], memory_budget_option)) {
+			if (++i == argc)
+				return EXIT_FAILURE;
+
+			memory_budget_size = std::strtoul(argv[i], nullptr, 10);
+		}
+		else if (!std::strcmp(argv[i], metrics_port_option)) {
+			if (++i == argc)
+				return EXIT_FAILURE;
+
+			metrics_port = std::strtoul(argv[i], nullptr, 10);
+		}
+		else if (!std::strcmp(argv[i], output_format_option)) {
+			if (++i == argc)
+				return EXIT_FAILURE;
+
+			remux = !std::strcmp(argv[i], mp4_format);
+		}
+		else if (!std::strcmp(argv[i], pipeline_depth_option)) {
+			if (++i == argc)
+				return EXIT_FAILURE;
+
+			pipeline_depth = std::max(std::strtoul(argv[i], nullptr, 10), 1UL);
+		}
+		else if (!std::strcmp(argv[i], range_size_option)) {
+			if (++i == argc)
+				return EXIT_FAILURE;
+
+			range_size = std::strtoull(argv[i], nullptr, 10) * 1024;
+		}
+		else if (!std::strcmp(argv[i], threads_option)) {
+			if (++i == argc)
+				return EXIT_FAILURE;
+
+			num_threads = std::strtoul(argv[i], nullptr, 10);
+
+			if (!num_threads)
+				num_threads = std::max(std::thread::hardware_concurrency(), 1U);
+		}
+		else
+			recordings.emplace_back(argv[i], std::string {});
+
+	if (recordings.empty()) {
+		BOOST_LOG_TRIVIAL(info)
+		    << "Usage: " << *argv << " [" << buffer_pool_size_option
+		    << " <buffer pool size in MiB>] [" << input_file_option << " <input file>] ["
+		    << idle_timeout_option << " <idle connection timeout in seconds>] ["
+		    << memory_budget_option << " <memory budget in MiB>] [" << metrics_port_option
+		    << " <metrics port>] [" << output_format_option << " <ts|mp4>] ["
+		    << pipeline_depth_option << " <pipeline depth>] ["
+		    << range_size_option << " <range size in KiB>] [" << threads_option
+		    << " <number of threads>] [<playlist URL>...]";
 		return EXIT_SUCCESS;
 	}
 
-	boost::asio::io_context io;
-	connection_pool pool {&io};
-	playlist playlist {&io, &pool};
+	// Declared before the shards, which add their metrics to it.
+	metrics_registry registry;
+	metrics_registry * const shard_registry = metrics_port ? &registry : nullptr;
+	// Shared by the recordings and the hedges of every shard.
+	memory_budget budget {memory_budget_size * 1024 * 1024};
+	std::vector<std::unique_ptr<shard>> shards(std::min(num_threads, recordings.size()));
+	std::unordered_map<std::string_view, size_t> host_recordings;
+	std::unordered_set<std::string> file_names;
+	bool recording_started = false;
+
+	for (auto& s : shards)
+		s = std::make_unique<shard>(buffer_pool_size * 1024 * 1024,
+					    pipeline_depth,
+					    idle_timeout,
+					    shard_registry,
+					    &budget);
+
+	for (const auto& [url, name] : recordings) {
+		std::string file_name {name};
+
+		if (file_name.empty() && !playlist::get_file_name(url, remux, &file_name)) {
+			BOOST_LOG_TRIVIAL(error) << "Invalid playlist URL: " << url;
+			continue;
+		}
 
-	if (playlist.record(argv[1])) {
-		io.run();
-		ret = EXIT_SUCCESS;
+		auto& s = *shards[get_shard(url, shards.size(), &host_recordings)];
+
+		s.playlists.emplace_back(&s.io, &s.pool, &budget, range_size, remux);
+
+		const auto& unique_file_name = get_unique_file_name(file_name, &file_names);
+
+		if (s.playlists.back().record(url, unique_file_name)) {
+			if (shard_registry)
+				registry.add_recording(unique_file_name,
+						       s.playlists.back().get_metrics());
+
+			recording_started = true;
+		}
+		else
+			s.playlists.pop_back();
 	}
 
-	return ret;
+	if (!recording_started)
+		return EXIT_FAILURE;
+
+	registry.set_memory_budget(&budget);
+
+	// Declared after the shards, so that it stops before their metrics are destroyed.
+	metrics_server server {&registry};
+
+	if (metrics_port && !server.start(static_cast<unsigned short>(metrics_port)))
+		return EXIT_FAILURE;
+
+	std::vector<std::thread> threads;
+
+	for (size_t i = 1; i < shards.size(); i++)
+		threads.emplace_back([&io = shards[i]->io]() { io.run(); });
+
+	shards.front()->io.run();
+
+	for (auto& t : threads)
+		t.join();
+
+	return EXIT_SUCCESS;
 }
@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <atomic>
+
+#include "memory_budget.h"
+
+bool memory_budget::acquire(size_t recording_size, size_t size, bool force) noexcept
+{
+	if (force)
+		used.fetch_add(size, std::memory_order_relaxed);
+	else {
+		if (recording_size + size > get_share(recording_size))
+			return false;
+
+		auto u = used.load(std::memory_order_relaxed);
+
+		do
+			if (u + size > limit)
+				return false;
+		while (!used.compare_exchange_weak(u, u + size, std::memory_order_relaxed));
+	}
+
+	if (!recording_size && size)
+		num_recordings.fetch_add(1, std::memory_order_relaxed);
+
+	return true;
+}
+
+size_t memory_budget::get_share(size_t recording_size) const noexcept
+{
+	// A recording that does not buffer any data yet would be one more.
+	const size_t n = num_recordings.load(std::memory_order_relaxed) + !recording_size;
+
+	return limit / std::max<size_t>(n, 1);
+}
+
+bool memory_budget::is_available(size_t recording_size) const noexcept
+{
+	return recording_size < get_share(recording_size) &&
+	       used.load(std::memory_order_relaxed) < limit;
+}
+
+void memory_budget::release(size_t recording_size, size_t size) noexcept
+{
+	used.fetch_sub(size, std::memory_order_relaxed);
+
+	if (!recording_size && size)
+		num_recordings.fetch_sub(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,48 @@
+#ifndef MEMORY_BUDGET_H
+
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+
+// Limits the data that the recordings of every thread buffer while it cannot be written yet. The
+// budget is shared fairly by the recordings that buffer data: once a recording has used up its
+// share, or the whole budget is used, it has to write its buffered data before buffering more.
+class memory_budget {
+		std::atomic<size_t> used {0};
+		// The recordings that buffer data.
+		std::atomic<size_t> num_recordings {0};
+		const size_t limit = 0;
+
+		size_t get_share(size_t recording_size) const noexcept;
+
+	public:
+		explicit memory_budget(size_t limit) noexcept : limit(limit)
+		{
+		}
+
+		memory_budget(const memory_budget&) = delete;
+		memory_budget& operator=(const memory_budget&) = delete;
+
+		// Takes size bytes from the budget for a recording that buffers recording_size
+		// bytes, unless the recording would exceed its share or the budget and the data
+		// may wait.
+		bool acquire(size_t recording_size, size_t size, bool force = false) noexcept;
+		size_t get_limit() const noexcept
+		{
+			return limit;
+		}
+
+		size_t get_used() const noexcept
+		{
+			return used.load(std::memory_order_relaxed);
+		}
+
+		// Whether a recording that buffers recording_size bytes may buffer more.
+		bool is_available(size_t recording_size) const noexcept;
+		// Returns size bytes to the budget for a recording that then buffers
+		// recording_size bytes.
+		void release(size_t recording_size, size_t size) noexcept;
+};
+
+#endif // MEMORY_BUDGET_H
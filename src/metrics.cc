@@ -0,0 +1,349 @@
+#include <charconv>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+
+#define METRIC_PREFIX "asr_"
+
+struct metric_family {
+	const char *name;
+	const char *help;
+};
+
+static const metric_family host_histograms = {
+    METRIC_PREFIX "request_phase_seconds", "The duration of each phase of the requests to a host."};
+static const metric_family recording_histograms = {
+    METRIC_PREFIX "recording_phase_seconds", "The duration of each phase of a recording."};
+
+static void append_number(std::string *s, std::uint64_t n)
+{
+	char buffer[24];
+
+	s->append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), n).ptr);
+}
+
+// Microseconds are written as seconds.
+static void append_seconds(std::string *s, std::uint64_t microseconds)
+{
+	char buffer[24];
+	const auto fraction = microseconds % 1000000;
+
+	append_number(s, microseconds / 1000000);
+
+	if (fraction) {
+		auto p = std::to_chars(buffer, buffer + sizeof(buffer), fraction + 1000000).ptr;
+
+		while (p[-1] == '0')
+			p--;
+
+		buffer[0] = '.';
+		s->append(buffer, p);
+	}
+}
+
+static void append_label(std::string *s, const char *name, const std::string_view& value)
+{
+	s->append(name);
+	s->append("=\"");
+
+	for (const char c : value) {
+		if (c == '\\' || c == '"')
+			s->push_back('\\');
+
+		if (c == '\n')
+			s->append("\\n");
+		else
+			s->push_back(c);
+	}
+
+	s->push_back('"');
+}
+
+static void append_header(std::string *s, const char *name, const char *help, const char *type)
+{
+	s->append("# HELP ").append(name).append(" ").append(help).append("\n");
+	s->append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+// The histograms are added up.
+static void append_histogram(std::string *s,
+			     const char *name,
+			     const std::string& labels,
+			     const std::vector<const latency_histogram *>& histograms)
+{
+	std::uint64_t count = 0;
+	std::uint64_t sum = 0;
+
+	for (size_t i = 0; i < latency_histogram::num_buckets; i++) {
+		for (const auto h : histograms)
+			count += h->get_count(i);
+
+		s->append(name).append("_bucket{").append(labels).append(",le=\"");
+
+		if (i == latency_histogram::num_buckets - 1)
+			s->append("+Inf");
+		else
+			append_seconds(s, latency_histogram::get_upper_bound(i));
+
+		s->append("\"} ");
+		append_number(s, count);
+		s->push_back('\n');
+	}
+
+	for (const auto h : histograms)
+		sum += h->get_sum();
+
+	s->append(name).append("_sum{").append(labels).append("} ");
+	append_seconds(s, sum);
+	s->append("\n").append(name).append("_count{").append(labels).append("} ");
+	append_number(s, count);
+	s->push_back('\n');
+}
+
+static void append_gauge(std::string *s, const metric_family& family, std::uint64_t value)
+{
+	append_header(s, family.name, family.help, "gauge");
+	s->append(family.name).push_back(' ');
+	append_number(s, value);
+	s->push_back('\n');
+}
+
+template<typename metrics, typename... phases>
+static void
+append_histograms(std::string *s,
+		  const metric_family& family,
+		  const char *label,
+		  const std::map<std::string_view, std::vector<const metrics *>>& entries,
+		  phases... p)
+{
+	append_header(s, family.name, family.help, "histogram");
+
+	for (const auto& [name, m] : entries)
+		for (const auto& [phase, member] : {p...}) {
+			std::string labels;
+			std::vector<const latency_histogram *> histograms;
+
+			append_label(&labels, label, name);
+			labels.push_back(',');
+			append_label(&labels, "phase", phase);
+
+			for (const auto e : m)
+				histograms.push_back(&(e->*member));
+
+			append_histogram(s, family.name, labels, histograms);
+		}
+}
+
+// The values of the entries with the same name are added up.
+template<typename metrics, typename metric>
+static void append_values(std::string *s,
+			  const metric_family& family,
+			  const char *type,
+			  const char *label,
+			  const std::map<std::string_view, std::vector<const metrics *>>& entries,
+			  metric metrics::*member)
+{
+	append_header(s, family.name, family.help, type);
+
+	for (const auto& [name, m] : entries) {
+		std::uint64_t value = 0;
+
+		for (const auto e : m)
+			value += (e->*member).get();
+
+		s->append(family.name).push_back('{');
+		append_label(s, label, name);
+		s->append("} ");
+		append_number(s, value);
+		s->push_back('\n');
+	}
+}
+
+template<typename metrics>
+static void append_counter(std::string *s,
+			   const metric_family& family,
+			   const char *label,
+			   const std::map<std::string_view, std::vector<const metrics *>>& entries,
+			   metrics_counter metrics::*member)
+{
+	append_values(s, family, "counter", label, entries, member);
+}
+
+template<typename metrics>
+static void append_gauges(std::string *s,
+			  const metric_family& family,
+			  const char *label,
+			  const std::map<std::string_view, std::vector<const metrics *>>& entries,
+			  metrics_gauge metrics::*member)
+{
+	append_values(s, family, "gauge", label, entries, member);
+}
+
+void metrics_registry::add_cache(const std::string& name, const cache_metrics *m)
+{
+	const std::lock_guard lock {mutex};
+
+	caches.push_back({name, m});
+}
+
+void metrics_registry::add_host(const std::string& name, const host_metrics *m)
+{
+	const std::lock_guard lock {mutex};
+
+	hosts.push_back({name, m});
+}
+
+void metrics_registry::add_recording(const std::string& name, const recording_metrics *m)
+{
+	const std::lock_guard lock {mutex};
+
+	recordings.push_back({name, m});
+}
+
+std::string metrics_registry::format()
+{
+	typedef std::pair<const char *, latency_histogram host_metrics::*> host_phase;
+	typedef std::pair<const char *, latency_histogram recording_metrics::*> recording_phase;
+
+	const std::lock_guard lock {mutex};
+	std::map<std::string_view, std::vector<const cache_metrics *>> c;
+	std::map<std::string_view, std::vector<const host_metrics *>> h;
+	std::map<std::string_view, std::vector<const recording_metrics *>> r;
+	std::string s;
+
+	for (const auto& e : caches)
+		c[e.name].push_back(e.metrics);
+
+	for (const auto& e : hosts)
+		h[e.name].push_back(e.metrics);
+
+	for (const auto& e : recordings)
+		r[e.name].push_back(e.metrics);
+
+	append_histograms(&s,
+			  host_histograms,
+			  "host",
+			  h,
+			  host_phase {"resolve", &host_metrics::resolve},
+			  host_phase {"connect", &host_metrics::connect},
+			  host_phase {"tls_handshake", &host_metrics::tls_handshake},
+			  host_phase {"queue", &host_metrics::queue},
+			  host_phase {"first_byte", &host_metrics::first_byte},
+			  host_phase {"body", &host_metrics::body});
+	append_counter(&s,
+		       {METRIC_PREFIX "received_bytes_total", "The response body bytes received."},
+		       "host",
+		       h,
+		       &host_metrics::bytes);
+	append_counter(&s,
+		       {METRIC_PREFIX "failed_requests_total", "The requests that failed."},
+		       "host",
+		       h,
+		       &host_metrics::errors);
+	append_counter(&s,
+		       {METRIC_PREFIX "hedged_requests_total", "The requests that were hedged."},
+		       "host",
+		       h,
+		       &host_metrics::hedges);
+	append_counter(&s,
+		       {METRIC_PREFIX "requests_total", "The requests made."},
+		       "host",
+		       h,
+		       &host_metrics::requests);
+	append_counter(&s,
+		       {METRIC_PREFIX "retries_total", "The requests retried after an error."},
+		       "host",
+		       h,
+		       &host_metrics::retries);
+	append_counter(&s,
+		       {METRIC_PREFIX "tls_full_handshakes_total",
+			"The TLS handshakes that did not resume a session."},
+		       "host",
+		       h,
+		       &host_metrics::tls_full_handshakes);
+	append_counter(&s,
+		       {METRIC_PREFIX "tls_resumed_handshakes_total",
+			"The TLS handshakes that resumed the session of an earlier connection."},
+		       "host",
+		       h,
+		       &host_metrics::tls_resumed_handshakes);
+	append_histograms(&s,
+			  recording_histograms,
+			  "recording",
+			  r,
+			  recording_phase {"detection", &recording_metrics::detection_delay},
+			  recording_phase {"reorder_wait", &recording_metrics::reorder_wait},
+			  recording_phase {"disk_write", &recording_metrics::disk_write},
+#ifdef BOOST_ASIO_HAS_IO_URING
+			  recording_phase {"io_uring_write", &recording_metrics::io_uring_write},
+#endif // BOOST_ASIO_HAS_IO_URING
+			  recording_phase {"throttled", &recording_metrics::throttled},
+			  recording_phase {"decryption", &recording_metrics::decryption});
+	append_counter(&s,
+		       {METRIC_PREFIX "written_bytes_total", "The bytes written to the output."},
+		       "recording",
+		       r,
+		       &recording_metrics::bytes);
+	append_counter(&s,
+		       {METRIC_PREFIX "decrypted_bytes_total", "The encrypted bytes decrypted."},
+		       "recording",
+		       r,
+		       &recording_metrics::decrypted_bytes);
+	append_counter(&s,
+		       {METRIC_PREFIX "dropped_segments_total",
+			"The media segments missing from the output file, or incomplete."},
+		       "recording",
+		       r,
+		       &recording_metrics::dropped_segments);
+	append_counter(&s,
+		       {METRIC_PREFIX "written_segments_total",
+			"The media segments written to the output file."},
+		       "recording",
+		       r,
+		       &recording_metrics::segments);
+#ifdef BOOST_ASIO_HAS_IO_URING
+	append_gauges(&s,
+		      {METRIC_PREFIX "io_uring_queue_depth",
+		       "The writes to the output file submitted to io_uring that have not "
+		       "completed."},
+		      "recording",
+		      r,
+		      &recording_metrics::io_uring_queue_depth);
+#endif // BOOST_ASIO_HAS_IO_URING
+	append_counter(&s,
+		       {METRIC_PREFIX "cache_hits_total", "The lookups found in a cache."},
+		       "cache",
+		       c,
+		       &cache_metrics::hits);
+	append_counter(&s,
+		       {METRIC_PREFIX "cache_misses_total", "The lookups not found in a cache."},
+		       "cache",
+		       c,
+		       &cache_metrics::misses);
+
+	if (budget) {
+		append_gauge(&s,
+			     {METRIC_PREFIX "memory_budget_bytes",
+			      "The limit of the data buffered by all recordings."},
+			     budget->get_limit());
+		append_gauge(&s,
+			     {METRIC_PREFIX "buffered_bytes",
+			      "The data buffered by all recordings until it can be written."},
+			     budget->get_used());
+	}
+
+	return s;
+}
+
+void metrics_registry::set_memory_budget(const memory_budget *b)
+{
+	const std::lock_guard lock {mutex};
+
+	budget = b;
+}
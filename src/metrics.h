@@ -0,0 +1,207 @@
+#ifndef METRICS_H
+
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "memory_budget.h"
+
+// A counter that is updated by a single thread without locking, and may be read by any thread.
+class metrics_counter {
+		std::atomic<std::uint64_t> value {0};
+
+	public:
+		void add(std::uint64_t n) noexcept
+		{
+			value.store(value.load(std::memory_order_relaxed) + n,
+				    std::memory_order_relaxed);
+		}
+
+		std::uint64_t get() const noexcept
+		{
+			return value.load(std::memory_order_relaxed);
+		}
+};
+
+// A gauge that is set by a single thread, and may be read by any thread.
+class metrics_gauge {
+		std::atomic<std::uint64_t> value {0};
+
+	public:
+		std::uint64_t get() const noexcept
+		{
+			return value.load(std::memory_order_relaxed);
+		}
+
+		void set(std::uint64_t v) noexcept
+		{
+			value.store(v, std::memory_order_relaxed);
+		}
+};
+
+// A histogram of durations with log-linear buckets, two per power of 2 microseconds, from 128 µs
+// up to 67 s, followed by a bucket for longer durations. Like a counter, it is updated by a single
+// thread without locking.
+class latency_histogram {
+	public:
+		typedef std::chrono::steady_clock::duration duration;
+
+		static const size_t num_buckets = 40;
+
+	private:
+		// The durations up to 2^first_octave microseconds fall into the first bucket.
+		static const unsigned first_octave = 7;
+
+		std::array<std::atomic<std::uint64_t>, num_buckets> counts {};
+		std::atomic<std::uint64_t> sum {0};
+
+		static size_t get_bucket(std::uint64_t microseconds) noexcept
+		{
+			// A duration equal to an upper bound falls into that bucket.
+			const auto d = microseconds ? microseconds - 1 : 0;
+
+			if (d < std::uint64_t {1} << first_octave)
+				return 0;
+
+			unsigned octave = first_octave;
+
+			while (octave < 63 && d >> (octave + 1))
+				octave++;
+
+			const size_t bucket =
+			    1 + (octave - first_octave) * 2 + ((d >> (octave - 1)) & 1);
+
+			return bucket < num_buckets ? bucket : num_buckets - 1;
+		}
+
+	public:
+		void record(duration d) noexcept
+		{
+			const auto us =
+			    std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+			const std::uint64_t microseconds = us > 0 ? us : 0;
+			auto& count = counts[get_bucket(microseconds)];
+
+			count.store(count.load(std::memory_order_relaxed) + 1,
+				    std::memory_order_relaxed);
+			sum.store(sum.load(std::memory_order_relaxed) + microseconds,
+				  std::memory_order_relaxed);
+		}
+
+		std::uint64_t get_count(size_t bucket) const noexcept
+		{
+			return counts[bucket].load(std::memory_order_relaxed);
+		}
+
+		// In microseconds.
+		std::uint64_t get_sum() const noexcept
+		{
+			return sum.load(std::memory_order_relaxed);
+		}
+
+		// In microseconds; the last bucket has no upper bound.
+		static std::uint64_t get_upper_bound(size_t bucket) noexcept
+		{
+			if (!bucket)
+				return std::uint64_t {1} << first_octave;
+
+			const unsigned octave = first_octave + (bucket - 1) / 2;
+
+			return (bucket - 1) % 2 ? std::uint64_t {2} << octave
+						: std::uint64_t {3} << (octave - 1);
+		}
+};
+
+// The lookups in a cache of a connection pool.
+struct cache_metrics {
+	metrics_counter hits;
+	metrics_counter misses;
+};
+
+// The phases of the requests to a host.
+struct host_metrics {
+	latency_histogram resolve;
+	latency_histogram connect;
+	latency_histogram tls_handshake;
+	// The time a request waits for a connection.
+	latency_histogram queue;
+	// From sending a request to its response header, and from there to the end of the body,
+	// for the responses that are passed to a sink.
+	latency_histogram first_byte;
+	latency_histogram body;
+	// The response bodies received.
+	metrics_counter bytes;
+	metrics_counter errors;
+	metrics_counter hedges;
+	metrics_counter requests;
+	metrics_counter retries;
+	// The TLS handshakes that resumed a session of an earlier connection, and the others.
+	metrics_counter tls_full_handshakes;
+	metrics_counter tls_resumed_handshakes;
+};
+
+struct recording_metrics {
+	// The time between an estimated update of a live playlist and the receipt of the refresh
+	// that brings it.
+	latency_histogram detection_delay;
+	// The time a received segment or part waits for the earlier ones to be written.
+	latency_histogram reorder_wait;
+	latency_histogram disk_write;
+#ifdef BOOST_ASIO_HAS_IO_URING
+	// The time each write submitted to io_uring takes to complete, and the writes in flight.
+	latency_histogram io_uring_write;
+	metrics_gauge io_uring_queue_depth;
+#endif // BOOST_ASIO_HAS_IO_URING
+	// The time during which the memory budget holds back the data and the requests of the
+	// recording.
+	latency_histogram throttled;
+	// The time spent decrypting each encrypted segment or part.
+	latency_histogram decryption;
+	metrics_counter bytes;
+	metrics_counter decrypted_bytes;
+	metrics_counter dropped_segments;
+	metrics_counter segments;
+};
+
+// Collects the metrics of the hosts and caches of every pool and of every recording, which must
+// remain valid as long as the registry is read. The metrics of the same host or cache in several
+// pools are added up.
+class metrics_registry {
+		struct cache_entry {
+			std::string name;
+			const cache_metrics *metrics = nullptr;
+		};
+
+		struct host_entry {
+			std::string name;
+			const host_metrics *metrics = nullptr;
+		};
+
+		struct recording_entry {
+			std::string name;
+			const recording_metrics *metrics = nullptr;
+		};
+
+		std::mutex mutex;
+		std::vector<cache_entry> caches;
+		std::vector<host_entry> hosts;
+		std::vector<recording_entry> recordings;
+		const memory_budget *budget = nullptr;
+
+	public:
+		void add_cache(const std::string& name, const cache_metrics *m);
+		void add_host(const std::string& name, const host_metrics *m);
+		void add_recording(const std::string& name, const recording_metrics *m);
+		// Returns the metrics in the Prometheus text format.
+		std::string format();
+		// The budget must remain valid as long as the registry is read.
+		void set_memory_budget(const memory_budget *b);
+};
+
+#endif // METRICS_H
@@ -0,0 +1,99 @@
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <boost/log/trivial.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include "metrics_server.h"
+
+static const char content_type[] = "text/plain; version=0.0.4";
+static const char metrics_path[] = "/metrics";
+// A scrape that takes longer is abandoned.
+static const std::chrono::seconds session_timeout {10};
+
+metrics_server::~metrics_server()
+{
+	if (thread.joinable()) {
+		io.stop();
+		thread.join();
+	}
+}
+
+void metrics_server::accept()
+{
+	acceptor.async_accept(beast::bind_front_handler(&metrics_server::on_accept, this));
+}
+
+void metrics_server::on_accept(beast::error_code ec, tcp::socket socket)
+{
+	if (ec == asio::error::operation_aborted)
+		return;
+
+	if (ec)
+		BOOST_LOG_TRIVIAL(error) << "Failed to accept a metrics connection. Error code: "
+					 << ec.what();
+	else {
+		const auto s = std::make_shared<session>(std::move(socket));
+
+		s->stream.expires_after(session_timeout);
+		http::async_read(s->stream,
+				 s->buffer,
+				 s->request,
+				 [this, s](beast::error_code ec, size_t) { on_read(s, ec); });
+	}
+
+	accept();
+}
+
+void metrics_server::on_read(const std::shared_ptr<session>& s, beast::error_code ec)
+{
+	if (ec)
+		return;
+
+	auto& response = s->response;
+
+	response.version(s->request.version());
+	response.keep_alive(false);
+
+	if (s->request.method() != http::verb::get || s->request.target() != metrics_path)
+		response.result(http::status::not_found);
+	else {
+		response.result(http::status::ok);
+		response.set(http::field::content_type, content_type);
+		response.body() = registry->format();
+	}
+
+	response.prepare_payload();
+	http::async_write(s->stream, response, [s](beast::error_code ec, size_t) {
+		s->stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+	});
+}
+
+bool metrics_server::start(unsigned short port)
+{
+	beast::error_code ec;
+	const tcp::endpoint endpoint {asio::ip::make_address("127.0.0.1"), port};
+
+	acceptor.open(endpoint.protocol(), ec);
+
+	if (!ec)
+		acceptor.set_option(asio::socket_base::reuse_address(true), ec);
+
+	if (!ec)
+		acceptor.bind(endpoint, ec);
+
+	if (!ec)
+		acceptor.listen(asio::socket_base::max_listen_connections, ec);
+
+	if (ec) {
+		BOOST_LOG_TRIVIAL(fatal) << "Failed to listen for metrics requests on port " << port
+					 << ". Error code: " << ec.what();
+		return false;
+	}
+
+	accept();
+	thread = std::thread {[this] { io.run(); }};
+	return true;
+}
@@ -0,0 +1,52 @@
+#ifndef METRICS_SERVER_H
+
+#define METRICS_SERVER_H
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <memory>
+#include <thread>
+
+#include "metrics.h"
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+
+// Serves the metrics of a registry in the Prometheus text format at /metrics on the loopback
+// address, from a thread of its own, so that scraping does not delay the recordings.
+class metrics_server {
+		struct session {
+			beast::tcp_stream stream;
+			beast::flat_buffer buffer;
+			http::request<http::empty_body> request;
+			http::response<http::string_body> response;
+
+			explicit session(tcp::socket&& socket) : stream(std::move(socket))
+			{
+			}
+		};
+
+		asio::io_context io {1};
+		tcp::acceptor acceptor {io};
+		std::thread thread;
+		metrics_registry * const registry = nullptr;
+
+		void accept();
+		void on_accept(beast::error_code ec, tcp::socket socket);
+		void on_read(const std::shared_ptr<session>& s, beast::error_code ec);
+
+	public:
+		explicit metrics_server(metrics_registry *registry) : registry(registry)
+		{
+		}
+
+		metrics_server(const metrics_server&) = delete;
+		metrics_server& operator=(const metrics_server&) = delete;
+		~metrics_server();
+
+		bool start(unsigned short port);
+};
+
+#endif // METRICS_SERVER_H
@@ -3,33 +3,45 @@
 #include <boost/log/trivial.hpp>
 #include <cctype>
 #include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <string_view>
 #include <utility>
 
 #include "connection_pool.h"
+#include "hls_tokenizer.h"
 #include "playlist.h"
 
-#define BANDWIDTH_ATTRIBUTE "BANDWIDTH="
-#define DISCONTINUITY_TAG "#EXT-X-DISCONTINUITY"
-#define END_LIST_TAG "#EXT-X-ENDLIST"
-#define MAP_TAG "#EXT-X-MAP:"
-#define MEDIA_SEQUENCE_TAG "#EXT-X-MEDIA-SEQUENCE:"
-#define PLAYLIST_TYPE_VOD_TAG "#EXT-X-PLAYLIST-TYPE:VOD"
-#define STREAM_INF_TAG "#EXT-X-STREAM-INF:"
-#define TARGET_DURATION_TAG "#EXT-X-TARGETDURATION:"
-#define URI_ATTRIBUTE "URI=\""
-
-static const char carriage_return = '\r';
+#define BANDWIDTH_ATTRIBUTE "BANDWIDTH"
+#define BYTERANGE_ATTRIBUTE "BYTERANGE"
+#define BYTERANGE_LENGTH_ATTRIBUTE "BYTERANGE-LENGTH"
+#define BYTERANGE_START_ATTRIBUTE "BYTERANGE-START"
+#define CAN_BLOCK_RELOAD_ATTRIBUTE "CAN-BLOCK-RELOAD"
+#define GAP_ATTRIBUTE "GAP"
+#define IV_ATTRIBUTE "IV"
+#define KEYFORMAT_ATTRIBUTE "KEYFORMAT"
+#define KEYFORMAT_IDENTITY "identity"
+#define METHOD_AES_128 "AES-128"
+#define METHOD_ATTRIBUTE "METHOD"
+#define METHOD_NONE "NONE"
+#define MSN_DIRECTIVE "_HLS_msn="
+#define PART_DIRECTIVE "_HLS_part="
+#define PART_TYPE "PART"
+#define PLAYLIST_TYPE_VOD "VOD"
+#define TYPE_ATTRIBUTE "TYPE"
+#define URI_ATTRIBUTE "URI"
+#define YES "YES"
+
+static const char byte_range_offset_delimiter = '@';
 static const char extension_delimiter = '.';
 static const std::string hls_content_type = "application/vnd.apple.mpegurl";
-static const char line_feed = '\n';
 static const size_t max_file_name_length = 32;
+static const std::string mp4_extension = ".mp4";
 static const char query_delimiter = '?';
-static const char tag_begin = '#';
+static const char query_parameter_delimiter = '&';
 static const std::string transport_stream_extension = ".ts";
-static const char uri_delimiter = '"';
 
 static bool is_url(const char *p, size_t len)
 {
@@ -39,169 +51,333 @@ static bool is_url(const char *p, size_t len)
 		std::equal(p, p + sizeof(HTTP_PREFIX) - 1, HTTP_PREFIX));
 }
 
+playlist::~playlist()
+{
+	const auto& stats = scheduler.get_statistics();
+
+	if (stats.updates) {
+		const auto delay = stats.total_detection_delay.count() / stats.updates;
+
+		BOOST_LOG_TRIVIAL(debug)
+		    << "Playlist refresh statistics: URL = " << url << " refreshes = "
+		    << stats.refreshes << " unchanged = " << stats.unchanged_refreshes
+		    << " updates = " << stats.updates << " average detection delay = " << delay
+		    << " ms max detection delay = " << stats.max_detection_delay.count() << " ms";
+	}
+}
+
+void playlist::get_playlist(const std::string_view& r,
+			    const http::fields *fields,
+			    bool blocking)
+{
+	request_time = poll_scheduler::clock::now();
+	reloading = blocking;
+	pool->get(is_https,
+		  host,
+		  r,
+		  fields,
+		  std::bind(&playlist::on_playlist_receive, this, std::placeholders::_1),
+		  std::bind(&playlist::on_error, this),
+		  blocking);
+}
+
 void playlist::on_error() noexcept
 {
-	period = 0;
+	refreshing = false;
 }
 
-void playlist::on_initial_playlist_receive(http_response *response)
+void playlist::on_playlist_receive(http_response *response)
 {
+	const auto next_sequence_number = writer.get_next_sequence_number();
+
 	parse_playlist(response);
 
-	if (period) {
-		timer.expires_after(std::chrono::seconds(period));
+	// Blocking playlist reloads take over from polling.
+	if (refreshing && !reloading) {
+		const auto detection_delay = scheduler.on_refresh(
+		    request_time, writer.get_next_sequence_number() - next_sequence_number);
+
+		if (detection_delay != poll_scheduler::clock::duration::zero())
+			writer.get_metrics()->detection_delay.record(detection_delay);
+
+		timer.expires_at(scheduler.get_next_refresh_time());
 		timer.async_wait(std::bind(&playlist::timer_handler, this, std::placeholders::_1));
 	}
 }
 
 void playlist::parse_hls_playlist(const std::vector<char>& response_body)
 {
+	std::string_view attribute;
 	std::string_view final_stream_information;
+	std::string_view h;
+	std::string_view r;
 	std::string_view stream_information;
 	std::string_view u;
-	const char *line_end;
-	const char *iter = response_body.data();
-	const char * const playlist_end = iter + response_body.size();
+	std::string_view uri;
+	std::string resolved_resource;
+	hls_tokenizer tokenizer {response_body.data(), response_body.size()};
+	hls_line line;
+	byte_range part_range;
+	byte_range segment_range;
+	std::uint64_t next_part_offset = 0;
+	std::uint64_t next_segment_offset = 0;
 	size_t bandwidth = 0;
 	size_t max_bandwidth = 0;
+	size_t part_number = 0;
 	size_t segment_number = 0;
 	size_t sequence_number = 0;
 	size_t target_duration = 0;
 	bool end_list = false;
+	bool has_parts = false;
+	bool https;
 	bool is_line_url = false;
 	bool master_playlist = true;
 
-	// In case we have to deal with an empty line later, make sure that we can look at least one
-	// character back.
-	if (iter != playlist_end && *iter == line_feed)
-		iter++;
+	can_block_reload = false;
+	// The playlist repeats the key tags that apply to its segments.
+	writer.clear_key();
+
+	while (tokenizer.next(&line)) {
+		const auto& value = line.value;
 
-	for (; iter < playlist_end; iter = line_end + 1) {
-		line_end = std::find(iter, playlist_end, line_feed);
+		switch (line.tag) {
+			case hls_tag::byte_range:
+				byte_ranges = true;
 
-		const char * const e = line_end[-1] == carriage_return ? line_end - 1 : line_end;
-		const size_t line_len = e - iter;
+				if (parse_byte_range(value, next_segment_offset, &segment_range))
+					next_segment_offset =
+					    segment_range.offset + segment_range.length;
+				else
+					BOOST_LOG_TRIVIAL(error) << "Invalid byte range: " << value;
 
-		if (!line_len) {
-			if (line_end == playlist_end)
 				break;
 
-			continue;
-		}
+			case hls_tag::discontinuity:
+				BOOST_LOG_TRIVIAL(warning) << "Playlist discontinuity.";
+				break;
 
-		if (line_len > sizeof(TARGET_DURATION_TAG) - 1 &&
-		    std::equal(iter, iter + sizeof(TARGET_DURATION_TAG) - 1, TARGET_DURATION_TAG)) {
-			std::from_chars(iter + sizeof(TARGET_DURATION_TAG) - 1, e, target_duration);
-			master_playlist = false;
-		}
-		else if (line_len > sizeof(MEDIA_SEQUENCE_TAG) - 1 &&
-			 std::equal(
-			     iter, iter + sizeof(MEDIA_SEQUENCE_TAG) - 1, MEDIA_SEQUENCE_TAG))
-			std::from_chars(iter + sizeof(MEDIA_SEQUENCE_TAG) - 1, e, sequence_number);
-		else if (line_len >= sizeof(DISCONTINUITY_TAG) - 1 &&
-			 std::equal(iter, iter + sizeof(DISCONTINUITY_TAG) - 1, DISCONTINUITY_TAG))
-			BOOST_LOG_TRIVIAL(warning) << "Playlist discontinuity.";
-		else if (line_len >= sizeof(END_LIST_TAG) - 1 &&
-			 std::equal(iter, iter + sizeof(END_LIST_TAG) - 1, END_LIST_TAG))
-			end_list = true;
-		else if (line_len >= sizeof(PLAYLIST_TYPE_VOD_TAG) - 1 &&
-			 std::equal(
-			     iter, iter + sizeof(PLAYLIST_TYPE_VOD_TAG) - 1, PLAYLIST_TYPE_VOD_TAG))
-			end_list = true;
-		else if (line_len > sizeof(MAP_TAG) - 1 &&
-			 std::equal(iter, iter + sizeof(MAP_TAG) - 1, MAP_TAG)) {
-			auto uri_pos = std::search(iter + sizeof(MAP_TAG) - 1,
-						   e,
-						   URI_ATTRIBUTE,
-						   &URI_ATTRIBUTE[sizeof(URI_ATTRIBUTE) - 1]);
-
-			if (uri_pos != e) {
-				uri_pos += sizeof(URI_ATTRIBUTE) - 1;
-
-				const auto uri_end = std::find(uri_pos, e, uri_delimiter);
-
-				if (uri_end != e) {
-					const size_t uri_len = uri_end - uri_pos;
-
-					if (is_url(uri_pos, uri_len))
-						writer.add_media_initialization_section(
-						    std::string_view {uri_pos, uri_len});
-					else if (*uri_pos == resource_delimiter)
-						writer.add_media_initialization_section(
-						    is_https,
-						    host,
-						    std::string_view {uri_pos, uri_len});
-					else {
-						std::string r {
-						    resource.substr(0, resource_prefix_len)};
-
-						r.append(uri_pos, uri_len);
-						writer.add_media_initialization_section(
-						    is_https, host, r);
-					}
+			case hls_tag::end_list:
+				end_list = true;
+				break;
+
+			case hls_tag::map: {
+				byte_range range;
+
+				// The range of a media initialization section always has an offset,
+				// which is 0 if omitted.
+				if (get_hls_attribute(value, BYTERANGE_ATTRIBUTE, &attribute) &&
+				    !parse_byte_range(attribute, 0, &range)) {
+					BOOST_LOG_TRIVIAL(error)
+					    << "Invalid byte range: " << attribute;
+					break;
 				}
+
+				if (get_hls_attribute(value, URI_ATTRIBUTE, &uri) &&
+				    resolve_uri(uri, &https, &h, &r, &resolved_resource))
+					writer.add_media_initialization_section(https, h, r, range);
+
+				break;
 			}
-		}
-		else if (line_len > sizeof(STREAM_INF_TAG) - 1 &&
-			 std::equal(iter, iter + sizeof(STREAM_INF_TAG) - 1, STREAM_INF_TAG)) {
-			bandwidth = 0;
-			stream_information =
-			    std::string_view {iter + sizeof(STREAM_INF_TAG) - 1,
-					      line_len + 1 - sizeof(STREAM_INF_TAG)};
-
-			auto bandwidth_pos =
-			    std::search(iter,
-					e,
-					BANDWIDTH_ATTRIBUTE,
-					&BANDWIDTH_ATTRIBUTE[sizeof(BANDWIDTH_ATTRIBUTE) - 1]);
-
-			if (bandwidth_pos != e) {
-				bandwidth_pos += sizeof(BANDWIDTH_ATTRIBUTE) - 1;
-
-				if (bandwidth_pos != e)
-					std::from_chars(bandwidth_pos, e, bandwidth);
+
+			case hls_tag::key: {
+				aes_decryptor::block iv;
+				std::string_view iv_attribute;
+				const bool has_iv =
+				    get_hls_attribute(value, IV_ATTRIBUTE, &iv_attribute);
+
+				// The keys of other formats are for DRM systems, and accompany an
+				// identity key if the segments can be decrypted without them.
+				if (get_hls_attribute(value, KEYFORMAT_ATTRIBUTE, &attribute) &&
+				    attribute != KEYFORMAT_IDENTITY)
+					break;
+
+				if (!get_hls_attribute(value, METHOD_ATTRIBUTE, &attribute) ||
+				    attribute == METHOD_NONE)
+					writer.clear_key();
+				// The segments of other methods, such as SAMPLE-AES, could only
+				// be recorded encrypted, which stops the recording instead.
+				else if (attribute != METHOD_AES_128) {
+					BOOST_LOG_TRIVIAL(error)
+					    << "Unsupported encryption method: " << attribute
+					    << " URL: " << url;
+					on_error();
+					return;
+				}
+				else if (has_iv && !parse_iv(iv_attribute, &iv)) {
+					BOOST_LOG_TRIVIAL(error) << "Invalid IV: " << iv_attribute;
+					writer.clear_key();
+				}
+				else if (get_hls_attribute(value, URI_ATTRIBUTE, &uri) &&
+					 resolve_uri(uri, &https, &h, &r, &resolved_resource))
+					writer.set_key(https, h, r, has_iv ? &iv : nullptr);
+				else {
+					BOOST_LOG_TRIVIAL(error) << "Invalid key URI: " << value;
+					writer.clear_key();
+				}
+
+				break;
 			}
-		}
-		else if (*iter != tag_begin) {
-			const bool is_current_line_url = is_url(iter, line_len);
-
-			if (master_playlist) {
-				if (bandwidth > max_bandwidth) {
-					max_bandwidth = bandwidth;
-					is_line_url = is_current_line_url;
-					final_stream_information = std::move(stream_information);
-					u = std::string_view {iter, line_len};
+
+			case hls_tag::media_sequence:
+				std::from_chars(
+				    value.data(), value.data() + value.size(), sequence_number);
+				break;
+
+			case hls_tag::part:
+				part_range = {};
+
+				if (get_hls_attribute(value, BYTERANGE_ATTRIBUTE, &attribute)) {
+					byte_ranges = true;
+
+					if (!parse_byte_range(attribute,
+							      next_part_offset,
+							      &part_range)) {
+						BOOST_LOG_TRIVIAL(error)
+						    << "Invalid byte range: " << attribute;
+						part_number++;
+						break;
+					}
+
+					next_part_offset = part_range.offset + part_range.length;
 				}
+
+				// A gap is not requested, which leaves the parts of the segment
+				// incomplete once it is added.
+				if (get_hls_attribute(value, URI_ATTRIBUTE, &uri) &&
+				    !get_hls_attribute(value, GAP_ATTRIBUTE, &attribute) &&
+				    resolve_uri(uri, &https, &h, &r, &resolved_resource))
+					writer.add_part(sequence_number,
+							part_number,
+							https,
+							h,
+							r,
+							part_range,
+							false);
+
+				part_number++;
+				break;
+
+			case hls_tag::part_inf:
+				has_parts = true;
+				break;
+
+			case hls_tag::playlist_type:
+				if (value == PLAYLIST_TYPE_VOD)
+					end_list = true;
+
+				break;
+
+			case hls_tag::preload_hint: {
+				byte_range range;
+
+				// The hinted part is requested right away, and the server
+				// responds once it is available. Without a length, its range
+				// extends to the end of the part.
+				if (!get_hls_attribute(value, TYPE_ATTRIBUTE, &attribute) ||
+				    attribute != PART_TYPE)
+					break;
+
+				if (get_hls_attribute(value, BYTERANGE_START_ATTRIBUTE, &attribute))
+					std::from_chars(attribute.data(),
+							attribute.data() + attribute.size(),
+							range.offset);
+
+				if (get_hls_attribute(value,
+						      BYTERANGE_LENGTH_ATTRIBUTE,
+						      &attribute))
+					std::from_chars(attribute.data(),
+							attribute.data() + attribute.size(),
+							range.length);
+
+				if (get_hls_attribute(value, URI_ATTRIBUTE, &uri) &&
+				    resolve_uri(uri, &https, &h, &r, &resolved_resource))
+					writer.add_part(sequence_number,
+							part_number,
+							https,
+							h,
+							r,
+							range,
+							true);
+
+				break;
 			}
-			else if (is_current_line_url)
-				writer.add_segment(sequence_number,
-						   std::string_view {iter, line_len});
-			else if (*iter == resource_delimiter)
-				writer.add_segment(sequence_number,
-						   is_https,
-						   host,
-						   std::string_view {iter, line_len});
-			else {
-				std::string r {resource.substr(0, resource_prefix_len)};
-
-				r.append(iter, line_len);
-				writer.add_segment(sequence_number, is_https, host, r);
+
+			case hls_tag::server_control:
+				can_block_reload =
+				    get_hls_attribute(
+					value, CAN_BLOCK_RELOAD_ATTRIBUTE, &attribute) &&
+				    attribute == YES;
+				break;
+
+			case hls_tag::stream_inf:
+				bandwidth = 0;
+				stream_information = value;
+
+				if (get_hls_attribute(value, BANDWIDTH_ATTRIBUTE, &attribute))
+					std::from_chars(attribute.data(),
+							attribute.data() + attribute.size(),
+							bandwidth);
+
+				break;
+
+			case hls_tag::target_duration:
+				std::from_chars(
+				    value.data(), value.data() + value.size(), target_duration);
+				master_playlist = false;
+				break;
+
+			case hls_tag::uri: {
+				const auto next_sequence_number = writer.get_next_sequence_number();
+				const auto range = segment_range;
+
+				segment_range = {};
+
+				// Skip this and the following segments that have been added on a
+				// previous refresh.
+				if (!master_playlist && sequence_number < next_sequence_number) {
+					const auto known = next_sequence_number - sequence_number;
+					const auto n =
+					    byte_ranges ? 1 : tokenizer.skip_uris(known - 1) + 1;
+
+					segment_number += n;
+					sequence_number += n;
+					part_number = 0;
+					break;
+				}
+
+				const bool is_current_line_url = is_url(value.data(), value.size());
+
+				if (master_playlist) {
+					if (bandwidth > max_bandwidth) {
+						max_bandwidth = bandwidth;
+						is_line_url = is_current_line_url;
+						final_stream_information = stream_information;
+						u = value;
+					}
+				}
+				else if (resolve_uri(value, &https, &h, &r, &resolved_resource))
+					writer.add_segment(
+					    sequence_number, part_number, https, h, r, range);
+
+				segment_number++;
+				sequence_number++;
+				part_number = 0;
+				break;
 			}
 
-			segment_number++;
-			sequence_number++;
+			default:
+				break;
 		}
-
-		if (line_end == playlist_end)
-			break;
 	}
 
+	const size_t next_sequence_number = sequence_number;
+
 	sequence_number = sequence_number - segment_number;
 
 	if (master_playlist) {
 		BOOST_LOG_TRIVIAL(trace) << "Received master playlist with stream information: "
 					 << final_stream_information;
-		target_duration = 0;
+		refreshing = false;
 
 		if (is_line_url)
 			url = u;
@@ -221,13 +397,7 @@ void playlist::parse_hls_playlist(const std::vector<char>& response_body)
 			BOOST_LOG_TRIVIAL(trace) << "Media playlist URL: " << url;
 			resource_prefix_len =
 			    resource.rfind(resource_delimiter, resource.find(query_delimiter)) + 1;
-			pool->get(is_https,
-				  host,
-				  resource,
-				  std::bind(&playlist::on_initial_playlist_receive,
-					    this,
-					    std::placeholders::_1),
-				  std::bind(&playlist::on_error, this));
+			get_playlist(resource, nullptr);
 		}
 		else
 			BOOST_LOG_TRIVIAL(error) << "Invalid playlist URL: " << url;
@@ -236,33 +406,50 @@ void playlist::parse_hls_playlist(const std::vector<char>& response_body)
 		BOOST_LOG_TRIVIAL(trace)
 		    << "Received final playlist: sequence number = " << sequence_number
 		    << " segments = " << segment_number;
-		target_duration = 0;
+		refreshing = false;
+		writer.end_stream();
 	}
 	else {
 		BOOST_LOG_TRIVIAL(trace)
 		    << "Received playlist: target duration = " << target_duration
-		    << " sequence number = " << sequence_number << " segments = " << segment_number;
-
-		if (target_duration > 1)
-			target_duration = target_duration / 2;
-		else
-			target_duration = 1;
+		    << " sequence number = " << sequence_number << " segments = " << segment_number
+		    << " parts = " << part_number;
+
+		refreshing = true;
+		scheduler.set_target_duration(
+		    std::chrono::seconds(std::max<size_t>(target_duration, 1)));
+
+		// A server that ignores the directives of a blocking reload responds at once,
+		// so that the playlist is polled instead until the next refresh.
+		if (reloading && (next_sequence_number < reload_sequence_number ||
+				  (next_sequence_number == reload_sequence_number &&
+				   (reload_part_number == stream_writer::no_part ||
+				    part_number <= reload_part_number)))) {
+			BOOST_LOG_TRIVIAL(debug)
+			    << "Blocking playlist reload returned early: " << url;
+			reloading = false;
+		}
+		else if (can_block_reload)
+			reload(next_sequence_number,
+			       has_parts ? part_number : stream_writer::no_part);
 	}
-
-	period = target_duration;
 }
 
 void playlist::parse_playlist(http_response *response)
 {
-	if (response->result() == http::status::ok) {
+	if (response->result() == http::status::not_modified)
+		BOOST_LOG_TRIVIAL(trace) << "Playlist not modified.";
+	else if (response->result() == http::status::ok) {
 		const auto& content_type = response->base()[http::field::content_type];
 
 		if (content_type.size() == hls_content_type.size() &&
 		    std::equal(content_type.begin(),
 			       content_type.end(),
 			       hls_content_type.begin(),
-			       [](const auto& x, const auto& y) { return std::tolower(x) == y; }))
+			       [](const auto& x, const auto& y) { return std::tolower(x) == y; })) {
+			update_validators(*response);
 			parse_hls_playlist(response->body());
+		}
 		else {
 			BOOST_LOG_TRIVIAL(error)
 			    << "Invalid content type: " << content_type << " URL: " << url;
@@ -276,38 +463,141 @@ void playlist::parse_playlist(http_response *response)
 	}
 }
 
-bool playlist::record(const std::string_view& u)
+void playlist::reload(size_t sequence_number, size_t part_number)
+{
+	reload_resource = resource;
+	reload_resource += resource.find(query_delimiter) == std::string_view::npos
+			       ? query_delimiter
+			       : query_parameter_delimiter;
+	reload_resource += MSN_DIRECTIVE;
+	reload_resource += std::to_string(sequence_number);
+
+	if (part_number != stream_writer::no_part) {
+		reload_resource += query_parameter_delimiter;
+		reload_resource += PART_DIRECTIVE;
+		reload_resource += std::to_string(part_number);
+	}
+
+	get_playlist(reload_resource, nullptr, true);
+	reload_sequence_number = sequence_number;
+	reload_part_number = part_number;
+}
+
+bool playlist::parse_byte_range(const std::string_view& value,
+				std::uint64_t next_offset,
+				byte_range *range)
+{
+	const auto end = value.data() + value.size();
+	std::uint64_t length = 0;
+	std::uint64_t offset = next_offset;
+	auto result = std::from_chars(value.data(), end, length);
+
+	if (result.ec != std::errc() || !length)
+		return false;
+
+	if (result.ptr != end) {
+		if (*result.ptr != byte_range_offset_delimiter)
+			return false;
+
+		result = std::from_chars(result.ptr + 1, end, offset);
+
+		if (result.ec != std::errc() || result.ptr != end)
+			return false;
+	}
+
+	range->offset = offset;
+	range->length = length;
+	return true;
+}
+
+bool playlist::parse_iv(const std::string_view& value, aes_decryptor::block *iv)
+{
+	// 0x<32 hexadecimal digits>
+	if (value.size() != 2 + iv->size() * 2 || value[0] != '0' ||
+	    (value[1] != 'x' && value[1] != 'X'))
+		return false;
+
+	for (size_t i = 0; i < iv->size(); i++) {
+		const auto p = value.data() + 2 + i * 2;
+		const auto result = std::from_chars(p, p + 2, (*iv)[i], 16);
+
+		if (result.ec != std::errc() || result.ptr != p + 2)
+			return false;
+	}
+
+	return true;
+}
+
+bool playlist::resolve_uri(const std::string_view& uri,
+			   bool *https,
+			   std::string_view *h,
+			   std::string_view *r,
+			   std::string *buffer) const
+{
+	bool ret = true;
+
+	if (uri.empty())
+		ret = false;
+	else if (is_url(uri.data(), uri.size())) {
+		ret = connection_pool::parse_url(uri, https, h, r);
+
+		if (!ret)
+			BOOST_LOG_TRIVIAL(error) << "Invalid URL: " << uri;
+	}
+	else {
+		*https = is_https;
+		*h = host;
+
+		if (uri[0] == resource_delimiter)
+			*r = uri;
+		else {
+			buffer->assign(resource.substr(0, resource_prefix_len));
+			buffer->append(uri);
+			*r = *buffer;
+		}
+	}
+
+	return ret;
+}
+
+bool playlist::get_file_name(const std::string_view& u, bool remux, std::string *file_name)
+{
+	std::string_view h;
+	std::string_view r;
+	bool https;
+
+	if (!connection_pool::parse_url(u, &https, &h, &r))
+		return false;
+
+	const auto query_pos = r.find(query_delimiter);
+	auto prefix_len = r.rfind(resource_delimiter, query_pos);
+
+	if (prefix_len++ == std::string_view::npos)
+		return false;
+
+	const auto& name = r.substr(prefix_len, query_pos - prefix_len);
+	const auto extension_pos = name.find_last_of(extension_delimiter);
+
+	*file_name = name.substr(0, std::min(extension_pos, max_file_name_length));
+	file_name->append(remux ? mp4_extension : transport_stream_extension);
+	return true;
+}
+
+bool playlist::record(const std::string_view& u, const std::string& file_name)
 {
 	bool ret = false;
 
 	url = u;
 
 	if (connection_pool::parse_url(url, &is_https, &host, &resource)) {
-		const auto query_pos = resource.find(query_delimiter);
-
-		resource_prefix_len = resource.rfind(resource_delimiter, query_pos);
+		resource_prefix_len =
+		    resource.rfind(resource_delimiter, resource.find(query_delimiter));
 
 		if (resource_prefix_len++ == std::string_view::npos)
 			BOOST_LOG_TRIVIAL(error) << "Invalid playlist URL: " << u;
-		else {
-			const auto& name =
-			    resource.substr(resource_prefix_len, query_pos - resource_prefix_len);
-			const auto extension_pos = name.find_last_of(extension_delimiter);
-			std::string file_name {
-			    name.substr(0, std::min(extension_pos, max_file_name_length))};
-
-			file_name.append(transport_stream_extension);
-
-			if (writer.open(file_name)) {
-				pool->get(is_https,
-					  host,
-					  resource,
-					  std::bind(&playlist::on_initial_playlist_receive,
-						    this,
-						    std::placeholders::_1),
-					  std::bind(&playlist::on_error, this));
-				ret = true;
-			}
+		else if (writer.open(file_name)) {
+			get_playlist(resource, nullptr);
+			ret = true;
 		}
 	}
 	else
@@ -316,19 +606,22 @@ bool playlist::record(const std::string_view& u)
 	return ret;
 }
 
-void playlist::timer_handler(const boost::system::error_code& ec)
+void playlist::update_validators(const http_response& response)
 {
-	if (!ec) {
-		if (period) {
-			timer.expires_after(std::chrono::seconds(period));
-			timer.async_wait(
-			    std::bind(&playlist::timer_handler, this, std::placeholders::_1));
-		}
+	const auto& entity_tag = response[http::field::etag];
+	const auto& last_modified = response[http::field::last_modified];
 
-		pool->get(is_https,
-			  host,
-			  resource,
-			  std::bind(&playlist::parse_playlist, this, std::placeholders::_1),
-			  std::bind(&playlist::on_error, this));
-	}
+	validators.clear();
+
+	if (!entity_tag.empty())
+		validators.set(http::field::if_none_match, entity_tag);
+
+	if (!last_modified.empty())
+		validators.set(http::field::if_modified_since, last_modified);
+}
+
+void playlist::timer_handler(const boost::system::error_code& ec)
+{
+	if (!ec)
+		get_playlist(resource, &validators);
 }
@@ -3,39 +3,97 @@
 #define PLAYLIST_H
 
 #include <boost/asio.hpp>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <string_view>
 
+#include "aes_decryptor.h"
+#include "byte_range.h"
 #include "connection_pool.h"
+#include "poll_scheduler.h"
 #include "stream_writer.h"
 
 namespace asio = boost::asio;
 
 class playlist {
+		// The conditional request fields for refreshing the playlist.
+		http::fields validators;
 		std::string_view host;
 		std::string_view resource;
 		asio::steady_timer timer;
+		std::string reload_resource;
 		std::string url;
 		stream_writer writer;
-		size_t period = 0;
+		poll_scheduler scheduler;
+		// The time at which the playlist was last requested.
+		poll_scheduler::clock::time_point request_time;
 		connection_pool * const pool = nullptr;
 		std::string_view::size_type resource_prefix_len = 0;
+		// The segment and part that the last blocking reload waited for.
+		size_t reload_part_number = 0;
+		size_t reload_sequence_number = 0;
+		// Segments that have been added on a previous refresh are skipped line by line once
+		// the playlist has byte ranges, since a range may start where the previous one
+		// ends.
+		bool byte_ranges = false;
+		bool can_block_reload = false;
 		bool is_https = false;
+		// Whether the playlist is live, and no error has occurred.
+		bool refreshing = false;
+		// Whether the last request is a blocking reload.
+		bool reloading = false;
 
+		// A blocking reload is held by the server until the playlist is updated.
+		void get_playlist(const std::string_view& r,
+				  const http::fields *fields,
+				  bool blocking = false);
 		void on_error() noexcept;
-		void on_initial_playlist_receive(http_response *response);
+		void on_playlist_receive(http_response *response);
 		void parse_hls_playlist(const std::vector<char>& response_body);
 		void parse_playlist(http_response *response);
+		// Parses "<length>[@<offset>]"; without an offset, the range starts at next_offset.
+		static bool parse_byte_range(const std::string_view& value,
+					     std::uint64_t next_offset,
+					     byte_range *range);
+		// Parses an IV, which is a hexadecimal integer with a 0x prefix.
+		static bool parse_iv(const std::string_view& value, aes_decryptor::block *iv);
+		// Requests the playlist once it contains the segment or part with the sequence
+		// number, which is an LL-HLS blocking playlist reload.
+		void reload(size_t sequence_number, size_t part_number);
+		// The resource of a relative URI is stored in the buffer.
+		bool resolve_uri(const std::string_view& uri,
+				 bool *https,
+				 std::string_view *h,
+				 std::string_view *r,
+				 std::string *buffer) const;
 		void timer_handler(const boost::system::error_code& ec);
+		void update_validators(const http_response& response);
 
 	public:
-		playlist(asio::io_context *io, connection_pool *p) :
-		    timer(*io), writer(io, p), pool(p)
+		// Segments larger than range_size are downloaded as several ranges in parallel,
+		// unless range_size is 0. The budget limits the data buffered by the recording.
+		// If remux is set, the recording is fragmented MP4 rather than a transport stream.
+		playlist(asio::io_context *io,
+			 connection_pool *p,
+			 memory_budget *budget,
+			 std::uint64_t range_size,
+			 bool remux) :
+		    timer(*io), writer(io, p, budget, range_size, remux), pool(p)
 		{
 		}
 
-		bool record(const std::string_view& u);
+		~playlist();
+
+		const recording_metrics *get_metrics() const noexcept
+		{
+			return writer.get_metrics();
+		}
+
+		bool record(const std::string_view& u, const std::string& file_name);
+
+		static bool
+		get_file_name(const std::string_view& u, bool remux, std::string *file_name);
 };
 
 #endif // PLAYLIST_H
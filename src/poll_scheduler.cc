@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <chrono>
+
+#include "poll_scheduler.h"
+
+static const poll_scheduler::clock::duration min_delay = std::chrono::milliseconds(100);
+
+poll_scheduler::clock::duration poll_scheduler::get_retry_delay() const noexcept
+{
+	const auto max_delay = std::max(target_duration / 2, min_delay);
+	auto ret = std::max(jitter, min_delay);
+
+	for (unsigned i = 1; i < retries && ret < max_delay; i++)
+		ret *= 2;
+
+	return std::min(ret, max_delay);
+}
+
+poll_scheduler::clock::duration poll_scheduler::on_refresh(clock::time_point request_time,
+							   size_t new_segments)
+{
+	const auto now = clock::now();
+
+	if (!has_refreshed) {
+		// The phase of the playlist is unknown until it is seen to change.
+		has_refreshed = true;
+		previous_refresh = request_time;
+		next_refresh = now + std::max(target_duration / 2, min_delay);
+		return clock::duration::zero();
+	}
+
+	stats.refreshes++;
+
+	if (!new_segments) {
+		stats.unchanged_refreshes++;
+		retries++;
+		previous_refresh = request_time;
+		next_refresh = now + get_retry_delay();
+		return clock::duration::zero();
+	}
+
+	// The update happened after the previous refresh was requested, and before this one was.
+	const auto update = previous_refresh + (request_time - previous_refresh) / 2;
+	const auto detection_delay = now - update;
+	const auto delay_ms =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(detection_delay);
+
+	if (has_update) {
+		const auto error =
+		    (update - last_update) / static_cast<clock::rep>(new_segments) - interval;
+
+		interval = std::clamp(interval + error / 8, min_delay, target_duration);
+		jitter += ((error < error.zero() ? -error : error) - jitter) / 4;
+	}
+
+	stats.updates++;
+	stats.total_detection_delay += delay_ms;
+	stats.max_detection_delay = std::max(stats.max_detection_delay, delay_ms);
+	last_update = update;
+	previous_refresh = request_time;
+	retries = 0;
+	has_update = true;
+	next_refresh = std::max(last_update + interval + jitter, now + min_delay);
+	return detection_delay;
+}
@@ -0,0 +1,66 @@
+#ifndef POLL_SCHEDULER_H
+
+#define POLL_SCHEDULER_H
+
+#include <chrono>
+#include <cstddef>
+
+// Times the refreshes of a live playlist. The update interval of the playlist and its jitter are
+// estimated from the refreshes that bring new segments, the same way TCP estimates the round-trip
+// time, and the next refresh is scheduled just after the expected update. A refresh that brings
+// no change is retried after a delay that doubles each time, up to half the target duration.
+class poll_scheduler {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		struct statistics {
+			std::chrono::milliseconds max_detection_delay {0};
+			std::chrono::milliseconds total_detection_delay {0};
+			size_t refreshes = 0;
+			size_t unchanged_refreshes = 0;
+			size_t updates = 0;
+		};
+
+	private:
+		// The estimated time of the last update.
+		clock::time_point last_update;
+		clock::time_point next_refresh;
+		// The time at which the previous refresh was requested.
+		clock::time_point previous_refresh;
+		clock::duration interval {0};
+		clock::duration jitter {0};
+		clock::duration target_duration {0};
+		statistics stats;
+		unsigned retries = 0;
+		bool has_refreshed = false;
+		bool has_update = false;
+
+		clock::duration get_retry_delay() const noexcept;
+
+	public:
+		// The detection delay of an update is the time between the estimated update and the
+		// receipt of the playlist that contains it.
+		const statistics& get_statistics() const noexcept
+		{
+			return stats;
+		}
+
+		clock::time_point get_next_refresh_time() const noexcept
+		{
+			return next_refresh;
+		}
+
+		// Called with the time at which the refresh was requested, once the playlist is
+		// received. Returns the detection delay of the update that the refresh brings, or
+		// zero if there is none.
+		clock::duration on_refresh(clock::time_point request_time, size_t new_segments);
+		void set_target_duration(clock::duration d) noexcept
+		{
+			if (interval == clock::duration::zero() || interval > d)
+				interval = d;
+
+			target_duration = d;
+		}
+};
+
+#endif // POLL_SCHEDULER_H
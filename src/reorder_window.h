@@ -0,0 +1,75 @@
+#ifndef REORDER_WINDOW_H
+
+#define REORDER_WINDOW_H
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+// A fixed-size window of elements indexed by sequence number, starting at the sequence number of
+// the first element. An element stays at the same address until it is removed from the window.
+// Sequence numbers inside the window that no element has been inserted for are gaps.
+template<typename T, size_t N> class reorder_window {
+		static_assert(N && !(N & (N - 1)), "The window size must be a power of 2.");
+
+		std::array<std::optional<T>, N> elements;
+		size_t first = 0;
+		size_t last = 0;
+
+	public:
+		bool empty() const noexcept
+		{
+			return first == last;
+		}
+
+		// Inserts an element after all existing ones, or at the start of an empty window.
+		template<typename... Args> T& emplace(size_t sequence_number, Args&&...args)
+		{
+			if (empty())
+				first = sequence_number;
+
+			last = sequence_number + 1;
+			auto& e = elements[sequence_number & (N - 1)];
+
+			return e.emplace(std::forward<Args>(args)...);
+		}
+
+		// Returns a null pointer if the sequence number is outside the window or a gap.
+		T *find(size_t sequence_number) noexcept
+		{
+			if (sequence_number < first || sequence_number >= last)
+				return nullptr;
+
+			auto& e = elements[sequence_number & (N - 1)];
+
+			return e ? &*e : nullptr;
+		}
+
+		// Whether an element with the sequence number may be inserted.
+		bool fits(size_t sequence_number) const noexcept
+		{
+			return empty() || (sequence_number >= last && sequence_number < first + N);
+		}
+
+		// Returns a null pointer if the window starts with a gap.
+		T *front() noexcept
+		{
+			auto& e = elements[first & (N - 1)];
+
+			return e ? &*e : nullptr;
+		}
+
+		size_t front_sequence_number() const noexcept
+		{
+			return first;
+		}
+
+		void pop_front() noexcept
+		{
+			elements[first & (N - 1)].reset();
+			first++;
+		}
+};
+
+#endif // REORDER_WINDOW_H
@@ -0,0 +1,49 @@
+#ifndef RESPONSE_SINK_H
+
+#define RESPONSE_SINK_H
+
+#include <boost/beast.hpp>
+#include <cstddef>
+#include <memory>
+
+#include "block_recycler.h"
+
+namespace http = boost::beast::http;
+
+// The fields of the messages of a connection are allocated from its block recycler, except for
+// the responses that are passed to a callback.
+typedef http::basic_fields<block_allocator<char>> recycled_fields;
+typedef http::response_header<recycled_fields> response_header;
+
+// Produces a response body, which is paused while the sink processes the data passed to it.
+class body_reader {
+	public:
+		virtual ~body_reader() = default;
+
+		// Whether other responses wait behind the body, in which case the sink should not
+		// hold the data for longer than it takes to process: it may wait for one of them.
+		virtual bool blocks_responses() const noexcept
+		{
+			return false;
+		}
+
+		virtual void resume() = 0;
+};
+
+class response_sink {
+	public:
+		virtual ~response_sink() = default;
+
+		// The response body is discarded if false is returned. Called again if the request
+		// is retried after an error, or answered first by its hedge, so the body may be
+		// received more than once.
+		virtual bool on_header(const response_header& header) = 0;
+		// The data remains valid until body_reader::resume() is called, and no more data is
+		// read before that.
+		virtual void
+		on_body(const char *data, size_t size, const std::shared_ptr<body_reader>& r) = 0;
+		// Called at the end of the response body, even if it is discarded.
+		virtual void on_complete() = 0;
+};
+
+#endif // RESPONSE_SINK_H
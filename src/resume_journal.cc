@@ -0,0 +1,215 @@
+#include <boost/log/trivial.hpp>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#ifdef _WIN32
+
+#include <io.h>
+
+#else
+
+#include <unistd.h>
+
+#endif // _WIN32
+
+#include "resume_journal.h"
+
+#define MEDIA_INITIALIZATION_SECTION_RECORD "map"
+#define SEGMENT_RECORD "segment"
+
+static const std::string journal_extension = ".journal";
+static const char record_delimiter = '\n';
+// Enough for the record name and two 64-bit numbers.
+static const size_t max_record_size = 64;
+static const std::string temporary_extension = ".tmp";
+
+// Parses "<name> [<sequence number>] <size>"; the sizes only grow.
+static bool parse_record(const std::string& line, resume_journal::state *s)
+{
+	const auto name_end = line.find(' ');
+
+	if (name_end == std::string::npos)
+		return false;
+
+	const std::string_view name {line.data(), name_end};
+	const auto end = line.data() + line.size();
+	const char *p = name.data() + name_end + 1;
+	resume_journal::state next = *s;
+	std::from_chars_result result {};
+
+	if (name == SEGMENT_RECORD) {
+		result = std::from_chars(p, end, next.sequence_number);
+
+		if (result.ec != std::errc() || result.ptr == end || *result.ptr != ' ')
+			return false;
+
+		p = result.ptr + 1;
+		next.has_segment = true;
+	}
+	else if (name == MEDIA_INITIALIZATION_SECTION_RECORD)
+		next.has_media_initialization_section = true;
+	else
+		return false;
+
+	result = std::from_chars(p, end, next.size);
+
+	if (result.ec != std::errc() || result.ptr != end || next.size < s->size)
+		return false;
+
+	*s = next;
+	return true;
+}
+
+resume_journal::~resume_journal()
+{
+	if (file)
+		std::fclose(file);
+}
+
+void resume_journal::add_media_initialization_section(std::uint64_t size)
+{
+	char record[max_record_size];
+	const int n = std::snprintf(record,
+				    sizeof(record),
+				    MEDIA_INITIALIZATION_SECTION_RECORD " %llu\n",
+				    static_cast<unsigned long long>(size));
+
+	records.append(record, n);
+}
+
+void resume_journal::add_segment(size_t sequence_number, std::uint64_t size)
+{
+	char record[max_record_size];
+	const int n = std::snprintf(record,
+				    sizeof(record),
+				    SEGMENT_RECORD " %zu %llu\n",
+				    sequence_number,
+				    static_cast<unsigned long long>(size));
+
+	records.append(record, n);
+}
+
+int resume_journal::get_descriptor() const noexcept
+{
+#ifdef _WIN32
+	return _fileno(file);
+#else
+	return fileno(file);
+#endif // _WIN32
+}
+
+bool resume_journal::open(const std::string& output_name, state *s)
+{
+	std::error_code ec;
+	std::ifstream input {output_name + journal_extension, std::ios::binary};
+	const auto output_size = std::filesystem::file_size(output_name, ec);
+	std::uint64_t media_initialization_section_size = 0;
+
+	name = output_name + journal_extension;
+	*s = {};
+
+	if (input) {
+		std::string line;
+
+		// A crash may leave an incomplete record at the end, which is ignored.
+		while (std::getline(input, line, record_delimiter) && !input.eof()) {
+			if (!parse_record(line, s)) {
+				BOOST_LOG_TRIVIAL(warning) << "Invalid journal record: " << line;
+				break;
+			}
+
+			if (!s->has_segment)
+				media_initialization_section_size = s->size;
+		}
+	}
+
+	if (ec || output_size < s->size) {
+		if (s->has_media_initialization_section || s->has_segment)
+			BOOST_LOG_TRIVIAL(warning)
+			    << "Discarded journal that does not match the output file: " << name;
+
+		*s = {};
+		s->size = ec ? 0 : output_size;
+	}
+	else if (!s->has_media_initialization_section && !s->has_segment)
+		s->size = output_size;
+	else if (output_size > s->size) {
+		BOOST_LOG_TRIVIAL(info) << "Discarded " << output_size - s->size
+					<< " bytes of an incomplete segment: " << output_name;
+		std::filesystem::resize_file(output_name, s->size, ec);
+
+		if (ec) {
+			BOOST_LOG_TRIVIAL(fatal)
+			    << "Failed to truncate output file: " << output_name;
+			return false;
+		}
+	}
+
+	if (s->has_segment)
+		BOOST_LOG_TRIVIAL(info) << "Resuming after media segment " << s->sequence_number
+					<< ": " << output_name;
+
+	input.close();
+
+	// The journal is rewritten with only its last records, and then replaced at once.
+	const auto temporary_name = name + temporary_extension;
+
+	file = std::fopen(temporary_name.c_str(), "wb");
+
+	if (s->has_media_initialization_section)
+		add_media_initialization_section(media_initialization_section_size);
+
+	if (s->has_segment)
+		add_segment(s->sequence_number, s->size);
+
+	if (file && (!write() || !sync())) {
+		std::fclose(file);
+		file = nullptr;
+	}
+
+	if (file) {
+		std::fclose(file);
+		std::filesystem::rename(temporary_name, name, ec);
+		file = ec ? nullptr : std::fopen(name.c_str(), "ab");
+	}
+
+	if (!file) {
+		BOOST_LOG_TRIVIAL(fatal) << "Failed to open journal: " << name;
+		return false;
+	}
+
+	return true;
+}
+
+bool resume_journal::sync()
+{
+#ifdef _WIN32
+	const bool synced = !_commit(_fileno(file));
+#else
+	const bool synced = !::fsync(fileno(file));
+#endif // _WIN32
+
+	if (!synced)
+		BOOST_LOG_TRIVIAL(error) << "Failed to synchronize journal: " << name;
+
+	return synced;
+}
+
+bool resume_journal::write()
+{
+	const auto size = records.size();
+	const bool written =
+	    file && std::fwrite(records.data(), 1, size, file) == size && !std::fflush(file);
+
+	if (!written)
+		BOOST_LOG_TRIVIAL(error) << "Failed to write journal: " << name;
+
+	records.clear();
+	return written;
+}
@@ -0,0 +1,51 @@
+#ifndef RESUME_JOURNAL_H
+
+#define RESUME_JOURNAL_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// An append-only record of what has been written to an output file, kept next to it, by which a
+// recording resumes after the last complete segment. Each record is a line with the size of the
+// output file once the media initialization section or a segment has been written; the output
+// file is synchronized before the record is added, and the journal after. The records added
+// together are written at once, so that the journal is synchronized once for all of them.
+class resume_journal {
+	public:
+		struct state {
+			// The size of the output file.
+			std::uint64_t size = 0;
+			size_t sequence_number = 0;
+			bool has_media_initialization_section = false;
+			bool has_segment = false;
+		};
+
+	private:
+		std::string name;
+		// The records that have been added since the last write.
+		std::string records;
+		std::FILE *file = nullptr;
+
+	public:
+		resume_journal() = default;
+		resume_journal(const resume_journal&) = delete;
+		resume_journal& operator=(const resume_journal&) = delete;
+		~resume_journal();
+
+		void add_media_initialization_section(std::uint64_t size);
+		void add_segment(size_t sequence_number, std::uint64_t size);
+		// The journal may be synchronized by other means once written.
+		int get_descriptor() const noexcept;
+		// Reads the journal of the output file, if any, and truncates the output file after
+		// the last complete segment. A journal that does not match the output file is
+		// discarded.
+		bool open(const std::string& output_name, state *s);
+		// Waits for the written records to reach the disk, which blocks the thread.
+		bool sync();
+		// Writes the records added since the last write at once, without synchronizing
+		// the journal.
+		bool write();
+};
+
+#endif // RESUME_JOURNAL_H
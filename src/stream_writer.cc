@@ -1,28 +1,51 @@
 #include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/log/trivial.hpp>
+#include <charconv>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 #include <utility>
 
 #ifdef __APPLE__
 
 #include <fcntl.h>
+#include <unistd.h>
 
 #endif // __APPLE__
 
+#include "connection.h"
 #include "stream_writer.h"
 
+// Limits the number of requests for a segment that is split into ranges.
+static const std::uint64_t max_pieces = 16;
+
+stream_writer::~stream_writer()
+{
+	set_throttled(false);
+	budget->release(0, buffered_size);
+}
+
 void stream_writer::add_media_initialization_section(bool is_https,
 						     const std::string_view& host,
-						     const std::string_view& resource)
+						     const std::string_view& resource,
+						     const byte_range& range)
 {
-	if (first_segment) {
+	if (remux && first_segment) {
+		BOOST_LOG_TRIVIAL(warning)
+		    << "The segments are fragmented MP4, and are not remuxed.";
+		remux = false;
+	}
+
+	if (first_segment && !media_initialization_section_written) {
 		// Insert a placeholder element.
 		media_initialization_section.push_back(0);
+		media_initialization_range = range;
 		pool->get(is_https,
 			  host,
 			  resource,
+			  range,
 			  std::bind(&stream_writer::on_media_initialization_section_receive,
 				    this,
 				    std::placeholders::_1),
@@ -30,71 +53,119 @@ void stream_writer::add_media_initialization_section(bool is_https,
 	}
 }
 
-void stream_writer::add_media_initialization_section(const std::string_view& url)
+void stream_writer::add_part(size_t sequence_number,
+			     size_t part_number,
+			     bool is_https,
+			     const std::string_view& host,
+			     const std::string_view& resource,
+			     const byte_range& range,
+			     bool hinted)
 {
-	if (first_segment) {
-		// Insert a placeholder element.
-		media_initialization_section.push_back(0);
+	const bool is_next_part = adding_parts &&
+				  sequence_number == last_downloaded_sequence_number &&
+				  part_number == next_part_number;
+	const bool is_new_segment =
+	    sequence_number > last_downloaded_sequence_number || first_segment;
 
-		if (!pool->get(
-			url,
-			std::bind(&stream_writer::on_media_initialization_section_receive,
-				  this,
-				  std::placeholders::_1),
-			std::bind(&stream_writer::on_media_initialization_section_error, this)))
-			on_media_initialization_section_error();
+	if (is_next_part || (!part_number && is_new_segment)) {
+		if (!is_next_part)
+			begin_segment(sequence_number);
+
+		adding_parts = true;
+		next_part_number = part_number + 1;
+		add_request(sequence_number,
+			    part_number,
+			    is_https,
+			    host,
+			    resource,
+			    range,
+			    0,
+			    range.is_whole(),
+			    hinted);
 	}
 }
 
-void stream_writer::add_segment(size_t sequence_number,
+void stream_writer::add_request(size_t sequence_number,
+				size_t part_number,
 				bool is_https,
 				const std::string_view& host,
-				const std::string_view& resource)
+				const std::string_view& resource,
+				const byte_range& range,
+				size_t piece,
+				bool whole_resource,
+				bool hinted)
 {
-	if (sequence_number > last_downloaded_sequence_number || first_segment) {
-		first_segment = false;
-		last_downloaded_sequence_number = sequence_number;
-		segments_in_progress.insert(sequence_number);
-		pool->get(is_https,
-			  host,
-			  resource,
-			  std::bind(&stream_writer::on_segment_receive,
-				    this,
-				    sequence_number,
-				    std::placeholders::_1),
-			  std::bind(&stream_writer::on_segment_error, this, sequence_number));
+	if (pending_segments.empty() && segments.fits(next_entry_number) && can_request() &&
+	    !waits_for_key(next_encryption))
+		request_segment(sequence_number,
+				part_number,
+				is_https,
+				host,
+				resource,
+				range,
+				next_encryption,
+				piece,
+				whole_resource,
+				hinted);
+	else {
+		std::string url {is_https ? HTTPS_PREFIX : HTTP_PREFIX};
+
+		url.append(host);
+		url.append(resource);
+		pending_segments.push_back({std::move(url),
+					    next_encryption,
+					    range,
+					    sequence_number,
+					    part_number,
+					    piece,
+					    whole_resource,
+					    hinted});
+		update_throttling();
 	}
 }
 
-void stream_writer::add_segment(size_t sequence_number, const std::string_view& url)
+void stream_writer::add_segment(size_t sequence_number,
+				size_t num_parts,
+				bool is_https,
+				const std::string_view& host,
+				const std::string_view& resource,
+				const byte_range& range)
 {
 	if (sequence_number > last_downloaded_sequence_number || first_segment) {
-		first_segment = false;
-		last_downloaded_sequence_number = sequence_number;
-		segments_in_progress.insert(sequence_number);
+		begin_segment(sequence_number);
+		split_segment(sequence_number, is_https, host, resource, range);
+	}
+	else if (adding_parts && sequence_number == last_downloaded_sequence_number) {
+		// A part that was skipped, or that is no longer listed, leaves a gap.
+		if (num_parts != next_part_number)
+			drop_parts(is_https, host, resource, range);
 
-		if (!pool->get(url,
-			       std::bind(&stream_writer::on_segment_receive,
-					 this,
-					 sequence_number,
-					 std::placeholders::_1),
-			       std::bind(&stream_writer::on_segment_error, this, sequence_number)))
-			on_segment_error(sequence_number);
+		adding_parts = false;
+		update_journal();
 	}
 }
 
-void stream_writer::media_initialization_section_write_handler(const boost::system::error_code& ec,
-							       size_t size)
+void stream_writer::add_journal_record(const journal_record& record)
 {
-	if (ec || size != media_initialization_section.size())
-		BOOST_LOG_TRIVIAL(error) << "Failed to write media initialization section: " << size
-					 << " Error code: " << ec.what();
-	else
-		BOOST_LOG_TRIVIAL(trace) << "Wrote media initialization section.";
+	unsynced_records.push_back(record);
 
-	write_in_progress = false;
-	media_initialization_section = std::vector<char> {0};
-	write_segment();
+	// The records added meanwhile wait for the next synchronization.
+	if (!syncing)
+		sync_output();
+}
+
+size_t stream_writer::add_remuxed_output(bool final)
+{
+	if (!muxer.start())
+		return 0;
+
+	if (!media_initialization_section_written) {
+		muxer.get_initialization_segment(&media_initialization_section);
+		writing_media_initialization_section = true;
+		write_sequence.push_back(asio::buffer(media_initialization_section));
+	}
+
+	return muxer.get_fragment(final, &write_sequence);
 }
 
 void stream_writer::on_media_initialization_section_error()
@@ -106,18 +177,27 @@ void stream_writer::on_media_initialization_section_error()
 
 void stream_writer::on_media_initialization_section_receive(http_response *response)
 {
-	if (response->result() == http::status::ok) {
+	const auto& range = media_initialization_range;
+
+	if (response->result() == http::status::ok ||
+	    response->result() == http::status::partial_content) {
+		auto& body = response->body();
+
+		// The server ignored the range.
+		if (response->result() == http::status::ok && !range.is_whole()) {
+			const auto offset = std::min<std::uint64_t>(range.offset, body.size());
+			const auto size =
+			    std::min<std::uint64_t>(body.size() - offset, range.length);
+
+			body.erase(body.begin() + offset + size, body.end());
+			body.erase(body.begin(), body.begin() + offset);
+		}
+
 		BOOST_LOG_TRIVIAL(trace)
 		    << "Received media initialization section: size = " << response->body().size();
 		media_initialization_section = std::move(response->body());
-		write_in_progress = true;
-		asio::async_write(
-		    output,
-		    asio::buffer(media_initialization_section),
-		    std::bind(&stream_writer::media_initialization_section_write_handler,
-			      this,
-			      std::placeholders::_1,
-			      std::placeholders::_2));
+		writing_media_initialization_section = true;
+		gather_write();
 	}
 	else {
 		BOOST_LOG_TRIVIAL(error) << "Invalid " << response->result_int()
@@ -126,35 +206,368 @@ void stream_writer::on_media_initialization_section_receive(http_response *respo
 	}
 }
 
-void stream_writer::on_segment_error(size_t sequence_number)
+void stream_writer::begin_segment(size_t sequence_number)
 {
-	segments_in_progress.erase(sequence_number);
+	if (adding_parts)
+		BOOST_LOG_TRIVIAL(error)
+		    << "Incomplete media segment: " << last_downloaded_sequence_number;
+
+	const size_t seq_number_diff = sequence_number - last_downloaded_sequence_number;
+
+	if (!first_segment && seq_number_diff > 1) {
+		metrics.dropped_segments.add(seq_number_diff - 1);
+
+		if (seq_number_diff == 2)
+			BOOST_LOG_TRIVIAL(error)
+			    << "Dropped media segment: " << sequence_number - 1;
+		else
+			BOOST_LOG_TRIVIAL(error)
+			    << "Dropped media segments: " << last_downloaded_sequence_number + 1
+			    << " - " << sequence_number - 1;
+	}
+
+	first_segment = false;
+	adding_parts = false;
+	last_downloaded_sequence_number = sequence_number;
+	update_journal();
+}
+
+void stream_writer::decrypt(media_segment *segment,
+			    const char *data,
+			    size_t size,
+			    std::vector<char> *plaintext)
+{
+	const auto start = clock::now();
+	const bool ret = size ? segment->decryptor->update(data, size, plaintext)
+			      : segment->decryptor->finish(plaintext);
+
+	segment->decryption_time += clock::now() - start;
+	metrics.decrypted_bytes.add(size);
+
+	if (!ret) {
+		BOOST_LOG_TRIVIAL(error) << "Failed to decrypt " << *segment << ".";
+		segment->key_failed = true;
+		discard_segment(segment);
+	}
+	else if (!size)
+		metrics.decryption.record(segment->decryption_time);
+}
+
+void stream_writer::discard_segment(media_segment *segment)
+{
+	release_buffer(segment->budgeted_size);
+	segment->budgeted_size = 0;
+	pool->get_buffer_pool()->put(std::move(segment->data));
+	segment->failed = true;
+}
+
+void stream_writer::drop_parts(bool is_https,
+			       const std::string_view& host,
+			       const std::string_view& resource,
+			       const byte_range& range)
+{
+	const auto sequence_number = last_downloaded_sequence_number;
+	const auto end = segments.empty() ? next_entry_number : segments.front_sequence_number();
+	bool written = journal_pending && written_sequence_number == sequence_number;
+
+	for (auto i = next_entry_number; i > end; i--) {
+		const auto segment = segments.find(i - 1);
+
+		if (!segment || segment->sequence_number != sequence_number)
+			break;
+
+		written |= segment->write_started;
+	}
+
+	if (written) {
+		BOOST_LOG_TRIVIAL(error) << "Incomplete media segment: " << sequence_number;
+
+		// The parts that have not been written yet are dropped as well.
+		if (failed_sequence_number != sequence_number) {
+			failed_sequence_number = sequence_number;
+			metrics.dropped_segments.add(1);
+		}
+
+		if (written_sequence_number == sequence_number)
+			written_segment_failed = true;
+
+		return;
+	}
+
+	BOOST_LOG_TRIVIAL(warning) << "Incomplete parts of media segment " << sequence_number
+				   << ", requesting the whole segment.";
+
+	while (!pending_segments.empty() &&
+	       pending_segments.back().sequence_number == sequence_number)
+		pending_segments.pop_back();
+
+	for (auto i = next_entry_number; i > end; i--) {
+		const auto segment = segments.find(i - 1);
+
+		if (!segment || segment->sequence_number != sequence_number)
+			break;
+
+		segment->superseded = true;
+
+		if (!segment->failed) {
+			discard_segment(segment);
+
+			if (segment->paused_reader)
+				resume_reader(segment);
+		}
+	}
+
+	split_segment(sequence_number, is_https, host, resource, range);
 	write_segment();
 }
 
-void stream_writer::on_segment_receive(size_t sequence_number, http_response *response)
+void stream_writer::gather_write()
+{
+	const auto first = segments.front_sequence_number();
+	size_t size = 0;
+
+	if (writing_media_initialization_section) {
+		write_sequence.push_back(asio::buffer(media_initialization_section));
+		size = media_initialization_section.size();
+	}
+
+	while (num_write_entries < max_write_entries && size < max_write_size) {
+		const auto segment = segments.find(first + num_write_entries);
+
+		if (!segment || is_dropped(*segment) ||
+		    (segment->data.empty() && !segment->paused_reader))
+			break;
+
+		num_write_entries++;
+		record_reorder_wait(segment);
+		segment->write_started = true;
+
+		release_buffer(segment->budgeted_size);
+		segment->budgeted_size = 0;
+
+		if (!segment->data.empty()) {
+			segment->write_size = segment->data.size();
+			write_buffers.push_back(std::move(segment->data));
+			write_sequence.push_back(asio::buffer(write_buffers.back()));
+		}
+
+		if (segment->paused_reader) {
+			const auto n = segment->paused_size;
+
+			segment->writing_paused_data = true;
+
+			if (segment->decryptor) {
+				const auto buffers = pool->get_buffer_pool();
+				auto b = buffers->get(n + aes_decryptor::block_size);
+
+				decrypt(segment, segment->paused_data, n, &b);
+				segment->write_size += b.size();
+				write_buffers.push_back(std::move(b));
+				write_sequence.push_back(asio::buffer(write_buffers.back()));
+			}
+			else {
+				segment->write_size += n;
+				write_sequence.push_back(asio::buffer(segment->paused_data, n));
+			}
+		}
+
+		size += segment->write_size;
+
+		// More data of the entry may follow.
+		if (segment->paused_reader || !segment->complete || segment->failed)
+			break;
+	}
+
+	if (remux && num_write_entries)
+		remux_write();
+
+	start_write();
+}
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+void stream_writer::journal_sync_handler(const boost::system::error_code& ec)
+{
+	syncing = false;
+
+	if (ec)
+		BOOST_LOG_TRIVIAL(error) << "Failed to synchronize journal. Error code: "
+					 << ec.what();
+
+	if (!unsynced_records.empty())
+		sync_output();
+}
+#endif // BOOST_ASIO_HAS_IO_URING
+
+void stream_writer::on_segment_body(media_segment *segment,
+				    const char *data,
+				    size_t size,
+				    const std::shared_ptr<body_reader>& r)
 {
-	if (response->result() == http::status::ok) {
-		BOOST_LOG_TRIVIAL(trace) << "Received media segment " << sequence_number
-					 << ": size = " << response->body().size();
-		segments_in_progress.erase(sequence_number);
-		segments.push(std::make_pair(sequence_number, std::move(response->body())));
+	// Keep only the range, in a response with the whole resource, and skip the data that has
+	// been received before a retry.
+	const auto& range = segment->range;
+	const std::uint64_t offset = segment->response_offset;
+	const std::uint64_t begin = std::max(offset, segment->response_skip + segment->size);
+	const std::uint64_t end = std::min(offset + size,
+					   range.length == byte_range::unbounded
+					       ? byte_range::unbounded
+					       : segment->response_skip + range.length);
+
+	segment->response_offset += size;
+
+	if (begin < end) {
+		data += begin - offset;
+		size = end - begin;
+	}
+	else
+		size = 0;
+
+	segment->size += size;
+
+	// The rest of a segment is dropped once a piece of it has failed.
+	if (!size || segment->failed)
+		r->resume();
+	// A reader that other responses wait behind is not paused over the budget, since the
+	// entry that it would wait for may be one of them.
+	else if (segment == segments.front() ||
+		 !budget->acquire(buffered_size, size, r->blocks_responses())) {
+		// Once the budget is used up, the reader is paused until the entry can be written.
+		if (segment != segments.front()) {
+			segment->paused_by_budget = true;
+			num_throttled_readers++;
+		}
+
+		segment->paused_reader = r;
+		segment->paused_data = data;
+		segment->paused_size = size;
 		write_segment();
 	}
 	else {
+		segment->budgeted_size += size;
+		buffered_size += size;
+
+		if (segment->decryptor) {
+			reserve_data(&segment->data, size + aes_decryptor::block_size);
+			decrypt(segment, data, size, &segment->data);
+		}
+		else {
+			reserve_data(&segment->data, size);
+			segment->data.insert(segment->data.end(), data, data + size);
+		}
+
+		r->resume();
+	}
+}
+
+void stream_writer::on_segment_complete(media_segment *segment)
+{
+	BOOST_LOG_TRIVIAL(trace) << "Received " << *segment << ": size = " << segment->size;
+	segment->complete = true;
+	segment->completion_time = clock::now();
+
+	if (segment->decryptor && !segment->failed) {
+		reserve_data(&segment->data, aes_decryptor::block_size);
+		decrypt(segment, nullptr, 0, &segment->data);
+	}
+
+	if (segment->part_number == no_part && segment->range.is_whole() && !segment->failed)
+		segment_size = segment->size;
+
+	write_segment();
+}
+
+void stream_writer::on_segment_error(size_t entry_number)
+{
+	const auto segment = segments.find(entry_number);
+
+	if (segment) {
+		discard_segment(segment);
+		segment->complete = true;
+		write_segment();
+	}
+}
+
+bool stream_writer::on_segment_header(media_segment *segment,
+				      const response_header& header)
+{
+	if (is_dropped(*segment))
+		return false;
+
+	if (segment->key_failed) {
+		BOOST_LOG_TRIVIAL(error) << "Cannot decrypt " << *segment << ".";
+		discard_segment(segment);
+		return false;
+	}
+
+	// The size of the segment is only estimated, so that the last pieces may start past
+	// its end; they are empty.
+	if (header.result() == http::status::range_not_satisfiable && segment->piece &&
+	    segment->whole_resource) {
+		BOOST_LOG_TRIVIAL(trace) << "Empty " << *segment << ".";
+		return false;
+	}
+
+	if (header.result() != http::status::ok &&
+	    header.result() != http::status::partial_content) {
 		BOOST_LOG_TRIVIAL(error)
-		    << "Invalid " << response->result_int()
-		    << " media segment response: sequence_number = " << sequence_number;
-		on_segment_error(sequence_number);
+		    << "Invalid " << header.result_int() << " response: " << *segment;
+		discard_segment(segment);
+		return false;
 	}
+
+	segment->failed = false;
+	segment->response_offset = 0;
+	segment->response_skip = 0;
+
+	if (header.result() == http::status::partial_content) {
+		// Content-Range: bytes <first>-<last>/<size>
+		const auto content_range = header[http::field::content_range];
+		const auto size_pos = content_range.rfind('/');
+		std::uint64_t size;
+
+		if (segment->whole_resource && size_pos != std::string_view::npos &&
+		    std::from_chars(content_range.data() + size_pos + 1,
+				    content_range.data() + content_range.size(),
+				    size)
+			    .ec == std::errc())
+			segment_size = size;
+	}
+	else if (!segment->range.is_whole()) {
+		segment->response_skip = segment->range.offset;
+
+		if (!ranges_ignored) {
+			ranges_ignored = true;
+			BOOST_LOG_TRIVIAL(warning)
+			    << "The server ignored the range of " << *segment
+			    << ", segments are no longer split.";
+		}
+	}
+
+	return true;
 }
 
 bool stream_writer::open(const std::string& name)
 {
 	boost::system::error_code ec;
+	resume_journal::state s;
 	bool ret = false;
 
-#ifdef __APPLE__
+	if (!journal.open(name, &s))
+		return false;
+
+	// The playlist skips the segments that have been written before.
+	output_size = s.size;
+	media_initialization_section_written = s.has_media_initialization_section;
+
+	if (s.has_segment) {
+		first_segment = false;
+		last_downloaded_sequence_number = s.sequence_number;
+	}
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+	output.open(name, &metrics, ec);
+	ret = !ec;
+#elif defined(__APPLE__)
 	const int fd = ::open(name.c_str(), O_APPEND | O_CLOEXEC | O_CREAT | O_WRONLY);
 
 	if (fd >= 0) {
@@ -167,7 +580,7 @@ bool stream_writer::open(const std::string& name)
 			asio::stream_file::write_only,
 		    ec);
 	ret = !ec;
-#endif
+#endif // BOOST_ASIO_HAS_IO_URING
 
 	if (!ret)
 		BOOST_LOG_TRIVIAL(fatal) << "Failed to open output file: " << name;
@@ -175,47 +588,494 @@ bool stream_writer::open(const std::string& name)
 	return ret;
 }
 
-void stream_writer::write_handler(const boost::system::error_code& ec, size_t size)
+void stream_writer::pop_segment(bool journal)
+{
+	const auto sequence_number = segments.front()->sequence_number;
+	const bool failed = segments.front()->failed;
+
+	// An encrypted entry may end without any data after its held back block.
+	release_buffer(segments.front()->budgeted_size);
+	segments.pop_front();
+
+	if (journal_pending && sequence_number != written_sequence_number)
+		write_journal(journal);
+
+	if (sequence_number != written_sequence_number)
+		written_segment_failed = false;
+
+	written_segment_failed |= failed;
+	written_sequence_number = sequence_number;
+	written_size = output_size;
+	journal_pending = true;
+
+	if (journal)
+		update_journal();
+}
+
+void stream_writer::record_reorder_wait(media_segment *segment)
+{
+	// A complete entry waits for the earlier ones to be written.
+	if (!segment->reached_front) {
+		segment->reached_front = true;
+		metrics.reorder_wait.record(segment->complete
+						? clock::now() - segment->completion_time
+						: clock::duration::zero());
+	}
+}
+
+void stream_writer::release_buffer(size_t size)
+{
+	buffered_size -= size;
+	budget->release(buffered_size, size);
+}
+
+void stream_writer::remux_write()
+{
+	const auto first = segments.front_sequence_number();
+	const auto last = segments.find(first + num_write_entries - 1);
+
+	for (const auto& b : write_sequence)
+		demuxer.feed(static_cast<const char *>(b.data()), b.size());
+
+	write_sequence.clear();
+
+	for (size_t i = 0; i < num_write_entries; i++)
+		segments.find(first + i)->write_size = 0;
+
+	// The output is accounted to the last entry, which may be written empty.
+	if ((last->complete && !last->failed && !last->paused_reader) ||
+	    muxer.get_buffered_size() >= max_write_size)
+		last->write_size = add_remuxed_output(false);
+}
+
+void stream_writer::request_pending_segments()
+{
+	while (!pending_segments.empty() && segments.fits(next_entry_number) && can_request() &&
+	       !waits_for_key(pending_segments.front().enc)) {
+		const auto& s = pending_segments.front();
+		std::string_view host;
+		std::string_view resource;
+		bool is_https;
+
+		connection_pool::parse_url(s.url, &is_https, &host, &resource);
+		request_segment(s.sequence_number,
+				s.part_number,
+				is_https,
+				host,
+				resource,
+				s.range,
+				s.enc,
+				s.piece,
+				s.whole_resource,
+				s.hinted);
+		pending_segments.pop_front();
+	}
+
+	update_throttling();
+}
+
+void stream_writer::request_segment(size_t sequence_number,
+				    size_t part_number,
+				    bool is_https,
+				    const std::string_view& host,
+				    const std::string_view& resource,
+				    const byte_range& range,
+				    const encryption& enc,
+				    size_t piece,
+				    bool whole_resource,
+				    bool hinted)
+{
+	const auto entry_number = next_entry_number++;
+	auto& segment = segments.emplace(
+	    entry_number, this, sequence_number, part_number, range, piece, whole_resource);
+
+	if (enc.key) {
+		auto iv = enc.iv;
+
+		// Without an IV, the sequence number is used as a big-endian 128-bit integer.
+		if (!enc.has_iv)
+			for (size_t i = 0; i < sizeof(std::uint64_t); i++)
+				iv[iv.size() - 1 - i] = static_cast<unsigned char>(
+				    static_cast<std::uint64_t>(sequence_number) >> (i * 8));
+
+		segment.decryptor = std::make_unique<aes_decryptor>();
+		segment.key_failed =
+		    !enc.key->received || !segment.decryptor->init(enc.key->value, iv);
+	}
+
+	// Unlike a bind expression, the lambda is small enough to be stored in the callback
+	// without an allocation.
+	pool->get(
+	    is_https,
+	    host,
+	    resource,
+	    range,
+	    &segment,
+	    [this, entry_number] { on_segment_error(entry_number); },
+	    hinted);
+}
+
+void stream_writer::reserve_data(std::vector<char> *data, size_t size)
+{
+	auto& d = *data;
+
+	if (d.capacity() - d.size() < size) {
+		auto buffers = pool->get_buffer_pool();
+		auto b = buffers->get(d.size() + size);
+
+		b.insert(b.end(), d.cbegin(), d.cend());
+		buffers->put(std::move(d));
+		d = std::move(b);
+	}
+}
+
+void stream_writer::resume_reader(media_segment *segment)
+{
+	const auto r = std::move(segment->paused_reader);
+
+	if (segment->paused_by_budget) {
+		segment->paused_by_budget = false;
+		num_throttled_readers--;
+	}
+
+	segment->writing_paused_data = false;
+	segment->paused_data = nullptr;
+	segment->paused_size = 0;
+	r->resume();
+}
+
+void stream_writer::set_key(bool is_https,
+			    const std::string_view& host,
+			    const std::string_view& resource,
+			    const aes_decryptor::block *iv)
+{
+	next_encryption.key =
+	    pool->get_key_cache()->get(is_https,
+				       host,
+				       resource,
+				       std::bind(&stream_writer::request_pending_segments, this));
+	next_encryption.has_iv = iv;
+
+	if (iv)
+		next_encryption.iv = *iv;
+}
+
+void stream_writer::set_throttled(bool t)
+{
+	if (t != throttled) {
+		throttled = t;
+
+		if (t)
+			throttle_start = clock::now();
+		else
+			metrics.throttled.record(clock::now() - throttle_start);
+	}
+}
+
+void stream_writer::split_segment(size_t sequence_number,
+				  bool is_https,
+				  const std::string_view& host,
+				  const std::string_view& resource,
+				  const byte_range& range)
+{
+	const bool whole_resource = range.is_whole();
+	const std::uint64_t size = whole_resource ? segment_size : range.length;
+
+	// The pieces of an encrypted segment could only be decrypted in order.
+	if (!range_size || ranges_ignored || next_encryption.key || size <= range_size) {
+		add_request(sequence_number,
+			    no_part,
+			    is_https,
+			    host,
+			    resource,
+			    range,
+			    0,
+			    whole_resource,
+			    false);
+		return;
+	}
+
+	const auto piece_size = std::max(range_size, (size + max_pieces - 1) / max_pieces);
+	const auto num_pieces = (size + piece_size - 1) / piece_size;
+
+	BOOST_LOG_TRIVIAL(trace) << "Splitting media segment " << sequence_number << " into "
+				 << num_pieces << " ranges.";
+
+	for (std::uint64_t i = 0; i < num_pieces; i++) {
+		byte_range r {range.offset + i * piece_size, piece_size};
+
+		// The last piece of a segment whose size is estimated extends to its end.
+		if (i == num_pieces - 1)
+			r.length = whole_resource ? byte_range::unbounded : size - i * piece_size;
+
+		add_request(sequence_number,
+			    no_part,
+			    is_https,
+			    host,
+			    resource,
+			    r,
+			    i,
+			    whole_resource,
+			    false);
+	}
+}
+
+void stream_writer::start_write()
+{
+	auto handler = std::bind(
+	    &stream_writer::write_handler, this, std::placeholders::_1, std::placeholders::_2);
+
+	write_in_progress = true;
+	write_start = clock::now();
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+	output.async_write(write_sequence, std::move(handler));
+#else
+	asio::async_write(output, write_sequence, std::move(handler));
+#endif // BOOST_ASIO_HAS_IO_URING
+}
+
+void stream_writer::sync_handler(const boost::system::error_code& ec)
 {
-	if (ec || size != segments.top().second.size())
-		BOOST_LOG_TRIVIAL(error) << "Failed to write media segment " << segments.top().first
-					 << ": " << size << " Error code: " << ec.what();
+	if (ec)
+		BOOST_LOG_TRIVIAL(error) << "Failed to synchronize output file. Error code: "
+					 << ec.what();
 	else
-		BOOST_LOG_TRIVIAL(trace) << "Wrote media segment " << segments.top().first << ".";
+		for (const auto& r : syncing_records)
+			if (r.media_initialization_section)
+				journal.add_media_initialization_section(r.size);
+			else
+				journal.add_segment(r.sequence_number, r.size);
+
+	syncing_records.clear();
+
+	// The records are written at once, and the journal is synchronized once for all of them.
+	if (!ec && journal.write()) {
+#ifdef BOOST_ASIO_HAS_IO_URING
+		output.async_sync(
+		    std::bind(&stream_writer::journal_sync_handler, this, std::placeholders::_1),
+		    journal.get_descriptor());
+		return;
+#else
+		// Without io_uring, the journal is synchronized on the thread, like the file.
+		journal.sync();
+#endif // BOOST_ASIO_HAS_IO_URING
+	}
+
+	syncing = false;
+
+	if (!unsynced_records.empty())
+		sync_output();
+}
+
+void stream_writer::sync_output()
+{
+	syncing = true;
+	syncing_records.swap(unsynced_records);
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+	output.async_sync(
+	    std::bind(&stream_writer::sync_handler, this, std::placeholders::_1));
+#else
+	boost::system::error_code ec;
+
+	// Without io_uring, the file is synchronized on the thread.
+#ifdef __APPLE__
+	if (::fsync(output.native_handle()))
+		ec.assign(errno, boost::system::system_category());
+#else
+	output.sync_data(ec);
+#endif // __APPLE__
+
+	asio::post(output.get_executor(), std::bind(&stream_writer::sync_handler, this, ec));
+#endif // BOOST_ASIO_HAS_IO_URING
+}
+
+void stream_writer::update_journal()
+{
+	// More parts or pieces of the segment may follow.
+	if (!journal_pending ||
+	    (adding_parts && written_sequence_number == last_downloaded_sequence_number))
+		return;
+
+	if (!segments.empty() ? segments.front()->sequence_number == written_sequence_number
+			      : !pending_segments.empty() &&
+				    pending_segments.front().sequence_number ==
+					written_sequence_number)
+		return;
+
+	write_journal();
+}
+
+void stream_writer::update_throttling()
+{
+	// The pending requests that fit into the window, and whose key has been received, are
+	// held back by the budget.
+	set_throttled(num_throttled_readers ||
+		      (!pending_segments.empty() && segments.fits(next_entry_number) &&
+		       !waits_for_key(pending_segments.front().enc)));
+}
+
+void stream_writer::write_final_fragment()
+{
+	stream_ended = false;
+	demuxer.flush();
+
+	if (add_remuxed_output(true) || writing_media_initialization_section)
+		start_write();
+}
+
+void stream_writer::write_handler(const boost::system::error_code& ec, size_t size)
+{
+	const auto n = num_write_entries;
+	size_t remaining = size;
+	// The data of the write is accounted for in order.
+	const auto take = [&remaining](size_t count) {
+		count = std::min(count, remaining);
+		remaining -= count;
+		return count;
+	};
+
+	if (ec)
+		BOOST_LOG_TRIVIAL(error) << "Failed to write to the output file: " << size
+					 << " Error code: " << ec.what();
+
+	metrics.bytes.add(size);
+
+	// A remuxed write is empty until a fragment is complete.
+	if (!write_sequence.empty())
+		metrics.disk_write.record(clock::now() - write_start);
 
-	last_written_sequence_number = segments.top().first;
 	write_in_progress = false;
-	segments.pop();
+	num_write_entries = 0;
+	write_sequence.clear();
+
+	if (remux)
+		muxer.release_fragment();
+
+	for (auto& b : write_buffers)
+		pool->get_buffer_pool()->put(std::move(b));
+
+	write_buffers.clear();
+
+	if (writing_media_initialization_section) {
+		const auto s = take(media_initialization_section.size());
+
+		if (ec || s != media_initialization_section.size())
+			BOOST_LOG_TRIVIAL(error)
+			    << "Failed to write media initialization section: " << s;
+		else {
+			BOOST_LOG_TRIVIAL(trace) << "Wrote media initialization section.";
+			media_initialization_section_written = true;
+		}
+
+		output_size += s;
+		writing_media_initialization_section = false;
+		pool->get_buffer_pool()->put(std::move(media_initialization_section));
+
+		if (media_initialization_section_written)
+			add_journal_record({output_size, 0, true});
+	}
+
+	// The complete entries are removed at once, and journaled together.
+	for (size_t i = 0; i < n; i++) {
+		auto& segment = *segments.front();
+
+		output_size += take(segment.write_size);
+		segment.write_size = 0;
+
+		// The last entry may have been incomplete, and received more data since.
+		if (segment.writing_paused_data || !segment.complete || segment.failed ||
+		    !segment.data.empty())
+			break;
+
+		BOOST_LOG_TRIVIAL(trace) << "Wrote " << segment << ".";
+		pop_segment(false);
+	}
+
+	update_journal();
+
+	// The final fragment of a remuxed stream is journaled with the last segment.
+	if (remaining && !n) {
+		output_size += remaining;
+		written_size = output_size;
+
+		add_journal_record({written_size, written_sequence_number, false});
+	}
+
+	const auto segment = segments.front();
+
+	// The reader of the last entry resumes once its paused data has been written.
+	if (segment && segment->writing_paused_data)
+		resume_reader(segment);
+
 	write_segment();
 }
 
+void stream_writer::write_journal(bool sync)
+{
+	journal_pending = false;
+
+	if (!written_segment_failed)
+		metrics.segments.add(1);
+
+	if (sync)
+		add_journal_record({written_size, written_sequence_number, false});
+}
+
 void stream_writer::write_segment()
 {
-	if (write_in_progress || segments.empty() || !media_initialization_section.empty())
-		return;
+	while (!write_in_progress && !segments.empty() && media_initialization_section.empty()) {
+		auto& segment = *segments.front();
 
-	const auto& minimum =
-	    std::min_element(segments_in_progress.cbegin(), segments_in_progress.cend());
-	auto& segment = segments.top();
+		record_reorder_wait(&segment);
 
-	if (minimum != segments_in_progress.cend() && segment.first > *minimum)
-		return;
+		if (is_dropped(segment) && !segment.failed) {
+			BOOST_LOG_TRIVIAL(error) << "Dropped " << segment << ".";
+			discard_segment(&segment);
 
-	const size_t seq_number_diff = segment.first - last_written_sequence_number;
+			if (segment.paused_reader)
+				resume_reader(&segment);
+		}
+		else if (!segment.data.empty() || segment.paused_reader)
+			gather_write();
+		else if (!segment.complete)
+			break;
+		else if (segment.superseded)
+			// The whole segment follows.
+			segments.pop_front();
+		else if (segment.failed) {
+			if (segment.write_started) {
+				BOOST_LOG_TRIVIAL(error) << "Partially wrote " << segment << ".";
 
-	if (seq_number_diff > 1 && last_written_sequence_number) {
-		if (seq_number_diff == 2)
-			BOOST_LOG_TRIVIAL(error) << "Dropped media segment: " << segment.first - 1;
-		else
-			BOOST_LOG_TRIVIAL(error)
-			    << "Dropped media segments: " << last_written_sequence_number + 1
-			    << " - " << segment.first - 1;
+				// The samples of the entry that are being received are incomplete.
+				if (remux)
+					demuxer.reset();
+			}
+
+			// The following pieces of the segment would leave a gap.
+			if (segment.sequence_number != failed_sequence_number) {
+				failed_sequence_number = segment.sequence_number;
+				metrics.dropped_segments.add(1);
+			}
+
+			pop_segment();
+		}
+		else if (remux && segment.write_started) {
+			// The data of the entry was written as it was received, and its samples
+			// end a fragment, after which it is removed.
+			num_write_entries = 1;
+			segment.write_size = add_remuxed_output(false);
+			start_write();
+		}
+		else {
+			BOOST_LOG_TRIVIAL(trace) << "Wrote " << segment << ".";
+			pop_segment();
+		}
 	}
 
-	write_in_progress = true;
-	asio::async_write(
-	    output,
-	    asio::buffer(segment.second),
-	    std::bind(
-		&stream_writer::write_handler, this, std::placeholders::_1, std::placeholders::_2));
+	if (stream_ended && !write_in_progress && segments.empty() && pending_segments.empty())
+		write_final_fragment();
+
+	request_pending_segments();
 }
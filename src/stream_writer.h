@@ -4,66 +4,446 @@
 
 #include <boost/asio.hpp>
 #include <boost/asio/stream_file.hpp>
+#include <chrono>
+#include <cstdint>
 #include <deque>
 #include <functional>
+#include <limits>
 #include <memory>
-#include <queue>
-#include <set>
+#include <ostream>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 
+#include "aes_decryptor.h"
+#include "byte_range.h"
 #include "connection_pool.h"
+#include "fmp4_muxer.h"
+#include "key_cache.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "reorder_window.h"
+#include "response_sink.h"
+#include "resume_journal.h"
+#include "ts_demuxer.h"
+#include "uring_file.h"
 
 namespace asio = boost::asio;
 
 class stream_writer {
-		typedef std::pair<size_t, std::vector<char>> media_segment;
-#ifdef __APPLE__
+		typedef std::chrono::steady_clock clock;
+
+		static const size_t max_segments = 256;
+		// Limits the entries gathered into a single write, each of which takes up to two
+		// buffers.
+		static const size_t max_write_entries = 64;
+		// Limits the size of a gathered write, beyond which no further entry is added, so
+		// that the first ones are released early enough.
+		static const size_t max_write_size = 8 * 1024 * 1024;
+
+		// The key of the encrypted entries, and their IV, unless it is derived from the
+		// sequence number.
+		struct encryption {
+			std::shared_ptr<const key_cache::key> key;
+			aes_decryptor::block iv {};
+			bool has_iv = false;
+		};
+
+		struct pending_segment {
+			std::string url;
+			encryption enc;
+			byte_range range;
+			size_t sequence_number = 0;
+			size_t part_number = 0;
+			size_t piece = 0;
+			bool whole_resource = true;
+			bool hinted = false;
+		};
+
+		// A segment or part, or one of the consecutive pieces of a segment that is
+		// downloaded as several ranges.
+		class media_segment : public response_sink {
+				stream_writer * const writer = nullptr;
+
+			public:
+				std::vector<char> data;
+				std::unique_ptr<aes_decryptor> decryptor;
+				std::shared_ptr<body_reader> paused_reader;
+				clock::time_point completion_time;
+				clock::duration decryption_time {};
+				// The paused data of an encrypted entry is decrypted once it is
+				// written.
+				const char *paused_data = nullptr;
+				size_t paused_size = 0;
+				// The budget taken for the data, which may exceed its size while
+				// the last block of an encrypted entry is held back.
+				size_t budgeted_size = 0;
+				size_t response_offset = 0;
+				size_t size = 0;
+				// The size of the data of the entry in the current write.
+				size_t write_size = 0;
+				const byte_range range;
+				// The data before the range in a response with the whole resource.
+				std::uint64_t response_skip = 0;
+				const size_t sequence_number = 0;
+				// A whole segment has no part number.
+				const size_t part_number = no_part;
+				const size_t piece = 0;
+				// Whether the range was split off a segment that has no byte range
+				// of its own, whose size is only estimated.
+				const bool whole_resource = true;
+				bool complete = false;
+				bool failed = false;
+				// Whether the entry cannot be decrypted, which is final even if the
+				// request is retried.
+				bool key_failed = false;
+				bool reached_front = false;
+				// Whether the entry is a part of a segment that is downloaded whole
+				// instead.
+				bool superseded = false;
+				bool write_started = false;
+				// Whether the reader is paused because the budget is used up.
+				bool paused_by_budget = false;
+				// Whether the current write includes the paused data.
+				bool writing_paused_data = false;
+
+				media_segment(stream_writer *writer,
+					      size_t sequence_number,
+					      size_t part_number,
+					      const byte_range& range,
+					      size_t piece,
+					      bool whole_resource) :
+				    writer(writer),
+				    range(range), sequence_number(sequence_number),
+				    part_number(part_number), piece(piece),
+				    whole_resource(whole_resource)
+				{
+				}
+
+				friend std::ostream& operator<<(std::ostream& os,
+								const media_segment& s)
+				{
+					os << "media segment " << s.sequence_number;
+
+					if (s.part_number != no_part)
+						os << " part " << s.part_number;
+
+					if (s.piece)
+						os << " piece " << s.piece;
+
+					return os;
+				}
+
+				bool on_header(const response_header& header) override
+				{
+					return writer->on_segment_header(this, header);
+				}
+
+				void on_body(const char *data,
+					     size_t size,
+					     const std::shared_ptr<body_reader>& r) override
+				{
+					writer->on_segment_body(this, data, size, r);
+				}
+
+				void on_complete() override
+				{
+					writer->on_segment_complete(this);
+				}
+		};
+
+		// A record that is added to the journal once the output file has been synchronized.
+		struct journal_record {
+			std::uint64_t size = 0;
+			size_t sequence_number = 0;
+			// Otherwise, the record is of a segment.
+			bool media_initialization_section = false;
+		};
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+		typedef uring_file output_file;
+#elif defined(__APPLE__)
 		typedef asio::posix::stream_descriptor output_file;
 #else
 		typedef asio::stream_file output_file;
-#endif // __APPLE__
+#endif // BOOST_ASIO_HAS_IO_URING
 
+		// Applies to the entries that are added next.
+		encryption next_encryption;
+		// Remux the transport stream segments, as they are written, into fragmented MP4.
+		fmp4_muxer muxer;
+		ts_demuxer demuxer;
 		std::vector<char> media_initialization_section;
+		// The data of the entries in the current write, which is returned to the buffer
+		// pool once written.
+		std::vector<std::vector<char>> write_buffers;
+		// The current write, which gathers the media initialization section and the entries
+		// at the front of the window that are ready, in order.
+		std::vector<asio::const_buffer> write_sequence;
+		byte_range media_initialization_range;
+		recording_metrics metrics;
+		clock::time_point throttle_start;
+		clock::time_point write_start;
 		output_file output;
-		std::priority_queue<media_segment,
-				    std::deque<media_segment>,
-				    std::greater<media_segment>>
-		    segments;
-		std::set<size_t> segments_in_progress;
+		resume_journal journal;
+		// The records that wait for the next synchronization, and for the one in flight.
+		std::vector<journal_record> unsynced_records;
+		std::vector<journal_record> syncing_records;
+		// Segments and parts that do not fit into the window yet.
+		std::deque<pending_segment> pending_segments;
+		// Indexed by the order in which the segments and parts are added, which is also the
+		// order in which they are written.
+		reorder_window<media_segment, max_segments> segments;
+		// The data of the entries other than the first, which is taken from the budget.
+		size_t buffered_size = 0;
+		// The last segment that failed, whose remaining pieces are dropped.
+		size_t failed_sequence_number = std::numeric_limits<size_t>::max();
 		size_t last_downloaded_sequence_number = 0;
-		size_t last_written_sequence_number = 0;
+		size_t next_entry_number = 0;
+		size_t next_part_number = 0;
+		size_t num_throttled_readers = 0;
+		// The number of entries in the current write, the last of which may be incomplete.
+		size_t num_write_entries = 0;
+		// The segment of the last entry that has been written, which is journaled with the
+		// size of the output file after that entry once no more entries of it follow.
+		size_t written_sequence_number = 0;
+		std::uint64_t output_size = 0;
+		std::uint64_t written_size = 0;
+		// The size of the last segment, by which segments are split into pieces of
+		// range_size before their size is known.
+		std::uint64_t segment_size = 0;
+		const std::uint64_t range_size = 0;
 		connection_pool * const pool = nullptr;
+		memory_budget * const budget = nullptr;
+		// Whether the last downloaded segment is being added part by part.
+		bool adding_parts = false;
 		bool first_segment = true;
+		bool journal_pending = false;
+		bool media_initialization_section_written = false;
+		// Set once the server responded to a piece with the whole segment.
+		bool ranges_ignored = false;
+		bool remux = false;
+		bool syncing = false;
+		// Set once the playlist ends, so that the samples that the muxer holds back are
+		// written after the last entry.
+		bool stream_ended = false;
+		// Whether readers are paused, or requests held back, by the budget.
+		bool throttled = false;
 		bool write_in_progress = false;
+		bool writing_media_initialization_section = false;
+		// Whether an entry of the segment with written_sequence_number failed, in which
+		// case it is not counted as written.
+		bool written_segment_failed = false;
 
-		void media_initialization_section_write_handler(const boost::system::error_code& ec,
-								size_t size);
+		// Journals the record once the data written so far is durable.
+		void add_journal_record(const journal_record& record);
+		void add_request(size_t sequence_number,
+				 size_t part_number,
+				 bool is_https,
+				 const std::string_view& host,
+				 const std::string_view& resource,
+				 const byte_range& range,
+				 size_t piece,
+				 bool whole_resource,
+				 bool hinted);
+		// Appends the remuxed output to the write: the initialization segment, unless it
+		// has been written, and a fragment, which is the final one if set. Returns the size
+		// of the fragment.
+		size_t add_remuxed_output(bool final);
+		void begin_segment(size_t sequence_number);
+		// Decrypts the data of an encrypted entry, or its last block once it is complete
+		// and size is 0, and appends the plaintext to the buffer. The entry is discarded if
+		// the data cannot be decrypted.
+		void decrypt(media_segment *segment,
+			     const char *data,
+			     size_t size,
+			     std::vector<char> *plaintext);
+		// Whether more entries may be requested within the budget. The first entry of the
+		// window is always requested, since it is written without being buffered.
+		bool can_request() const noexcept
+		{
+			return segments.empty() || budget->is_available(buffered_size);
+		}
+
+		void discard_segment(media_segment *segment);
+		// Drops the parts of the segment that is being added part by part, which are
+		// incomplete, and requests the whole segment instead, unless a part has been
+		// written; the segment is then dropped.
+		void drop_parts(bool is_https,
+				const std::string_view& host,
+				const std::string_view& resource,
+				const byte_range& range);
+		// Writes the media initialization section, if it is being written, and then the
+		// entries at the front of the window that are ready, up to the first incomplete
+		// one, in a single write.
+		void gather_write();
+		bool is_dropped(const media_segment& segment) const noexcept
+		{
+			// The first entry of a segment starts it again.
+			const bool follows = segment.part_number == no_part
+						 ? segment.piece != 0
+						 : segment.part_number != 0;
+
+			return segment.superseded ||
+			       (follows && segment.sequence_number == failed_sequence_number);
+		}
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+		void journal_sync_handler(const boost::system::error_code& ec);
+#endif // BOOST_ASIO_HAS_IO_URING
 		void on_media_initialization_section_error();
 		void on_media_initialization_section_receive(http_response *response);
-		void on_segment_error(size_t sequence_number);
-		void on_segment_receive(size_t sequence_number, http_response *response);
+		void on_segment_body(media_segment *segment,
+				     const char *data,
+				     size_t size,
+				     const std::shared_ptr<body_reader>& r);
+		void on_segment_complete(media_segment *segment);
+		void on_segment_error(size_t entry_number);
+		bool on_segment_header(media_segment *segment,
+				       const response_header& header);
+		// Removes the first entry once it has been written. When several entries are
+		// removed at once, the journal may be left to the caller, which then updates it
+		// once.
+		void pop_segment(bool journal = true);
+		// Records how long the entry waited for the earlier ones, once it reaches the front
+		// of the window or is written with them.
+		void record_reorder_wait(media_segment *segment);
+		void release_buffer(size_t size);
+		// Feeds the data of the gathered entries to the demuxer, and writes a fragment
+		// instead once an entry is complete, or enough samples have been buffered.
+		void remux_write();
+		// Makes room for size more bytes in the data of an entry.
+		void reserve_data(std::vector<char> *data, size_t size);
+		void request_pending_segments();
+		void request_segment(size_t sequence_number,
+				     size_t part_number,
+				     bool is_https,
+				     const std::string_view& host,
+				     const std::string_view& resource,
+				     const byte_range& range,
+				     const encryption& enc,
+				     size_t piece,
+				     bool whole_resource,
+				     bool hinted);
+		void resume_reader(media_segment *segment);
+		void set_throttled(bool t);
+		void start_write();
+		// Splits the segment into pieces of range_size, as far as its size is known or
+		// estimated, which are downloaded in parallel.
+		void split_segment(size_t sequence_number,
+				   bool is_https,
+				   const std::string_view& host,
+				   const std::string_view& resource,
+				   const byte_range& range);
+		void sync_handler(const boost::system::error_code& ec);
+		// Makes the data written so far durable, without blocking the thread if possible,
+		// and then journals the unsynchronized records, which are written and synchronized
+		// together.
+		void sync_output();
+		// Journals the last written segment, unless more parts or pieces of it may follow.
+		void update_journal();
+		void update_throttling();
+		static bool waits_for_key(const encryption& enc) noexcept
+		{
+			return enc.key && enc.key->is_pending();
+		}
+
+		void write_final_fragment();
 		void write_handler(const boost::system::error_code& ec, size_t size);
+		// Unless sync is set, the written segment is only counted.
+		void write_journal(bool sync = true);
 		void write_segment();
 
 	public:
-		stream_writer(asio::io_context *io_ctx, connection_pool *pool) :
-		    media_initialization_section(0), output(*io_ctx), pool(pool)
+		static const size_t no_part = std::numeric_limits<size_t>::max();
+
+		// Segments larger than range_size are downloaded as several ranges in parallel,
+		// unless range_size is 0. The data of the segments that cannot be written yet is
+		// limited by the budget, which is shared with other recordings. If remux is set,
+		// transport stream segments are written as fragmented MP4.
+		stream_writer(asio::io_context *io_ctx,
+			      connection_pool *pool,
+			      memory_budget *budget,
+			      std::uint64_t range_size,
+			      bool remux) :
+		    demuxer(&muxer), media_initialization_section(0), output(*io_ctx),
+		    range_size(range_size), pool(pool), budget(budget), remux(remux)
 		{
+			write_buffers.reserve(max_write_entries * 2);
+			write_sequence.reserve(max_write_entries * 2 + 1);
 		}
 
+		stream_writer(const stream_writer&) = delete;
+		stream_writer& operator=(const stream_writer&) = delete;
+		~stream_writer();
+
+		// Only the range of each resource is written.
 		void add_media_initialization_section(bool is_https,
 						      const std::string_view& host,
-						      const std::string_view& resource);
-		void add_media_initialization_section(const std::string_view& url);
+						      const std::string_view& resource,
+						      const byte_range& range);
+		// Parts are accepted in order, starting with the first part of a segment; once the
+		// segment itself is added, it is considered complete instead of being downloaded
+		// again if num_parts parts were listed before it, and all of them were added. A
+		// hinted part is requested before it exists, and the server holds the response
+		// until it does.
+		void add_part(size_t sequence_number,
+			      size_t part_number,
+			      bool is_https,
+			      const std::string_view& host,
+			      const std::string_view& resource,
+			      const byte_range& range,
+			      bool hinted);
 		void add_segment(size_t sequence_number,
+				 size_t num_parts,
 				 bool is_https,
 				 const std::string_view& host,
-				 const std::string_view& resource);
-		void add_segment(size_t sequence_number, const std::string_view& url);
+				 const std::string_view& resource,
+				 const byte_range& range);
+		// Ends the remuxed output once the entries that have been added are written.
+		void end_stream()
+		{
+			stream_ended = remux;
+			write_segment();
+		}
+
+		// The segments and parts that are added next are no longer encrypted.
+		void clear_key() noexcept
+		{
+			next_encryption = {};
+		}
+
+		// Returns the first sequence number that add_segment accepts, or the one of the
+		// segment that is being added part by part.
+		size_t get_next_sequence_number() const noexcept
+		{
+			if (first_segment)
+				return 0;
+
+			return adding_parts ? last_downloaded_sequence_number
+					    : last_downloaded_sequence_number + 1;
+		}
+
+		recording_metrics *get_metrics() noexcept
+		{
+			return &metrics;
+		}
+
+		const recording_metrics *get_metrics() const noexcept
+		{
+			return &metrics;
+		}
+
+		// Resumes after the last complete segment in the journal of the file, if any.
 		bool open(const std::string& name);
+		// The segments and parts that are added next are decrypted with the AES-128 key at
+		// the URL, and the IV, or without one, their sequence number. They are requested
+		// once the key has been received.
+		void set_key(bool is_https,
+			     const std::string_view& host,
+			     const std::string_view& resource,
+			     const aes_decryptor::block *iv);
 };
 
 #endif // STREAM_WRITER_H
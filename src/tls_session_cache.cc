@@ -0,0 +1,89 @@
+#include <ctime>
+
+#include "tls_session_cache.h"
+
+// Servers usually send two tickets per connection, and a few are kept for the connections that
+// are established at once.
+static const size_t max_sessions_per_host = 4;
+
+static int get_cache_index()
+{
+	static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+
+	return index;
+}
+
+static int get_host_index()
+{
+	static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+
+	return index;
+}
+
+tls_session_cache::tls_session_cache(ssl::context *tls_context)
+{
+	const auto ctx = tls_context->native_handle();
+
+	// The sessions are only stored here, by host name rather than by server address.
+	SSL_CTX_set_ex_data(ctx, get_cache_index(), this);
+	SSL_CTX_set_session_cache_mode(ctx,
+				       SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, &tls_session_cache::on_new_session);
+}
+
+void tls_session_cache::on_handshake(const std::string& host, bool failed)
+{
+	if (failed)
+		sessions.erase(host);
+}
+
+int tls_session_cache::on_new_session(SSL *ssl, SSL_SESSION *session)
+{
+	const auto cache = static_cast<tls_session_cache *>(
+	    SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), get_cache_index()));
+	const auto host = static_cast<const std::string *>(SSL_get_ex_data(ssl, get_host_index()));
+
+	if (!cache || !host || !SSL_SESSION_is_resumable(session))
+		return 0;
+
+	auto& s = cache->sessions[*host];
+
+	if (s.size() == max_sessions_per_host)
+		s.erase(s.begin());
+
+	// The cache takes ownership of the session.
+	s.emplace_back(session);
+	return 1;
+}
+
+bool tls_session_cache::prepare(SSL *ssl, const std::string& host)
+{
+	if (!SSL_set_ex_data(ssl, get_host_index(), const_cast<std::string *>(&host)))
+		return false;
+
+	const auto i = sessions.find(host);
+
+	if (i == sessions.end())
+		return true;
+
+	auto& s = i->second;
+	const auto now = std::time(nullptr);
+
+	while (!s.empty()) {
+		const auto session = s.back().get();
+
+		if (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <= now)
+			s.pop_back();
+		else {
+			const bool ret = SSL_set_session(ssl, session);
+
+			// TLS 1.3 tickets are not reused, as recommended by RFC 8446.
+			if (SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION)
+				s.pop_back();
+
+			return ret;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,46 @@
+#ifndef TLS_SESSION_CACHE_H
+
+#define TLS_SESSION_CACHE_H
+
+#include <boost/asio/ssl.hpp>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <openssl/ssl.h>
+
+namespace ssl = boost::asio::ssl;
+
+// Keeps the latest TLS sessions of each host, which new connections to the host resume with an
+// abbreviated handshake. With TLS 1.3 the sessions are the tickets that the server sends after
+// the handshake, and each one is only used once.
+class tls_session_cache {
+		struct session_deleter {
+			void operator()(SSL_SESSION *s) const noexcept
+			{
+				SSL_SESSION_free(s);
+			}
+		};
+
+		typedef std::unique_ptr<SSL_SESSION, session_deleter> session_ptr;
+
+		std::unordered_map<std::string, std::vector<session_ptr>> sessions;
+
+		static int on_new_session(SSL *ssl, SSL_SESSION *session);
+
+	public:
+		explicit tls_session_cache(ssl::context *tls_context);
+		tls_session_cache(const tls_session_cache&) = delete;
+		tls_session_cache& operator=(const tls_session_cache&) = delete;
+
+		// Called once the handshake with the host has completed, or has failed, in which
+		// case the session is not resumed again.
+		void on_handshake(const std::string& host, bool failed);
+		// Sets the session to resume on a new connection to the host. The host must
+		// remain valid as long as the connection.
+		bool prepare(SSL *ssl, const std::string& host);
+};
+
+#endif // TLS_SESSION_CACHE_H
@@ -0,0 +1,814 @@
+#include <algorithm>
+#include <array>
+#include <boost/log/trivial.hpp>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "ts_demuxer.h"
+
+// Reads the bits of the RBSP of a NAL unit, as zeros past its end.
+class bit_reader {
+		const std::vector<unsigned char>& data;
+		size_t position = 0;
+
+	public:
+		bit_reader(const std::vector<unsigned char>& data, size_t position) :
+		    data(data), position(position)
+		{
+		}
+
+		bool is_valid() const noexcept
+		{
+			return position <= data.size() * 8;
+		}
+
+		unsigned read_bit() noexcept
+		{
+			const auto byte = position / 8;
+			const auto bit = 7 - position % 8;
+
+			position++;
+			return byte < data.size() ? (data[byte] >> bit) & 1 : 0;
+		}
+
+		std::uint32_t read_bits(unsigned n) noexcept
+		{
+			std::uint32_t ret = 0;
+
+			while (n--)
+				ret = (ret << 1) | read_bit();
+
+			return ret;
+		}
+
+		int read_se() noexcept
+		{
+			const auto v = read_ue();
+
+			return v & 1 ? static_cast<int>((v + 1) / 2) : -static_cast<int>(v / 2);
+		}
+
+		std::uint32_t read_ue() noexcept
+		{
+			unsigned zeros = 0;
+
+			while (!read_bit() && zeros < 31 && is_valid())
+				zeros++;
+
+			return ((std::uint32_t {1} << zeros) - 1) + read_bits(zeros);
+		}
+
+		void skip_bits(size_t n) noexcept
+		{
+			position += n;
+		}
+};
+
+struct video_parameters {
+	std::array<unsigned char, 12> profile_tier_level {};
+	unsigned bit_depth_chroma = 8;
+	unsigned bit_depth_luma = 8;
+	unsigned chroma_format = 1;
+	unsigned height = 0;
+	unsigned max_sub_layers = 1;
+	unsigned width = 0;
+	bool temporal_id_nesting = false;
+};
+
+// The samples per frame of AAC-LC and HE-AAC.
+static const unsigned aac_frame_samples = 1024;
+static const size_t adts_header_size = 7;
+static const std::array<unsigned, 13> aac_sample_rates {
+    96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
+static const unsigned char avc_stream_type = 0x1b;
+static const unsigned char hevc_stream_type = 0x24;
+static const unsigned char aac_stream_type = 0x0f;
+static const size_t pes_header_size = 9;
+static const std::uint32_t timestamp_rate = 90000;
+static const unsigned char sync_byte = 0x47;
+
+// The NAL unit types.
+static const unsigned avc_idr = 5;
+static const unsigned avc_sps = 7;
+static const unsigned avc_pps = 8;
+static const unsigned avc_aud = 9;
+static const unsigned avc_filler = 12;
+static const unsigned hevc_irap_first = 16;
+static const unsigned hevc_irap_last = 23;
+static const unsigned hevc_vps = 32;
+static const unsigned hevc_sps = 33;
+static const unsigned hevc_pps = 34;
+static const unsigned hevc_aud = 35;
+static const unsigned hevc_filler = 38;
+
+static void append_parameter_set(const std::vector<char>& unit, std::vector<char> *c)
+{
+	c->push_back(static_cast<char>(unit.size() >> 8));
+	c->push_back(static_cast<char>(unit.size()));
+	c->insert(c->end(), unit.cbegin(), unit.cend());
+}
+
+// Returns the position of the next 0x000001 start code, or the end.
+static const char *find_start_code(const char *p, const char *end)
+{
+	while (end - p >= 3) {
+		const auto q = static_cast<const char *>(std::memchr(p + 2, 1, end - p - 2));
+
+		if (!q)
+			break;
+
+		if (!q[-1] && !q[-2])
+			return q - 2;
+
+		p = q - 1;
+	}
+
+	return end;
+}
+
+// Removes the emulation prevention bytes of a NAL unit.
+static void get_rbsp(const std::vector<char>& unit, std::vector<unsigned char> *rbsp)
+{
+	unsigned zeros = 0;
+
+	rbsp->clear();
+
+	for (const auto c : unit) {
+		const auto b = static_cast<unsigned char>(c);
+
+		if (zeros >= 2 && b == 3) {
+			zeros = 0;
+			continue;
+		}
+
+		zeros = b ? 0 : zeros + 1;
+		rbsp->push_back(b);
+	}
+}
+
+// Finds the next NAL unit of an Annex B byte stream; returns false at its end.
+static bool next_nal_unit(const char **p, const char *end, std::string_view *unit)
+{
+	const char *begin = find_start_code(*p, end);
+
+	if (begin == end)
+		return false;
+
+	begin += 3;
+
+	const char *e = find_start_code(begin, end);
+
+	*p = e;
+
+	// Including the first zero byte of a four-byte start code.
+	while (e > begin && !e[-1])
+		e--;
+
+	*unit = std::string_view(begin, e - begin);
+	return true;
+}
+
+// Parses the dimensions, chroma format and bit depths of an H.264 sequence parameter set.
+static bool parse_avc_sps(const std::vector<char>& unit, video_parameters *params)
+{
+	std::vector<unsigned char> rbsp;
+
+	get_rbsp(unit, &rbsp);
+
+	if (rbsp.size() < 4)
+		return false;
+
+	// After the NAL unit header, profile_idc, the constraint flags and level_idc.
+	bit_reader r(rbsp, 32);
+	const unsigned profile = rbsp[1];
+
+	r.read_ue();
+
+	switch (profile) {
+	case 100:
+	case 110:
+	case 122:
+	case 244:
+	case 44:
+	case 83:
+	case 86:
+	case 118:
+	case 128:
+	case 138:
+	case 139:
+	case 134:
+	case 135:
+		params->chroma_format = r.read_ue();
+
+		if (params->chroma_format == 3)
+			r.skip_bits(1);
+
+		params->bit_depth_luma = r.read_ue() + 8;
+		params->bit_depth_chroma = r.read_ue() + 8;
+		r.skip_bits(1);
+
+		// The scaling matrices.
+		if (r.read_bit()) {
+			const unsigned n = params->chroma_format == 3 ? 12 : 8;
+
+			for (unsigned i = 0; i < n; i++) {
+				if (!r.read_bit())
+					continue;
+
+				int last = 8;
+				int next = 8;
+
+				for (unsigned j = 0; j < (i < 6 ? 16u : 64u) && next; j++) {
+					next = (last + r.read_se() + 256) % 256;
+					last = next ? next : last;
+				}
+			}
+		}
+
+		break;
+	default:
+		break;
+	}
+
+	r.read_ue();
+
+	const auto poc_type = r.read_ue();
+
+	if (!poc_type)
+		r.read_ue();
+	else if (poc_type == 1) {
+		r.skip_bits(1);
+		r.read_se();
+		r.read_se();
+
+		const auto n = r.read_ue();
+
+		for (std::uint32_t i = 0; i < n && r.is_valid(); i++)
+			r.read_se();
+	}
+
+	r.read_ue();
+	r.skip_bits(1);
+
+	const auto width_mbs = r.read_ue() + 1;
+	const auto height_map_units = r.read_ue() + 1;
+	const auto frame_mbs_only = r.read_bit();
+
+	if (!frame_mbs_only)
+		r.skip_bits(1);
+
+	r.skip_bits(1);
+
+	unsigned crop_left = 0;
+	unsigned crop_right = 0;
+	unsigned crop_top = 0;
+	unsigned crop_bottom = 0;
+
+	if (r.read_bit()) {
+		crop_left = r.read_ue();
+		crop_right = r.read_ue();
+		crop_top = r.read_ue();
+		crop_bottom = r.read_ue();
+	}
+
+	if (!r.is_valid())
+		return false;
+
+	const unsigned crop_x = params->chroma_format == 1 || params->chroma_format == 2 ? 2 : 1;
+	const unsigned crop_y =
+	    (params->chroma_format == 1 ? 2 : 1) * (frame_mbs_only ? 1 : 2);
+
+	params->width = width_mbs * 16 - (crop_left + crop_right) * crop_x;
+	params->height = height_map_units * 16 * (frame_mbs_only ? 1 : 2) -
+			 (crop_top + crop_bottom) * crop_y;
+	return true;
+}
+
+// Parses the profile, dimensions, chroma format and bit depths of an HEVC sequence parameter
+// set.
+static bool parse_hevc_sps(const std::vector<char>& unit, video_parameters *params)
+{
+	std::vector<unsigned char> rbsp;
+
+	get_rbsp(unit, &rbsp);
+
+	// The NAL unit header, the first byte and the general profile_tier_level.
+	if (rbsp.size() < 15)
+		return false;
+
+	params->max_sub_layers = ((rbsp[2] >> 1) & 7) + 1;
+	params->temporal_id_nesting = rbsp[2] & 1;
+	std::copy(rbsp.cbegin() + 3, rbsp.cbegin() + 15, params->profile_tier_level.begin());
+
+	bit_reader r(rbsp, 15 * 8);
+	const auto sub_layers = params->max_sub_layers - 1;
+	std::array<bool, 8> profile_present {};
+	std::array<bool, 8> level_present {};
+
+	for (unsigned i = 0; i < sub_layers; i++) {
+		profile_present[i] = r.read_bit();
+		level_present[i] = r.read_bit();
+	}
+
+	if (sub_layers)
+		r.skip_bits(2 * (8 - sub_layers));
+
+	for (unsigned i = 0; i < sub_layers; i++)
+		r.skip_bits((profile_present[i] ? 88 : 0) + (level_present[i] ? 8 : 0));
+
+	r.read_ue();
+	params->chroma_format = r.read_ue();
+
+	if (params->chroma_format == 3)
+		r.skip_bits(1);
+
+	params->width = r.read_ue();
+	params->height = r.read_ue();
+
+	if (r.read_bit()) {
+		const unsigned crop_x =
+		    params->chroma_format == 1 || params->chroma_format == 2 ? 2 : 1;
+		const unsigned crop_y = params->chroma_format == 1 ? 2 : 1;
+		const auto left = r.read_ue();
+		const auto right = r.read_ue();
+		const auto top = r.read_ue();
+		const auto bottom = r.read_ue();
+
+		params->width -= (left + right) * crop_x;
+		params->height -= (top + bottom) * crop_y;
+	}
+
+	params->bit_depth_luma = r.read_ue() + 8;
+	params->bit_depth_chroma = r.read_ue() + 8;
+	return r.is_valid();
+}
+
+static std::uint64_t read_timestamp(const unsigned char *p)
+{
+	return (std::uint64_t {p[0] & 0x0eu} << 29) | (p[1] << 22) | ((p[2] >> 1) << 15) |
+	       (p[3] << 7) | (p[4] >> 1);
+}
+
+bool ts_demuxer::configure_video(stream *s)
+{
+	const bool hevc = s->track.codec == media_codec::hevc;
+	auto& c = s->track.configuration;
+	video_parameters params;
+
+	if (s->sps.empty() || s->pps.empty() || (hevc && s->vps.empty()))
+		return false;
+
+	if (!(hevc ? parse_hevc_sps(s->sps, &params) : parse_avc_sps(s->sps, &params))) {
+		BOOST_LOG_TRIVIAL(error) << "Invalid sequence parameter set of PID " << s->pid;
+		s->sps.clear();
+		return false;
+	}
+
+	s->track.width = params.width;
+	s->track.height = params.height;
+
+	if (hevc) {
+		// The HEVCDecoderConfigurationRecord, with 4-byte NAL unit lengths.
+		c.push_back(1);
+		c.insert(c.end(),
+			 params.profile_tier_level.cbegin(),
+			 params.profile_tier_level.cend());
+		c.push_back('\xf0');
+		c.push_back(0);
+		c.push_back('\xfc');
+		c.push_back(static_cast<char>(0xfc | params.chroma_format));
+		c.push_back(static_cast<char>(0xf8 | (params.bit_depth_luma - 8)));
+		c.push_back(static_cast<char>(0xf8 | (params.bit_depth_chroma - 8)));
+		c.push_back(0);
+		c.push_back(0);
+		c.push_back(static_cast<char>((params.max_sub_layers << 3) |
+					      (params.temporal_id_nesting << 2) | 3));
+		c.push_back(3);
+
+		// The arrays are not complete, since the samples may carry other parameter sets.
+		for (const auto& [type, unit] : {std::make_pair(hevc_vps, &s->vps),
+						 std::make_pair(hevc_sps, &s->sps),
+						 std::make_pair(hevc_pps, &s->pps)}) {
+			c.push_back(static_cast<char>(type));
+			c.push_back(0);
+			c.push_back(1);
+			append_parameter_set(*unit, &c);
+		}
+	}
+	else {
+		// The AVCDecoderConfigurationRecord, with 4-byte NAL unit lengths.
+		c.push_back(1);
+		c.insert(c.end(), s->sps.cbegin() + 1, s->sps.cbegin() + 4);
+		c.push_back('\xff');
+		c.push_back('\xe1');
+		append_parameter_set(s->sps, &c);
+		c.push_back(1);
+		append_parameter_set(s->pps, &c);
+
+		switch (static_cast<unsigned char>(s->sps[1])) {
+		case 66:
+		case 77:
+		case 88:
+			break;
+		default:
+			c.push_back(static_cast<char>(0xfc | params.chroma_format));
+			c.push_back(static_cast<char>(0xf8 | (params.bit_depth_luma - 8)));
+			c.push_back(static_cast<char>(0xf8 | (params.bit_depth_chroma - 8)));
+			c.push_back(0);
+			break;
+		}
+	}
+
+	BOOST_LOG_TRIVIAL(debug) << (hevc ? "HEVC" : "H.264") << " stream of PID " << s->pid
+				 << ": " << params.width << 'x' << params.height;
+	return true;
+}
+
+void ts_demuxer::feed(const char *data, size_t size)
+{
+	const auto *p = reinterpret_cast<const unsigned char *>(data);
+
+	// Complete the packet whose beginning was received with the previous data.
+	if (partial_size) {
+		const auto n = std::min(size, packet_size - partial_size);
+
+		std::copy(p, p + n, partial_packet.begin() + partial_size);
+		partial_size += n;
+		p += n;
+		size -= n;
+
+		if (partial_size < packet_size)
+			return;
+
+		parse_packet(partial_packet.data());
+		partial_size = 0;
+	}
+
+	while (size) {
+		if (*p != sync_byte) {
+			const auto q = static_cast<const unsigned char *>(
+			    std::memchr(p, sync_byte, size));
+
+			if (!synchronization_lost)
+				BOOST_LOG_TRIVIAL(warning)
+				    << "Lost transport stream synchronization.";
+
+			synchronization_lost = true;
+
+			if (!q)
+				return;
+
+			size -= q - p;
+			p = q;
+			continue;
+		}
+
+		if (size < packet_size) {
+			std::copy(p, p + size, partial_packet.begin());
+			partial_size = size;
+			return;
+		}
+
+		parse_packet(p);
+		p += packet_size;
+		size -= packet_size;
+	}
+}
+
+void ts_demuxer::flush()
+{
+	for (size_t i = 0; i < streams.size(); i++) {
+		if (!streams[i].pes.empty())
+			parse_pes(i);
+
+		streams[i].pes.clear();
+	}
+}
+
+void ts_demuxer::parse_audio(size_t index, const char *data, size_t size, std::uint64_t pts)
+{
+	auto& track = streams[index].track;
+
+	for (std::uint64_t n = 0; size >= adts_header_size; n++) {
+		const auto p = reinterpret_cast<const unsigned char *>(data);
+		const size_t header_size = p[1] & 1 ? adts_header_size : adts_header_size + 2;
+		const size_t frame_size = ((p[3] & 3) << 11) | (p[4] << 3) | (p[5] >> 5);
+		const unsigned sampling_index = (p[2] >> 2) & 0xf;
+
+		if (p[0] != 0xff || (p[1] & 0xf6) != 0xf0 || frame_size <= header_size ||
+		    frame_size > size || sampling_index >= aac_sample_rates.size()) {
+			BOOST_LOG_TRIVIAL(debug)
+			    << "Invalid ADTS frame of PID " << streams[index].pid;
+			break;
+		}
+
+		if (track.configuration.empty()) {
+			const unsigned object_type = (p[2] >> 6) + 1;
+
+			track.channels = ((p[2] & 1) << 2) | (p[3] >> 6);
+			track.sample_rate = aac_sample_rates[sampling_index];
+			// The AudioSpecificConfig.
+			track.configuration.push_back(
+			    static_cast<char>((object_type << 3) | (sampling_index >> 1)));
+			track.configuration.push_back(
+			    static_cast<char>(((sampling_index & 1) << 7) | (track.channels << 3)));
+			BOOST_LOG_TRIVIAL(debug)
+			    << "AAC stream of PID " << streams[index].pid << ": "
+			    << track.sample_rate << " Hz, " << track.channels << " channels";
+		}
+
+		// The timestamp of a PES packet is the one of its first frame.
+		const auto t = pts + n * aac_frame_samples * timestamp_rate / track.sample_rate;
+
+		units.assign(1, std::string_view(data + header_size, frame_size - header_size));
+		sink->on_sample(index, track, t, t, true, units);
+		data += frame_size;
+		size -= frame_size;
+	}
+}
+
+void ts_demuxer::parse_packet(const unsigned char *p)
+{
+	const unsigned pid = ((p[1] & 0x1f) << 8) | p[2];
+	const bool start = p[1] & 0x40;
+	bool random_access = false;
+	size_t offset = 4;
+
+	// A packet with a transport error.
+	if (p[1] & 0x80)
+		return;
+
+	if (p[3] & 0x20) {
+		if (p[4])
+			random_access = p[5] & 0x40;
+
+		offset += 1 + p[4];
+	}
+
+	if (!(p[3] & 0x10) || offset >= packet_size)
+		return;
+
+	const auto payload = p + offset;
+	const auto size = packet_size - offset;
+
+	if (!pid) {
+		if (start)
+			parse_pat(payload, size);
+
+		return;
+	}
+
+	if (has_pmt_pid && pid == pmt_pid) {
+		if (start && !has_program)
+			parse_pmt(payload, size);
+
+		return;
+	}
+
+	const auto s = std::find_if(
+	    streams.begin(), streams.end(), [pid](const auto& s) { return s.pid == pid; });
+
+	if (s == streams.end())
+		return;
+
+	if (start) {
+		if (!s->pes.empty())
+			parse_pes(s - streams.begin());
+
+		s->pes.clear();
+		s->random_access = random_access;
+	}
+	// The rest of a PES packet whose beginning was lost.
+	else if (s->pes.empty())
+		return;
+
+	s->pes.insert(s->pes.end(), payload, payload + size);
+
+	// A PES packet with a length is complete once it has been received.
+	if (s->pes.size() >= 6) {
+		const auto h = reinterpret_cast<const unsigned char *>(s->pes.data());
+		const size_t length = (h[4] << 8) | h[5];
+
+		if (length && s->pes.size() >= 6 + length) {
+			parse_pes(s - streams.begin());
+			s->pes.clear();
+		}
+	}
+}
+
+void ts_demuxer::parse_pat(const unsigned char *p, size_t size)
+{
+	const size_t pointer = p[0];
+
+	if (pointer + 9 > size)
+		return;
+
+	p += 1 + pointer;
+	size -= 1 + pointer;
+
+	const size_t section_size = std::min<size_t>(((p[1] & 0xf) << 8) | p[2], size - 3);
+
+	// The programs are between the header and the CRC.
+	for (size_t i = 8; i + 4 + 4 <= section_size + 3; i += 4) {
+		const unsigned program = (p[i] << 8) | p[i + 1];
+
+		// Program 0 is the network information table.
+		if (program) {
+			pmt_pid = ((p[i + 2] & 0x1f) << 8) | p[i + 3];
+			has_pmt_pid = true;
+			return;
+		}
+	}
+}
+
+void ts_demuxer::parse_pes(size_t index)
+{
+	auto& s = streams[index];
+	const auto p = reinterpret_cast<const unsigned char *>(s.pes.data());
+	auto size = s.pes.size();
+
+	if (size < pes_header_size || p[0] || p[1] || p[2] != 1)
+		return;
+
+	const size_t length = (p[4] << 8) | p[5];
+	const size_t offset = pes_header_size + p[8];
+	const unsigned flags = p[7] >> 6;
+
+	if (length)
+		size = std::min(size, 6 + length);
+
+	if (offset > size)
+		return;
+
+	std::uint64_t dts = s.last_dts;
+	std::uint64_t pts = s.last_dts;
+
+	if (flags & 2) {
+		pts = unwrap(read_timestamp(p + pes_header_size));
+		dts = flags == 3 && offset >= pes_header_size + 10
+			  ? unwrap(read_timestamp(p + pes_header_size + 5))
+			  : pts;
+	}
+	// A PES packet without timestamps follows on from the previous one.
+	else if (!s.has_timestamp)
+		return;
+
+	s.last_dts = dts;
+	s.has_timestamp = true;
+
+	const auto data = s.pes.data() + offset;
+
+	if (s.track.codec == media_codec::aac)
+		parse_audio(index, data, size - offset, pts);
+	else
+		parse_video(index, data, size - offset, dts, pts);
+}
+
+void ts_demuxer::parse_pmt(const unsigned char *p, size_t size)
+{
+	const size_t pointer = p[0];
+
+	if (pointer + 13 > size)
+		return;
+
+	p += 1 + pointer;
+	size -= 1 + pointer;
+
+	const size_t section_size = std::min<size_t>(((p[1] & 0xf) << 8) | p[2], size - 3);
+	const size_t program_info_size = ((p[10] & 0xf) << 8) | p[11];
+	// Before the CRC.
+	const size_t end = section_size + 3 - 4;
+
+	if (p[0] != 2)
+		return;
+
+	has_program = true;
+
+	for (size_t i = 12 + program_info_size; i + 5 <= end;) {
+		const unsigned char type = p[i];
+		const auto pid = static_cast<std::uint16_t>(((p[i + 1] & 0x1f) << 8) | p[i + 2]);
+		media_codec codec;
+
+		i += 5 + (((p[i + 3] & 0xf) << 8) | p[i + 4]);
+
+		switch (type) {
+		case aac_stream_type:
+			codec = media_codec::aac;
+			break;
+		case avc_stream_type:
+			codec = media_codec::h264;
+			break;
+		case hevc_stream_type:
+			codec = media_codec::hevc;
+			break;
+		default:
+			BOOST_LOG_TRIVIAL(warning)
+			    << "Unsupported stream type 0x" << std::hex << unsigned {type}
+			    << std::dec << " of PID " << pid << ", which is not remuxed.";
+			continue;
+		}
+
+		streams.emplace_back();
+		streams.back().pid = pid;
+		streams.back().track.codec = codec;
+	}
+}
+
+void ts_demuxer::parse_video(
+    size_t index, const char *data, size_t size, std::uint64_t dts, std::uint64_t pts)
+{
+	auto& s = streams[index];
+	const bool hevc = s.track.codec == media_codec::hevc;
+	const char *end = data + size;
+	bool sync = s.random_access;
+	std::string_view unit;
+
+	units.clear();
+
+	while (next_nal_unit(&data, end, &unit)) {
+		if (unit.size() < (hevc ? 2 : 1))
+			continue;
+
+		const unsigned type = hevc ? (unit[0] >> 1) & 0x3f : unit[0] & 0x1f;
+		std::vector<char> *parameter_set = nullptr;
+
+		// The parameter sets stay in the samples, where they may change; the first ones
+		// also make up the configuration.
+		if (hevc) {
+			switch (type) {
+			case hevc_vps:
+				parameter_set = &s.vps;
+				break;
+			case hevc_sps:
+				parameter_set = &s.sps;
+				break;
+			case hevc_pps:
+				parameter_set = &s.pps;
+				break;
+			case hevc_aud:
+			case hevc_filler:
+				continue;
+			default:
+				sync |= type >= hevc_irap_first && type <= hevc_irap_last;
+				break;
+			}
+		}
+		else {
+			switch (type) {
+			case avc_sps:
+				parameter_set = &s.sps;
+				break;
+			case avc_pps:
+				parameter_set = &s.pps;
+				break;
+			case avc_aud:
+			case avc_filler:
+				continue;
+			default:
+				sync |= type == avc_idr;
+				break;
+			}
+		}
+
+		if (parameter_set && parameter_set->empty())
+			parameter_set->assign(unit.cbegin(), unit.cend());
+
+		units.push_back(unit);
+	}
+
+	// The samples before the configuration cannot be decoded.
+	if (s.track.configuration.empty() && !configure_video(&s))
+		return;
+
+	if (!units.empty())
+		sink->on_sample(index, s.track, dts, pts, sync, units);
+}
+
+void ts_demuxer::reset() noexcept
+{
+	for (auto& s : streams)
+		s.pes.clear();
+
+	partial_size = 0;
+}
+
+std::uint64_t ts_demuxer::unwrap(std::uint64_t t) noexcept
+{
+	// About 26.5 hours.
+	static const std::uint64_t period = std::uint64_t {1} << 33;
+
+	if (has_reference) {
+		t |= reference & ~(period - 1);
+
+		if (t + period / 2 < reference)
+			t += period;
+		else if (t > reference + period / 2 && t >= period)
+			t -= period;
+	}
+
+	reference = t;
+	has_reference = true;
+	return t;
+}
@@ -0,0 +1,108 @@
+#ifndef TS_DEMUXER_H
+
+#define TS_DEMUXER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+enum class media_codec { aac, h264, hevc };
+
+// A track of a demultiplexed stream, whose configuration is known from its first sample on.
+struct media_track {
+	// The AVCDecoderConfigurationRecord, HEVCDecoderConfigurationRecord or
+	// AudioSpecificConfig.
+	std::vector<char> configuration;
+	media_codec codec = media_codec::h264;
+	unsigned width = 0;
+	unsigned height = 0;
+	unsigned channels = 0;
+	unsigned sample_rate = 0;
+};
+
+// Receives the samples of each track of a demultiplexed stream in decoding order.
+class sample_sink {
+	public:
+		virtual ~sample_sink() = default;
+
+		// The timestamps are in units of 90 kHz. A video sample consists of NAL units
+		// without their start codes, and an audio sample of a single raw frame.
+		virtual void on_sample(size_t track_index,
+				       const media_track& track,
+				       std::uint64_t dts,
+				       std::uint64_t pts,
+				       bool sync,
+				       const std::vector<std::string_view>& units) = 0;
+};
+
+// Demultiplexes the H.264, HEVC and ADTS AAC streams of the first program of an MPEG transport
+// stream, as it is received in chunks of any size.
+class ts_demuxer {
+	public:
+		static const size_t packet_size = 188;
+
+	private:
+		struct stream {
+			media_track track;
+			// The PES packet that is being received.
+			std::vector<char> pes;
+			// The first parameter sets of a video stream, from which its
+			// configuration is built.
+			std::vector<char> vps;
+			std::vector<char> sps;
+			std::vector<char> pps;
+			std::uint64_t last_dts = 0;
+			std::uint16_t pid = 0;
+			bool has_timestamp = false;
+			// Set by the adaptation field of the first packet of the PES packet.
+			bool random_access = false;
+		};
+
+		std::array<unsigned char, packet_size> partial_packet {};
+		std::vector<stream> streams;
+		// The NAL units or the frame of the sample that is passed to the sink.
+		std::vector<std::string_view> units;
+		sample_sink * const sink = nullptr;
+		size_t partial_size = 0;
+		// The last timestamp, by which the following ones are unwrapped.
+		std::uint64_t reference = 0;
+		std::uint16_t pmt_pid = 0;
+		bool has_pmt_pid = false;
+		bool has_program = false;
+		bool has_reference = false;
+		bool synchronization_lost = false;
+
+		bool configure_video(stream *s);
+		void parse_audio(size_t index, const char *data, size_t size, std::uint64_t pts);
+		void parse_packet(const unsigned char *p);
+		void parse_pat(const unsigned char *p, size_t size);
+		void parse_pes(size_t index);
+		void parse_pmt(const unsigned char *p, size_t size);
+		void parse_video(size_t index,
+				 const char *data,
+				 size_t size,
+				 std::uint64_t dts,
+				 std::uint64_t pts);
+		// Extends a 33-bit timestamp to 64 bits, so that it keeps increasing once it
+		// wraps around.
+		std::uint64_t unwrap(std::uint64_t t) noexcept;
+
+	public:
+		explicit ts_demuxer(sample_sink *sink) : sink(sink)
+		{
+		}
+
+		ts_demuxer(const ts_demuxer&) = delete;
+		ts_demuxer& operator=(const ts_demuxer&) = delete;
+
+		void feed(const char *data, size_t size);
+		// Ends the PES packets that are being received, which is only known once the next
+		// one starts unless they have a length.
+		void flush();
+		// Drops the data that is being received, after a gap in the stream.
+		void reset() noexcept;
+};
+
+#endif // TS_DEMUXER_H
@@ -0,0 +1,305 @@
+#ifdef BOOST_ASIO_HAS_IO_URING
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/log/trivial.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "uring_file.h"
+
+static const size_t fixed_buffer_size = 256 * 1024;
+static const unsigned num_fixed_buffers = 8;
+// The user data of a synchronization, which is not the index of a fixed buffer.
+static const uintptr_t sync_data = UINTPTR_MAX;
+
+uring_file::~uring_file()
+{
+	if (ring_initialized)
+		io_uring_queue_exit(&ring);
+
+	if (fd >= 0)
+		::close(fd);
+}
+
+void uring_file::async_sync(sync_handler&& handler, int descriptor)
+{
+	sync_in_flight = std::move(handler);
+	sync_descriptor = descriptor;
+	prepare_sync();
+	submit();
+}
+
+void uring_file::async_write(const std::vector<asio::const_buffer>& data,
+			     write_handler&& handler)
+{
+	auto& o = operations.emplace_back();
+
+	o.data = data.data();
+	o.num_buffers = data.size();
+	o.size = asio::buffer_size(data);
+	o.handler = std::move(handler);
+
+	if (o.size)
+		submit();
+	else
+		asio::post(event.get_executor(), std::bind(&uring_file::complete, this));
+}
+
+void uring_file::complete()
+{
+	while (!operations.empty() && operations.front().completed == operations.front().size) {
+		auto o = std::move(operations.front());
+
+		operations.pop_front();
+		o.handler(o.ec, o.written);
+	}
+}
+
+void uring_file::on_event(const boost::system::error_code& ec)
+{
+	if (ec == asio::error::operation_aborted)
+		return;
+
+	uint64_t count;
+	io_uring_cqe *cqe;
+
+	waiting = false;
+
+	// Reset the event counter before reaping, so that no completion is missed.
+	while (::read(event.native_handle(), &count, sizeof(count)) > 0)
+		;
+
+	while (!io_uring_peek_cqe(&ring, &cqe)) {
+		const auto index = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+		const int result = cqe->res;
+
+		io_uring_cqe_seen(&ring, cqe);
+
+		if (index == sync_data)
+			on_sync_complete(result);
+		else
+			on_write_complete(index, result);
+	}
+
+	submit();
+	complete();
+}
+
+void uring_file::on_sync_complete(int result)
+{
+	boost::system::error_code ec;
+
+	if (result == -EINTR || result == -EAGAIN) {
+		prepare_sync();
+		return;
+	}
+
+	if (result < 0)
+		ec.assign(-result, boost::system::system_category());
+
+	// The handler may start another synchronization once the completions have been reaped.
+	asio::post(event.get_executor(), std::bind(std::move(sync_in_flight), ec));
+	sync_in_flight = nullptr;
+}
+
+void uring_file::on_write_complete(unsigned index, int result)
+{
+	auto& b = buffers[index];
+
+	queue_depth--;
+	metrics->io_uring_write.record(std::chrono::steady_clock::now() - b.start);
+	metrics->io_uring_queue_depth.set(queue_depth);
+
+	if (result == -EINTR || result == -EAGAIN) {
+		prepare_write(index);
+		return;
+	}
+
+	if (result > 0) {
+		b.written += result;
+		b.operation->written += result;
+
+		// Retry a short write.
+		if (b.written < b.size) {
+			prepare_write(index);
+			return;
+		}
+	}
+	else if (!b.operation->ec)
+		b.operation->ec = boost::system::error_code {result ? -result : EIO,
+							     boost::system::system_category()};
+
+	b.operation->completed += b.size;
+	b.operation = nullptr;
+	free_buffers.push_back(index);
+}
+
+void uring_file::open(const std::string& name,
+		      recording_metrics *m,
+		      boost::system::error_code& ec)
+{
+	metrics = m;
+	fd = ::open(name.c_str(), O_CLOEXEC | O_CREAT | O_WRONLY, 0644);
+
+	if (fd < 0) {
+		ec.assign(errno, boost::system::system_category());
+		return;
+	}
+
+	// The writes are positioned explicitly, so that several of them may be in flight.
+	const auto size = ::lseek(fd, 0, SEEK_END);
+	const int event_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (size < 0 || event_fd < 0) {
+		ec.assign(errno, boost::system::system_category());
+		return;
+	}
+
+	offset = size;
+	event.assign(event_fd, ec);
+
+	if (ec)
+		return;
+
+	int ret = io_uring_queue_init(num_fixed_buffers * 2, &ring, 0);
+
+	if (ret < 0) {
+		ec.assign(-ret, boost::system::system_category());
+		return;
+	}
+
+	std::vector<iovec> iovecs(num_fixed_buffers);
+
+	ring_initialized = true;
+	buffer_memory.resize(fixed_buffer_size * num_fixed_buffers);
+	buffers.resize(num_fixed_buffers);
+
+	for (unsigned i = 0; i < num_fixed_buffers; i++) {
+		iovecs[i].iov_base = buffer_memory.data() + i * fixed_buffer_size;
+		iovecs[i].iov_len = fixed_buffer_size;
+		free_buffers.push_back(num_fixed_buffers - i - 1);
+	}
+
+	ret = io_uring_register_buffers(&ring, iovecs.data(), iovecs.size());
+
+	if (!ret)
+		ret = io_uring_register_files(&ring, &fd, 1);
+
+	if (!ret)
+		ret = io_uring_register_eventfd(&ring, event_fd);
+
+	if (ret < 0)
+		ec.assign(-ret, boost::system::system_category());
+}
+
+void uring_file::prepare_sync()
+{
+	auto sqe = io_uring_get_sqe(&ring);
+
+	// The output file is registered, unlike the others.
+	if (sync_descriptor < 0) {
+		io_uring_prep_fsync(sqe, 0, IORING_FSYNC_DATASYNC);
+		io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+	}
+	else
+		io_uring_prep_fsync(sqe, sync_descriptor, IORING_FSYNC_DATASYNC);
+
+	io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(sync_data));
+	num_prepared++;
+}
+
+void uring_file::prepare_write(unsigned index)
+{
+	auto& b = buffers[index];
+	auto sqe = io_uring_get_sqe(&ring);
+
+	b.start = std::chrono::steady_clock::now();
+	io_uring_prep_write_fixed(sqe,
+				  0,
+				  buffer_memory.data() + index * fixed_buffer_size + b.written,
+				  b.size - b.written,
+				  b.offset + b.written,
+				  index);
+	io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+	io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(static_cast<uintptr_t>(index)));
+	num_prepared++;
+	queue_depth++;
+	metrics->io_uring_queue_depth.set(queue_depth);
+}
+
+void uring_file::submit()
+{
+	for (auto& o : operations) {
+		// Do not start the rest of a failed write.
+		if (o.ec) {
+			o.completed += o.size - o.submitted;
+			o.submitted = o.size;
+		}
+
+		while (o.submitted < o.size && !free_buffers.empty()) {
+			const auto index = free_buffers.back();
+			auto& b = buffers[index];
+			char *p = buffer_memory.data() + index * fixed_buffer_size;
+
+			free_buffers.pop_back();
+			b.operation = &o;
+			b.offset = offset;
+			b.size = std::min(fixed_buffer_size, o.size - o.submitted);
+			b.written = 0;
+
+			// Small buffers are packed together, so that they take a single write.
+			for (size_t n = b.size; n;) {
+				const auto& d = o.data[o.buffer_index];
+				const auto size = std::min(n, d.size() - o.buffer_offset);
+
+				std::memcpy(p,
+					    static_cast<const char *>(d.data()) + o.buffer_offset,
+					    size);
+				p += size;
+				n -= size;
+				o.buffer_offset += size;
+
+				if (o.buffer_offset == d.size()) {
+					o.buffer_index++;
+					o.buffer_offset = 0;
+				}
+			}
+
+			o.submitted += b.size;
+			offset += b.size;
+			prepare_write(index);
+		}
+	}
+
+	if (num_prepared) {
+		const int ret = io_uring_submit(&ring);
+
+		if (ret < 0)
+			BOOST_LOG_TRIVIAL(error) << "Failed to submit output file writes: " << -ret;
+		else
+			num_prepared = 0;
+	}
+
+	if (queue_depth || sync_in_flight)
+		wait();
+}
+
+void uring_file::wait()
+{
+	if (!waiting) {
+		waiting = true;
+		event.async_wait(asio::posix::stream_descriptor::wait_read,
+				 std::bind(&uring_file::on_event, this, std::placeholders::_1));
+	}
+}
+
+#endif // BOOST_ASIO_HAS_IO_URING
@@ -0,0 +1,108 @@
+#ifndef URING_FILE_H
+
+#define URING_FILE_H
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <liburing.h>
+
+#include "metrics.h"
+
+namespace asio = boost::asio;
+
+// An append-only output file that is written through a dedicated io_uring instance, with the
+// file and a set of fixed buffers registered in advance. A write is gathered into the fixed
+// buffers, so several parts of it may be in flight at the same time. The file, and others such
+// as its journal, are synchronized through the ring as well, so that the thread does not block
+// on the disk.
+class uring_file {
+	public:
+		typedef std::function<void(const boost::system::error_code&)> sync_handler;
+		typedef std::function<void(const boost::system::error_code&, size_t)>
+		    write_handler;
+
+	private:
+		struct write_operation {
+			boost::system::error_code ec;
+			write_handler handler;
+			const asio::const_buffer *data = nullptr;
+			size_t num_buffers = 0;
+			// The position of the next data to submit.
+			size_t buffer_index = 0;
+			size_t buffer_offset = 0;
+			size_t size = 0;
+			size_t submitted = 0;
+			size_t completed = 0;
+			size_t written = 0;
+		};
+
+		struct fixed_buffer {
+			std::chrono::steady_clock::time_point start;
+			uint64_t offset = 0;
+			write_operation *operation = nullptr;
+			size_t size = 0;
+			size_t written = 0;
+		};
+
+		io_uring ring;
+		asio::posix::stream_descriptor event;
+		std::vector<char> buffer_memory;
+		std::vector<fixed_buffer> buffers;
+		std::vector<unsigned> free_buffers;
+		std::deque<write_operation> operations;
+		// The handler of the synchronization in flight, if any.
+		sync_handler sync_in_flight;
+		recording_metrics *metrics = nullptr;
+		uint64_t offset = 0;
+		// The file of the synchronization in flight, or -1 for the output file.
+		int sync_descriptor = -1;
+		// The writes that have been prepared but not yet submitted, and the ones that
+		// have been submitted but have not completed.
+		unsigned num_prepared = 0;
+		unsigned queue_depth = 0;
+		int fd = -1;
+		bool ring_initialized = false;
+		bool waiting = false;
+
+		void complete();
+		void on_event(const boost::system::error_code& ec);
+		void on_sync_complete(int result);
+		void on_write_complete(unsigned index, int result);
+		void prepare_sync();
+		void prepare_write(unsigned index);
+		void submit();
+		void wait();
+
+	public:
+		uring_file(asio::io_context& io) : event(io)
+		{
+		}
+
+		uring_file(const uring_file&) = delete;
+		uring_file& operator=(const uring_file&) = delete;
+		~uring_file();
+
+		// Waits for the data of the writes that have completed to reach the disk, or for
+		// that of another file if a descriptor is given. One synchronization may be in
+		// flight at a time.
+		void async_sync(sync_handler&& handler, int descriptor = -1);
+		// The buffers and their data must remain valid until the handler is called.
+		void async_write(const std::vector<asio::const_buffer>& data,
+				 write_handler&& handler);
+		// The writes are recorded in the metrics, which must outlive the file.
+		void open(const std::string& name,
+			  recording_metrics *m,
+			  boost::system::error_code& ec);
+};
+
+#endif // BOOST_ASIO_HAS_IO_URING
+
+#endif // URING_FILE_H